@@ -109,9 +109,9 @@ CSP_BROADCAST_ADDR  = CSP_ID_HOST_MAX
 CSP_DEFAULT_ROUTE   = CSP_ID_HOST_MAX + 1
 
 # CSP Flags
-CSP_FRES1			= 0x80 # Reserved for future use
+CSP_FRFRAG			= 0x80 # Router fragment, reassembled by the destination
 CSP_FRES2			= 0x40 # Reserved for future use
-CSP_FRES3			= 0x20 # Reserved for future use
+CSP_FCOMP			= 0x20 # Payload compressed by the link
 CSP_FRES4			= 0x10 # Reserved for future use
 CSP_FHMAC			= 0x08 # Use HMAC verification/generation
 CSP_FXTEA			= 0x04 # Use XTEA encryption/decryption
@@ -45,8 +45,8 @@ csp_iface_t csp_if_fifo = {
 };
 
 int csp_fifo_tx(csp_iface_t *ifc, csp_packet_t *packet, uint32_t timeout) {
-    /* Write packet to fifo */
-    if (write(tx_channel, &packet->length, packet->length + sizeof(uint32_t) + sizeof(uint16_t)) < 0)
+    /* Write packet to fifo, the length follows from the size of the read */
+    if (write(tx_channel, &packet->id, packet->length + sizeof(packet->id)) < 0)
         printf("Failed to write frame\r\n");
     csp_buffer_free(packet);
     return CSP_ERR_NONE;
@@ -54,8 +54,10 @@ int csp_fifo_tx(csp_iface_t *ifc, csp_packet_t *packet, uint32_t timeout) {
 
 void * fifo_rx(void * parameters) {
     csp_packet_t *buf = csp_buffer_get(BUF_SIZE);
+    ssize_t len;
     /* Wait for packet on fifo */
-    while (read(rx_channel, &buf->length, BUF_SIZE) > 0) {
+    while ((len = read(rx_channel, &buf->id, BUF_SIZE)) >= (ssize_t) sizeof(buf->id)) {
+        buf->length = len - sizeof(buf->id);
         csp_new_packet(buf, &csp_if_fifo, NULL);
         buf = csp_buffer_get(BUF_SIZE);
     }
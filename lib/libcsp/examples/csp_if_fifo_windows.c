@@ -35,10 +35,10 @@ csp_iface_t csp_if_fifo = {
 
 int csp_fifo_tx(csp_packet_t *packet, uint32_t timeout) {
     printf("csp_fifo_tx tid: %lu\n", GetCurrentThreadId());
-    DWORD expectedSent = packet->length + sizeof(uint32_t) + sizeof(uint16_t);
+    DWORD expectedSent = packet->length + sizeof(packet->id);
     DWORD actualSent;
-    /* Write packet to fifo */
-    if( !WriteFile(pipe, &packet->length, expectedSent, &actualSent, NULL)
+    /* Write packet to fifo, the length follows from the size of the read */
+    if( !WriteFile(pipe, &packet->id, expectedSent, &actualSent, NULL)
             || actualSent != expectedSent ) {
         printError();
     }
@@ -209,12 +209,13 @@ unsigned WINAPI fifo_rx(void *handle) {
 
     while(1) {
         readSuccess = 
-            ReadFile(pipe, &buf->length, BUF_SIZE, &bytesRead, NULL);
-        if( !readSuccess || bytesRead == 0 ) {
+            ReadFile(pipe, &buf->id, BUF_SIZE, &bytesRead, NULL);
+        if( !readSuccess || bytesRead < sizeof(buf->id) ) {
             csp_buffer_free(buf);
             printError();
             break;
         }
+        buf->length = bytesRead - sizeof(buf->id);
         csp_new_packet(buf, &csp_if_fifo, NULL);
         buf = csp_buffer_get(BUF_SIZE);
     }
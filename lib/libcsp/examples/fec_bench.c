@@ -0,0 +1,205 @@
+/**
+ * Benchmark of Reed-Solomon FEC on KISS links.
+ *
+ * Build this example on linux with:
+ * ./waf configure --enable-examples --enable-if-kiss --enable-crc32 --enable-fec clean build
+ *
+ * First the codec speed is measured. Then packets are sent between two KISS
+ * interfaces in this process over a stand-in link that flips bits at the
+ * given bit error rate, once without FEC and once with FEC, and the number
+ * of packets delivered and the goodput are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <csp/csp.h>
+#include <csp/csp_fec.h>
+#include <csp/interfaces/csp_if_kiss.h>
+
+#define MY_ADDRESS	1
+#define PORT		10
+
+static csp_iface_t if_tx, if_rx;
+static csp_kiss_handle_t kiss_tx, kiss_rx;
+
+/* Stand-in link state */
+static double ber = 1e-4;
+static unsigned int burst = 0;
+static unsigned long line_bytes;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random number in [0, 1) */
+static double frand(void) {
+	return rand() / (RAND_MAX + 1.0);
+}
+
+/* Deliver one byte from the transmitting to the receiving interface, with errors */
+static void link_putc(char c) {
+
+	static unsigned int burst_left = 0;
+	uint8_t byte = c;
+	int bit;
+
+	line_bytes++;
+
+	for (bit = 0; bit < 8; bit++) {
+		if (frand() < ber) {
+			byte ^= 1 << bit;
+			burst_left = burst;
+		}
+	}
+
+	/* Bursts replace the following bytes with noise */
+	if (burst_left > 0) {
+		burst_left--;
+		byte = rand();
+	}
+
+	csp_kiss_rx(&if_rx, &byte, 1, NULL);
+
+}
+
+static void bench_codec(unsigned int size, uint8_t depth) {
+
+	uint8_t frame[CSP_FEC_ENCODED_MAX(300)];
+	unsigned int i, count = 20000;
+	int len = 0;
+
+	for (i = 0; i < size; i++)
+		frame[i] = rand();
+
+	double start = now();
+	for (i = 0; i < count; i++)
+		len = csp_fec_encode(frame, size, frame, depth);
+	double enc = now() - start;
+
+	/* Decode with the maximum number of correctable errors per codeword */
+	unsigned int interleave = (len - size) / CSP_FEC_PARITY;
+	double dec = 0;
+	for (i = 0; i < count; i++) {
+		uint8_t copy[sizeof(frame)];
+		unsigned int e;
+		memcpy(copy, frame, len);
+		for (e = 0; e < 16 * interleave; e++)
+			copy[e] ^= 0x5a;
+		start = now();
+		csp_fec_decode(copy, len, depth, NULL);
+		dec += now() - start;
+	}
+
+	printf("Codec, %u byte frames, depth %u: encode %.1f MB/s, decode with %u errors %.1f MB/s\r\n",
+			size, depth, size * count / enc / 1e6, 16 * interleave, size * count / dec / 1e6);
+
+}
+
+static void bench_link(csp_socket_t * socket, uint8_t depth, unsigned int count, unsigned int size) {
+
+	unsigned int i, delivered = 0;
+
+	csp_kiss_set_fec(&if_tx, depth);
+	csp_kiss_set_fec(&if_rx, depth);
+	line_bytes = 0;
+	kiss_rx.fec_corrected = 0;
+	kiss_rx.fec_failed = 0;
+
+	for (i = 0; i < count; i++) {
+		csp_packet_t * packet = csp_buffer_get(size);
+		if (packet == NULL)
+			break;
+		memset(packet->data, i, size);
+		packet->length = size;
+
+		packet->id.ext = 0;
+		packet->id.pri = CSP_PRIO_NORM;
+		packet->id.src = MY_ADDRESS;
+		packet->id.dst = MY_ADDRESS;
+		packet->id.dport = PORT;
+		packet->id.sport = PORT;
+		if (if_tx.nexthop(&if_tx, packet, 0) != CSP_ERR_NONE)
+			csp_buffer_free(packet);
+
+		/* Terminate a frame whose end was corrupted */
+		link_putc(0xC0);
+		line_bytes--;
+
+		packet = csp_recvfrom(socket, 10);
+		if (packet != NULL) {
+			delivered++;
+			csp_buffer_free(packet);
+		}
+	}
+
+	printf("Link, BER %.0e, burst %u, %s: %u/%u delivered, goodput %.1f%%",
+			ber, burst, depth ? "FEC" : "no FEC", delivered, count,
+			100.0 * delivered * size / line_bytes);
+	if (depth)
+		printf(", depth %u, %"PRIu32" bytes corrected, %"PRIu32" frames failed",
+				depth, kiss_rx.fec_corrected, kiss_rx.fec_failed);
+	printf("\r\n");
+
+}
+
+int main(int argc, char * argv[]) {
+
+	unsigned int count = 1000, size = 200;
+	uint8_t depth = 2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:B:d:n:s:")) != -1) {
+		switch (opt) {
+		case 'b':
+			ber = atof(optarg);
+			break;
+		case 'B':
+			burst = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-b bit error rate] [-B burst bytes] [-d depth] [-n packets] [-s size]\r\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (size == 0 || size > 240 || depth < 1 || depth > CSP_FEC_MAX_DEPTH) {
+		printf("Size must be 1 to 240, and depth 1 to %u\r\n", CSP_FEC_MAX_DEPTH);
+		return 1;
+	}
+
+	srand(1);
+	bench_codec(size, depth);
+
+	/* Lost frames are counted below */
+	csp_debug_set_level(CSP_WARN, false);
+
+	csp_buffer_init(20, 300);
+	csp_init(MY_ADDRESS);
+	csp_kiss_init(&if_tx, &kiss_tx, link_putc, NULL, "KISSTX");
+	csp_kiss_init(&if_rx, &kiss_rx, NULL, NULL, "KISSRX");
+	csp_route_start_task(1000, 0);
+
+	csp_socket_t * socket = csp_socket(CSP_SO_CONN_LESS);
+	csp_bind(socket, PORT);
+
+	bench_link(socket, 0, count, size);
+	bench_link(socket, depth, count, size);
+
+	return 0;
+
+}
@@ -0,0 +1,382 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * ZMQ hub broker for csp_if_zmqhub.
+ *
+ * Interfaces publish to the XSUB socket (default port 6000) and
+ * subscribe on the XPUB socket (default port 7000). Messages are
+ * forwarded without copying, and counted per destination address, which
+ * is the first byte of each message.
+ *
+ * The optional capture tap writes every forwarded message to a file from
+ * a separate thread. Each record is a uint64_t timestamp in ns, a uint32_t
+ * length and the message, all in host byte order. When the writer cannot
+ * keep up, messages are dropped from the capture instead of delaying
+ * forwarding. The file is flushed every CAPTURE_FLUSH_RECORDS records or
+ * once a second, and closed on SIGINT or SIGTERM.
+ *
+ * Build with: ./waf configure --enable-if-zmqhub build
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <zmq.h>
+
+/* Messages buffered for the capture writer */
+#define CAPTURE_HWM		100000
+
+/* Flush the capture file after this many records or this many ms */
+#define CAPTURE_FLUSH_RECORDS	1000
+#define CAPTURE_FLUSH_MS	1000
+
+/* Time the forwarder waits in zmq_poll before checking for a stop signal */
+#define PROXY_POLL_MS		100
+
+/* Number of destination addresses, one byte */
+#define PROXY_ADDRESSES		256
+
+typedef struct {
+	uint64_t messages;
+	uint64_t bytes;
+} proxy_counter_t;
+
+/* Updated by the forwarder, read by the stats thread */
+static proxy_counter_t counters[PROXY_ADDRESSES];
+static uint64_t latency_min_ns = UINT64_MAX;
+static uint64_t latency_max_ns;
+static uint64_t latency_total_ns;
+static uint64_t capture_drops;
+
+static void * context;
+static const char * capture_file;
+static unsigned int stats_interval = 10;
+static volatile sig_atomic_t proxy_stop;
+
+static uint64_t proxy_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Only async-signal-safe work here, the forwarder sees the flag after zmq_poll returns */
+static void proxy_signal(int signo) {
+	(void) signo;
+	proxy_stop = 1;
+}
+
+static void * capture_task(void * param) {
+
+	void * pull = param;
+	FILE * fp = fopen(capture_file, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open capture file %s: %s\n", capture_file, strerror(errno));
+		zmq_close(pull);
+		return NULL;
+	}
+
+	/* Wake up once a second to flush an idle capture */
+	int timeout = CAPTURE_FLUSH_MS;
+	zmq_setsockopt(pull, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+
+	unsigned int pending = 0;
+	uint64_t last_flush = proxy_time_ns();
+
+	while (1) {
+		zmq_msg_t msg;
+		zmq_msg_init(&msg);
+		if (zmq_msg_recv(&msg, pull, 0) < 0) {
+			zmq_msg_close(&msg);
+			if (zmq_errno() == ETERM)
+				break;
+			if (pending > 0) {
+				fflush(fp);
+				pending = 0;
+				last_flush = proxy_time_ns();
+			}
+			continue;
+		}
+
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		uint64_t stamp = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+		uint32_t length = zmq_msg_size(&msg);
+
+		/* Buffered writes, flushed in batches */
+		fwrite(&stamp, sizeof(stamp), 1, fp);
+		fwrite(&length, sizeof(length), 1, fp);
+		fwrite(zmq_msg_data(&msg), 1, length, fp);
+		zmq_msg_close(&msg);
+
+		uint64_t now = proxy_time_ns();
+		if (++pending >= CAPTURE_FLUSH_RECORDS || now - last_flush >= CAPTURE_FLUSH_MS * 1000000ULL) {
+			fflush(fp);
+			pending = 0;
+			last_flush = now;
+		}
+	}
+
+	fclose(fp);
+	zmq_close(pull);
+	return NULL;
+
+}
+
+static void * stats_task(void * param) {
+
+	proxy_counter_t last[PROXY_ADDRESSES];
+	uint64_t last_time = proxy_time_ns();
+	memset(last, 0, sizeof(last));
+
+	while (1) {
+		sleep(stats_interval);
+
+		uint64_t now = proxy_time_ns();
+		double elapsed = (now - last_time) / 1E9;
+		uint64_t total = 0;
+		last_time = now;
+
+		printf("Addr    Messages       Bytes    Msg/s     kB/s\n");
+		for (int i = 0; i < PROXY_ADDRESSES; i++) {
+			proxy_counter_t cur = counters[i];
+			total += cur.messages;
+			if (cur.messages == 0)
+				continue;
+			printf("%4d %11"PRIu64" %11"PRIu64" %8.0f %8.1f\n", i, cur.messages, cur.bytes,
+				(cur.messages - last[i].messages) / elapsed,
+				(cur.bytes - last[i].bytes) / elapsed / 1000);
+			last[i] = cur;
+		}
+
+		if (total > 0)
+			printf("Forwarding latency min %"PRIu64" avg %"PRIu64" max %"PRIu64" ns, capture drops %"PRIu64"\n",
+				latency_min_ns, latency_total_ns / total, latency_max_ns, capture_drops);
+	}
+
+	return NULL;
+
+}
+
+/* Forward one multipart message from one socket to the other */
+static int forward(void * from, void * to, void * capture, int count, int flags) {
+
+	int more;
+
+	do {
+		zmq_msg_t msg;
+		zmq_msg_init(&msg);
+
+		if (zmq_msg_recv(&msg, from, flags) < 0) {
+			zmq_msg_close(&msg);
+			return -1;
+		}
+
+		uint64_t start = proxy_time_ns();
+		more = zmq_msg_more(&msg);
+
+		if (count) {
+			size_t size = zmq_msg_size(&msg);
+			if (size > 0) {
+				proxy_counter_t * c = &counters[((uint8_t *) zmq_msg_data(&msg))[0]];
+				c->messages++;
+				c->bytes += size;
+			}
+
+			/* The copy shares the message data by reference count */
+			if (capture) {
+				zmq_msg_t copy;
+				zmq_msg_init(&copy);
+				zmq_msg_copy(&copy, &msg);
+				if (zmq_msg_send(&copy, capture, ZMQ_DONTWAIT) < 0) {
+					capture_drops++;
+					zmq_msg_close(&copy);
+				}
+			}
+		}
+
+		if (zmq_msg_send(&msg, to, more ? ZMQ_SNDMORE : 0) < 0) {
+			zmq_msg_close(&msg);
+			return -1;
+		}
+
+		if (count) {
+			uint64_t latency = proxy_time_ns() - start;
+			if (latency < latency_min_ns)
+				latency_min_ns = latency;
+			if (latency > latency_max_ns)
+				latency_max_ns = latency;
+			latency_total_ns += latency;
+		}
+		flags = 0;
+	} while (more);
+
+	return 0;
+
+}
+
+static void usage(void) {
+	printf("usage: csp-zmqproxy [-s SUBSCRIBE] [-p PUBLISH] [-t THREADS] [-c FILE] [-i SECONDS]\n");
+	printf("  -s ENDPOINT,\tEndpoint interfaces publish to (default: tcp://*:6000)\n");
+	printf("  -p ENDPOINT,\tEndpoint interfaces subscribe on (default: tcp://*:7000)\n");
+	printf("  -t THREADS,\tNumber of ZMQ I/O threads (default: 1)\n");
+	printf("  -c FILE,\tCapture all messages to file\n");
+	printf("  -i SECONDS,\tStatistics interval (default: 10)\n");
+}
+
+int main(int argc, char ** argv) {
+
+	const char * sub_endpoint = "tcp://*:6000";
+	const char * pub_endpoint = "tcp://*:7000";
+	int io_threads = 1;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:p:t:c:i:h")) != -1) {
+		switch (c) {
+		case 's':
+			sub_endpoint = optarg;
+			break;
+		case 'p':
+			pub_endpoint = optarg;
+			break;
+		case 't':
+			io_threads = atoi(optarg);
+			break;
+		case 'c':
+			capture_file = optarg;
+			break;
+		case 'i':
+			stats_interval = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(EXIT_SUCCESS);
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	context = zmq_ctx_new();
+	if (context == NULL || zmq_ctx_set(context, ZMQ_IO_THREADS, io_threads) != 0) {
+		fprintf(stderr, "Failed to create ZMQ context: %s\n", zmq_strerror(zmq_errno()));
+		exit(EXIT_FAILURE);
+	}
+
+	void * frontend = zmq_socket(context, ZMQ_XSUB);
+	if (frontend == NULL || zmq_bind(frontend, sub_endpoint) != 0) {
+		fprintf(stderr, "Failed to bind %s: %s\n", sub_endpoint, zmq_strerror(zmq_errno()));
+		exit(EXIT_FAILURE);
+	}
+
+	void * backend = zmq_socket(context, ZMQ_XPUB);
+	if (backend == NULL || zmq_bind(backend, pub_endpoint) != 0) {
+		fprintf(stderr, "Failed to bind %s: %s\n", pub_endpoint, zmq_strerror(zmq_errno()));
+		exit(EXIT_FAILURE);
+	}
+
+	/* Do not wait for slow subscribers on shutdown */
+	int linger = 0;
+	zmq_setsockopt(frontend, ZMQ_LINGER, &linger, sizeof(linger));
+	zmq_setsockopt(backend, ZMQ_LINGER, &linger, sizeof(linger));
+
+	/* Capture tap, an inproc pipe to the writer thread */
+	void * capture = NULL;
+	pthread_t capture_thread;
+	if (capture_file) {
+		int hwm = CAPTURE_HWM;
+		void * pull = zmq_socket(context, ZMQ_PULL);
+		if (pull == NULL || zmq_setsockopt(pull, ZMQ_RCVHWM, &hwm, sizeof(hwm)) != 0 ||
+				zmq_bind(pull, "inproc://capture") != 0) {
+			fprintf(stderr, "Failed to create capture socket: %s\n", zmq_strerror(zmq_errno()));
+			exit(EXIT_FAILURE);
+		}
+
+		capture = zmq_socket(context, ZMQ_PUSH);
+		if (capture == NULL || zmq_setsockopt(capture, ZMQ_SNDHWM, &hwm, sizeof(hwm)) != 0 ||
+				zmq_connect(capture, "inproc://capture") != 0) {
+			fprintf(stderr, "Failed to connect capture socket: %s\n", zmq_strerror(zmq_errno()));
+			exit(EXIT_FAILURE);
+		}
+
+		/* Queued records are dropped on shutdown */
+		zmq_setsockopt(capture, ZMQ_LINGER, &linger, sizeof(linger));
+
+		pthread_create(&capture_thread, NULL, capture_task, pull);
+	}
+
+	signal(SIGINT, proxy_signal);
+	signal(SIGTERM, proxy_signal);
+
+	if (stats_interval > 0) {
+		pthread_t stats_thread;
+		pthread_create(&stats_thread, NULL, stats_task, NULL);
+	}
+
+	printf("Forwarding %s -> %s with %d I/O threads\n", sub_endpoint, pub_endpoint, io_threads);
+
+	zmq_pollitem_t items[] = {
+		{ frontend, 0, ZMQ_POLLIN, 0 },
+		{ backend, 0, ZMQ_POLLIN, 0 },
+	};
+
+	while (1) {
+		int ready = zmq_poll(items, 2, PROXY_POLL_MS);
+
+		/* Terminate the context, so blocking calls in other threads return ETERM */
+		if (proxy_stop) {
+			zmq_ctx_shutdown(context);
+			break;
+		}
+
+		if (ready <= 0) {
+			if (ready < 0 && zmq_errno() == ETERM)
+				break;
+			continue;
+		}
+
+		/* Data from publishers, drain everything queued before polling again */
+		if (items[0].revents & ZMQ_POLLIN)
+			while (forward(frontend, backend, capture, 1, ZMQ_DONTWAIT) == 0);
+
+		/* Subscriptions from subscribers */
+		if (items[1].revents & ZMQ_POLLIN)
+			while (forward(backend, frontend, NULL, 0, ZMQ_DONTWAIT) == 0);
+	}
+
+	zmq_close(frontend);
+	zmq_close(backend);
+	if (capture) {
+		zmq_close(capture);
+		pthread_join(capture_thread, NULL);
+	}
+	zmq_ctx_destroy(context);
+
+	return 0;
+
+}
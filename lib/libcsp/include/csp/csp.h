@@ -218,6 +218,9 @@ int csp_sendto_reply(csp_packet_t * request_packet, csp_packet_t * reply_packet,
  * @param dport Destination port.
  * @param timeout Timeout in ms.
  * @param opts Connection options.
+ * With CSP_O_RDP | CSP_O_RDPFASTOPEN, this returns without waiting for the
+ * handshake, and the first csp_send() sends its packet with the SYN. A
+ * connection that is not accepted within the connection timeout is reset.
  * @return a pointer to a new connection or NULL
  */
 csp_conn_t *csp_connect(uint8_t prio, uint8_t dest, uint8_t dport, uint32_t timeout, uint32_t opts);
@@ -329,6 +332,24 @@ void csp_promisc_disable(void);
  */
 csp_packet_t *csp_promisc_read(uint32_t timeout);
 
+/** Router fragmentation statistics */
+typedef struct {
+	uint32_t tx_packets;		/**< Packets split into fragments */
+	uint32_t tx_fragments;		/**< Fragments sent */
+	uint32_t rx_fragments;		/**< Fragments received for this node */
+	uint32_t rx_packets;		/**< Packets reassembled */
+	uint32_t timeouts;		/**< Incomplete packets discarded after CSP_FRAG_TIMEOUT */
+	uint32_t drops;			/**< Fragments discarded as invalid, duplicate, or for lack of a context or buffer */
+} csp_frag_stats_t;
+
+/**
+ * Get router fragmentation statistics.
+ * Packets larger than the MTU of the output interface are fragmented by the
+ * router when CSP is built with CSP_USE_FRAG.
+ * @param stats Filled with the current counters
+ */
+void csp_frag_get_stats(csp_frag_stats_t * stats);
+
 /**
  * Send multiple packets using the simple fragmentation protocol
  * CSP will add total size and offset to all packets
@@ -336,7 +357,7 @@ csp_packet_t *csp_promisc_read(uint32_t timeout);
  * @param conn pointer to connection
  * @param data pointer to data to send
  * @param totalsize size of data to send
- * @param mtu maximum transfer unit
+ * @param mtu maximum transfer unit, or 0 to fit the first hop, see csp_rtable_find_mtu()
  * @param timeout timeout in ms to wait for csp_send()
  * @return 0 if OK, -1 if ERR
  */
@@ -348,7 +369,7 @@ int csp_sfp_send(csp_conn_t * conn, void * data, int totalsize, int mtu, uint32_
  * @param conn pointer to connection
  * @param data pointer to data to send
  * @param totalsize size of data to send
- * @param mtu maximum transfer unit
+ * @param mtu maximum transfer unit, or 0 to fit the first hop
  * @param timeout timeout in ms to wait for csp_send()
  * @param memcpyfcn, pointer to memcpy function
  * @return 0 if OK, -1 if ERR
@@ -376,6 +397,124 @@ int csp_sfp_recv(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t ti
  */
 int csp_sfp_recv_fp(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t timeout, csp_packet_t * first_packet);
 
+/**
+ * SFP stream callbacks
+ * @param data user data given to csp_sfp_send_stream() or csp_sfp_recv_stream()
+ * @param offset offset of the fragment in the data
+ * @param buf fragment data
+ * @param len fragment length
+ * @param totalsize size of all data, known from the first fragment received
+ * @return len when reading, 0 when writing, -1 to abort
+ */
+typedef int (*csp_sfp_read_t)(void * data, uint32_t offset, void * buf, uint32_t len);
+typedef int (*csp_sfp_write_t)(void * data, uint32_t offset, const void * buf, uint32_t len, uint32_t totalsize);
+
+/** Missing range of a stream received with csp_sfp_recv_stream() */
+typedef struct {
+	uint32_t offset;
+	uint32_t length;
+} csp_sfp_hole_t;
+
+/** Scatter buffer, in a list ended by a NULL base */
+typedef struct {
+	void * base;
+	uint32_t len;
+} csp_sfp_iov_t;
+
+/**
+ * Same as csp_sfp_send but reading each fragment when it is sent, so the data
+ * does not have to be in memory.
+ * @param conn pointer to connection
+ * @param totalsize size of data to send
+ * @param mtu maximum transfer unit, or 0 to fit the first hop, see csp_rtable_find_mtu()
+ * @param timeout timeout in ms to wait for csp_send()
+ * @param readfcn function to read a fragment, such as csp_sfp_iov_read or csp_sfp_fd_read
+ * @param data user data for readfcn
+ * @return 0 if OK, -1 if ERR
+ */
+int csp_sfp_send_stream(csp_conn_t * conn, uint32_t totalsize, int mtu, uint32_t timeout, csp_sfp_read_t readfcn, void * data);
+
+/**
+ * This is the counterpart to the csp_sfp_send functions, writing each
+ * fragment when it arrives instead of into one allocation.
+ * Missing fragments are recorded as holes and reception continues, until the
+ * last fragment has arrived or the timeout expires. The holes are sorted by
+ * offset. If there are more than max_holes, the last hole also covers the
+ * rest, so the list may cover more than is missing but never less.
+ * @param conn pointer to active conn, on which you expect to receive sfp packed data
+ * @param writefcn function to write a fragment, such as csp_sfp_iov_write or csp_sfp_fd_write
+ * @param data user data for writefcn
+ * @param holes list of missing ranges, or NULL
+ * @param max_holes size of holes
+ * @param timeout timeout in ms to wait for csp_recv()
+ * @param first_packet first SFP packet (previously received with csp_read), or NULL
+ * @return number of holes, 0 if all data was received, -1 if nothing was received or writefcn failed
+ */
+int csp_sfp_recv_stream(csp_conn_t * conn, csp_sfp_write_t writefcn, void * data, csp_sfp_hole_t * holes, unsigned int max_holes, uint32_t timeout, csp_packet_t * first_packet);
+
+/**
+ * Stream callbacks for a list of scatter buffers. Pass the csp_sfp_iov_t list as data.
+ */
+int csp_sfp_iov_read(void * data, uint32_t offset, void * buf, uint32_t len);
+int csp_sfp_iov_write(void * data, uint32_t offset, const void * buf, uint32_t len, uint32_t totalsize);
+
+#if defined(CSP_POSIX) || defined(CSP_MACOSX)
+/**
+ * Stream callbacks for a file descriptor, using pread() and pwrite() at the
+ * fragment offset. Pass a pointer to the int file descriptor as data.
+ */
+int csp_sfp_fd_read(void * data, uint32_t offset, void * buf, uint32_t len);
+int csp_sfp_fd_write(void * data, uint32_t offset, const void * buf, uint32_t len, uint32_t totalsize);
+#endif
+
+/**
+ * Bulk transfer segment callbacks
+ * @param data user data given to csp_bulk_send() or csp_bulk_recv()
+ * @param seq segment number
+ * @param buf segment data
+ * @param len size of buf, or of the segment when writing
+ * @return segment length when reading, or 0 when writing, -1 to abort the transfer
+ */
+typedef int (*csp_bulk_read_t)(void * data, uint32_t seq, uint8_t * buf, unsigned int len);
+typedef int (*csp_bulk_write_t)(void * data, uint32_t seq, const uint8_t * buf, unsigned int len);
+
+/**
+ * Send numbered segments with the rate-based bulk transport.
+ * Segments are streamed at the given rate on a connection without RDP, and
+ * are not held back by acknowledgements. The receiver reports missing
+ * segments every interval, and they are retransmitted before new segments.
+ * With a rate of zero, the rate starts at a few segments per interval and
+ * is probed from the delivery rate and loss in the reports. Loss is taken as
+ * congestion, so give a fixed rate on links with much random loss.
+ * Use the same interval at both ends.
+ * @param conn pointer to connection
+ * @param segments number of segments
+ * @param size segment size, at most the MTU less 9 bytes of bulk header
+ * @param rate rate in bytes per second, or 0 to probe the rate
+ * @param interval report interval in ms
+ * @param timeout timeout in ms without a report from the receiver
+ * @param readfcn function to read a segment, which may be shorter than size
+ * @param data user data for readfcn
+ * @return CSP_ERR_NONE when the receiver has all segments, CSP_ERR type otherwise
+ */
+int csp_bulk_send(csp_conn_t * conn, uint32_t segments, unsigned int size, uint32_t rate, uint32_t interval, uint32_t timeout, csp_bulk_read_t readfcn, void * data);
+
+/**
+ * This is the counterpart to the csp_bulk_send function
+ * Segments are written in the order they arrive, and marked in map. Segments
+ * already marked are not written again, so a transfer that timed out can be
+ * restarted with the same map.
+ * @param conn pointer to connection
+ * @param segments number of segments
+ * @param map bitmap of (segments + 7) / 8 bytes, bit set for each segment received
+ * @param interval report interval in ms
+ * @param timeout timeout in ms without data from the sender
+ * @param writefcn function to write a segment
+ * @param data user data for writefcn
+ * @return CSP_ERR_NONE when all segments were received, CSP_ERR type otherwise
+ */
+int csp_bulk_recv(csp_conn_t * conn, uint32_t segments, uint8_t * map, uint32_t interval, uint32_t timeout, csp_bulk_write_t writefcn, void * data);
+
 /**
  * If the given packet is a service-request (that is uses one of the csp service ports)
  * it will be handled according to the CSP service handler.
@@ -450,10 +589,10 @@ void csp_uptime(uint8_t node, uint32_t timeout);
  * Set RDP options
  * @param window_size Window size
  * @param conn_timeout_ms Connection timeout in ms
- * @param packet_timeout_ms Packet timeout in ms
+ * @param packet_timeout_ms Maximum retransmission timeout in ms, the timeout adapts to the round-trip time below this
  * @param delayed_acks Enable/disable delayed acknowledgements
- * @param ack_timeout Acknowledgement timeout when delayed ACKs is enabled
- * @param ack_delay_count Send acknowledgement for every ack_delay_count packets
+ * @param ack_timeout Maximum acknowledgement delay when delayed ACKs is enabled, a quarter of the round-trip time once measured
+ * @param ack_delay_count Send acknowledgement for at most every ack_delay_count packets, and at least every quarter window
  */
 void csp_rdp_set_opt(unsigned int window_size, unsigned int conn_timeout_ms,
 		unsigned int packet_timeout_ms, unsigned int delayed_acks,
@@ -472,6 +611,42 @@ void csp_rdp_get_opt(unsigned int *window_size, unsigned int *conn_timeout_ms,
 		unsigned int *packet_timeout_ms, unsigned int *delayed_acks,
 		unsigned int *ack_timeout, unsigned int *ack_delay_count);
 
+/**
+ * Set RDP suspend grace period
+ * An RDP connection that has not heard from the other end for the
+ * connection timeout, while it has unacknowledged data, is suspended
+ * instead of timing out. It keeps its windows and resumes when the link
+ * returns, or is closed after the grace period. csp_send() blocks while
+ * the connection is suspended. Applies to new connections.
+ * @param grace_ms Grace period in ms, zero to disable (default)
+ */
+void csp_rdp_set_suspend(unsigned int grace_ms);
+
+/**
+ * Get RDP suspend grace period
+ * @return Grace period in ms, zero if disabled
+ */
+unsigned int csp_rdp_get_suspend(void);
+
+/** RDP connection statistics */
+typedef struct {
+	uint32_t srtt;			/**< Smoothed round-trip time in ms, zero until measured */
+	uint32_t rttvar;		/**< Round-trip time variation in ms */
+	uint32_t rto;			/**< Retransmission timeout in ms */
+	uint32_t window_size;		/**< Negotiated window size */
+	uint32_t retransmits;		/**< Segments retransmitted after a timeout */
+	uint32_t fast_retransmits;	/**< Segments retransmitted after extended acknowledgements */
+	uint32_t suspends;		/**< Times the connection was suspended after losing the link */
+} csp_rdp_stats_t;
+
+/**
+ * Get RDP connection statistics
+ * @param conn RDP connection
+ * @param stats Filled with the current values
+ * @return CSP_ERR_NONE on success, CSP_ERR_INVAL if conn is not an RDP connection
+ */
+int csp_rdp_get_stats(csp_conn_t * conn, csp_rdp_stats_t * stats);
+
 /**
  * Set XTEA key
  * @param key Pointer to key array
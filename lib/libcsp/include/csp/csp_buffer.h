@@ -37,6 +37,52 @@ extern "C" {
  */
 int csp_buffer_init(int count, int size);
 
+/**
+ * Add a class of buffers of another size, after csp_buffer_init() and
+ * before any buffers are used.
+ * csp_buffer_get() takes a buffer from the smallest class that fits the
+ * requested size, with room for the CRC32, HMAC, XTEA and RDP trailers,
+ * and has a free buffer. A few large buffers can then back interfaces with
+ * a large MTU without making every buffer large.
+ *
+ * @param count Number of buffers to allocate
+ * @param size Buffer size in bytes.
+ *
+ * @return CSP_ERR_NONE if malloc() succeeded, CSP_ERR_INVAL if there are too many classes, CSP_ERR_NOMEM otherwise.
+ */
+int csp_buffer_init_class(int count, int size);
+
+/**
+ * Return the memory needed for csp_buffer_init_pool()
+ * @param count Number of buffers
+ * @param size Buffer size in bytes.
+ * @return pool size in bytes
+ */
+size_t csp_buffer_pool_size(int count, int size);
+
+/**
+ * Add a class of buffers in memory provided by a driver, such as memory
+ * shared with other processes. csp_buffer_get() never returns these
+ * buffers, the driver takes them with csp_buffer_get_pool() and they are
+ * returned to the pool by csp_buffer_free() as usual.
+ *
+ * @param pool Memory of at least csp_buffer_pool_size() bytes, pointer aligned
+ * @param count Number of buffers
+ * @param size Buffer size in bytes.
+ *
+ * @return CSP_ERR_NONE on success, CSP_ERR_INVAL if there are too many pools, CSP_ERR_NOMEM otherwise.
+ */
+int csp_buffer_init_pool(void * pool, int count, int size);
+
+/**
+ * Get a free buffer from a pool added with csp_buffer_init_pool().
+ * This function can only be called from task context.
+ *
+ * @param pool Memory passed to csp_buffer_init_pool()
+ * @return pointer to a free csp_packet_t, or NULL if the pool is empty
+ */
+void * csp_buffer_get_pool(void * pool);
+
 /**
  * Get a reference to a free buffer. This function can only be called
  * from task context.
@@ -74,17 +120,75 @@ void csp_buffer_free_isr(void *packet);
 void * csp_buffer_clone(void *buffer);
 
 /**
- * Return how many buffers that are currently free.
+ * Copy a received packet into a smaller buffer class, if the data fills at
+ * most half of its buffer. Drivers receive directly into buffers sized for
+ * the MTU, and use this so small packets do not hold on to large buffers.
+ * @param packet received packet, left unchanged
+ * @return the copy, or NULL if the packet is large or no smaller buffer is free
+ */
+csp_packet_t * csp_buffer_compact(csp_packet_t * packet);
+
+/**
+ * Return how many buffers that are currently free, in all classes.
  * @return number of free buffers
  */
 int csp_buffer_remaining(void);
 
 /**
- * Return the size of the CSP buffers
+ * Return the size of the largest CSP buffers, including packet overhead
  * @return size of CSP buffers
  */
 int csp_buffer_size(void);
 
+/**
+ * Return the size of a buffer, including packet overhead
+ * @param packet pointer to memory area, must be acquired by csp_buffer_get().
+ * @return size of the buffer
+ */
+int csp_buffer_size_of(void * packet);
+
+/**
+ * Packet headroom and tailroom.
+ * The data of a packet always starts right after the CSP id. Protocol
+ * trailers such as the RDP header, CRC32, HMAC and XTEA nonce are added
+ * after the data without copying. A link header of up to
+ * CSP_PACKET_HEADROOM bytes, set with --with-headroom, fits in the headroom
+ * field right in front of the id. Drivers with larger headers or escaping
+ * still encode into their own frame buffers.
+ */
+
+/**
+ * Return the link header area in front of the CSP id. The area is the
+ * headroom field only, the length field is never part of it.
+ * @param packet pointer to packet, must be acquired by csp_buffer_get().
+ * @param len header length
+ * @return pointer to len bytes ending at the id, or NULL if len exceeds CSP_PACKET_HEADROOM
+ */
+void * csp_packet_push(csp_packet_t * packet, unsigned int len);
+
+/**
+ * Return the number of bytes free after the data
+ * @param packet pointer to packet, must be acquired by csp_buffer_get().
+ * @return tailroom in bytes
+ */
+int csp_packet_tailroom(csp_packet_t * packet);
+
+/**
+ * Append len bytes to the data
+ * @param packet pointer to packet, must be acquired by csp_buffer_get().
+ * @param len number of bytes
+ * @return pointer to the appended bytes, or NULL if the tailroom is too small
+ */
+void * csp_packet_put(csp_packet_t * packet, unsigned int len);
+
+/**
+ * Remove len bytes from the end of the data
+ * @param packet pointer to packet
+ * @param len number of bytes
+ * @return pointer to the removed bytes, or NULL if the packet is shorter than len
+ */
+void * csp_packet_trim(csp_packet_t * packet, unsigned int len);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
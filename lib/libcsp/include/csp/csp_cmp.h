@@ -44,6 +44,7 @@ extern "C" {
 #define CSP_CMP_POKE 5
 #define CSP_CMP_POKE_MAX_LEN 200
 #define CSP_CMP_CLOCK 6
+#define CSP_CMP_IF_XSTATS 7
 
 struct csp_cmp_message {
 	uint8_t type;
@@ -74,6 +75,21 @@ struct csp_cmp_message {
 			uint32_t rxbytes;
 			uint32_t irq;
 		} if_stats;
+		struct __attribute__((__packed__)) {
+			char interface[CSP_CMP_ROUTE_IFACE_LEN];
+			uint32_t fifo_full;
+			uint32_t no_route;
+			uint32_t split_horizon;
+			uint32_t dedup;
+			uint32_t security;
+			uint32_t no_conn;
+			uint32_t rx_latency[CSP_IF_HIST_BUCKETS];
+			uint32_t rx_latency_max;
+			uint32_t dwell[CSP_IF_HIST_BUCKETS];
+			uint32_t dwell_max;
+			uint32_t tx_latency[CSP_IF_HIST_BUCKETS];
+			uint32_t tx_latency_max;
+		} if_xstats;
 		struct {
 			uint32_t addr;
 			uint8_t len;
@@ -103,6 +119,7 @@ CMP_MESSAGE(CSP_CMP_IF_STATS, if_stats)
 CMP_MESSAGE(CSP_CMP_PEEK, peek)
 CMP_MESSAGE(CSP_CMP_POKE, poke)
 CMP_MESSAGE(CSP_CMP_CLOCK, clock)
+CMP_MESSAGE(CSP_CMP_IF_XSTATS, if_xstats)
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -42,6 +42,7 @@ extern "C" {
 #define CSP_ERR_HMAC		-100 	/* HMAC failed */
 #define CSP_ERR_XTEA		-101	/* XTEA failed */
 #define CSP_ERR_CRC32		-102	/* CRC32 failed */
+#define CSP_ERR_FEC		-103	/* FEC decoding failed */
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,81 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CSP_FEC_H_
+#define _CSP_FEC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * Reed-Solomon RS(255,223) forward error correction for frames.
+ *
+ * A frame is spread over depth codewords, and each codeword can correct
+ * 16 byte errors. The encoded frame is the unchanged data followed by the
+ * parity bytes, and byte i of the encoded frame belongs to codeword
+ * i % depth. A burst of errors is therefore shared between all the
+ * codewords, and up to 16 * depth consecutive bytes can be corrected.
+ *
+ * The depth used for a frame is at least the configured depth, and large
+ * enough to keep each codeword within 223 data bytes. The receiver works
+ * out the frame length and depth from the encoded length.
+ */
+
+/** Parity bytes per codeword */
+#define CSP_FEC_PARITY			32
+
+/** Maximum data bytes per codeword */
+#define CSP_FEC_BLOCK			223
+
+/** Maximum interleaving depth */
+#define CSP_FEC_MAX_DEPTH		8
+
+/** Worst case encoded length of a frame */
+#define CSP_FEC_ENCODED_MAX(len)	((len) + CSP_FEC_PARITY * CSP_FEC_MAX_DEPTH)
+
+/**
+ * Encode frame
+ * @param in Frame to encode
+ * @param len Frame length
+ * @param out Output buffer, at least CSP_FEC_ENCODED_MAX(len) bytes
+ * @param depth Minimum interleaving depth, 1 to CSP_FEC_MAX_DEPTH
+ * @return Encoded length, or CSP_ERR_INVAL if the frame is too long for depth
+ */
+int csp_fec_encode(const uint8_t * in, unsigned int len, uint8_t * out, uint8_t depth);
+
+/**
+ * Decode frame in place. The corrected frame is left at the start of buf.
+ * @param buf Encoded frame
+ * @param len Encoded length
+ * @param depth Minimum interleaving depth used by the sender
+ * @param corrected Set to number of corrected bytes if not NULL
+ * @return Frame length, or CSP_ERR_INVAL if the length is invalid, or
+ * CSP_ERR_FEC if the frame has more errors than can be corrected.
+ */
+int csp_fec_decode(uint8_t * buf, unsigned int len, uint8_t depth, unsigned int * corrected);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CSP_FEC_H_ */
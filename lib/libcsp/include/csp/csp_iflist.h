@@ -34,6 +34,13 @@ void csp_iflist_add(csp_iface_t *ifc);
  */
 csp_iface_t * csp_iflist_get_by_name(char *name);
 
+/**
+ * Add latency sample to histogram
+ * @param hist Histogram
+ * @param ms Latency in ms
+ */
+void csp_iflist_hist_add(csp_iface_hist_t * hist, uint32_t ms);
+
 /**
  * Print list of interfaces to stdout
  */
@@ -65,6 +65,36 @@ uint8_t csp_route_get_mac(uint8_t node);
  */
 void csp_iflist_add(csp_iface_t * ifc);
 
+/** TX queue statistics */
+typedef struct {
+	uint32_t depth;			/**< Packets currently queued */
+	uint32_t depth_max;		/**< Highest number of packets queued */
+	uint32_t drops;			/**< Packets rejected because the queue was full */
+	uint32_t sent;			/**< Packets passed to the interface */
+	uint32_t wait_avg;		/**< Average time in queue [ms] */
+	uint32_t wait_max;		/**< Longest time in queue [ms] */
+} csp_txq_stats_t;
+
+/**
+ * Send packets on interface from a scheduler task instead of the sending task.
+ * Queued packets are sent in order of priority, and limited to bitrate by a
+ * token bucket holding up to burst bytes.
+ * @param ifc Interface, must be added with csp_iflist_add()
+ * @param length Queue length per priority
+ * @param bitrate Rate limit in bits/s, 0 for unlimited
+ * @param burst Bytes that may be sent back to back at full speed
+ * @return CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_txq_enable(csp_iface_t * ifc, unsigned int length, uint32_t bitrate, uint32_t burst);
+
+/**
+ * Get TX queue statistics
+ * @param ifc Interface
+ * @param stats Statistics output
+ * @return CSP_ERR_NONE on success, CSP_ERR_INVAL if the interface has no TX queue.
+ */
+int csp_txq_get_stats(csp_iface_t * ifc, csp_txq_stats_t * stats);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -41,6 +41,15 @@ csp_iface_t * csp_rtable_find_iface(uint8_t id);
  */
 uint8_t csp_rtable_find_mac(uint8_t id);
 
+/**
+ * Find the largest packet that can be sent towards a node without
+ * fragmentation. Only the first hop is known, so this is the smaller of the
+ * outgoing interface MTU and the largest CSP buffer.
+ * @param id Destination node
+ * @return Maximum packet data length including CSP options, or 0 if there is no route
+ */
+int csp_rtable_find_mtu(uint8_t id);
+
 /**
  * Setup routing entry
  * @param node Host
@@ -117,6 +126,19 @@ int csp_rtable_check(char * buffer);
  */
 void csp_rtable_clear(void);
 
+/**
+ * Routing table change hook, called after a route is set or the table is changed
+ */
+typedef void (*csp_rtable_hook_func_t)(void);
+
+/**
+ * Set routing table change hook. The CAN interface uses this to keep its
+ * acceptance filters in sync with the routing table, so only set it when
+ * the CAN interface is not in use.
+ * @param f Hook function or NULL
+ */
+void csp_rtable_hook_set(csp_rtable_hook_func_t f);
+
 /**
  * Setup routing entry to single node
  * (deprecated, please use csp_rtable_set)
@@ -127,9 +127,9 @@ typedef union {
 #define CSP_DEFAULT_ROUTE		(CSP_ID_HOST_MAX + 1)
 
 /** CSP Flags */
-#define CSP_FRES1			0x80 // Reserved for future use
+#define CSP_FRFRAG			0x80 // Router fragment, reassembled by the destination
 #define CSP_FRES2			0x40 // Reserved for future use
-#define CSP_FRES3			0x20 // Reserved for future use
+#define CSP_FCOMP			0x20 // Payload compressed by the link, see csp_iface_t.upper
 #define CSP_FFRAG			0x10 // Use fragmentation
 #define CSP_FHMAC			0x08 // Use HMAC verification
 #define CSP_FXTEA			0x04 // Use XTEA encryption
@@ -147,6 +147,7 @@ typedef union {
 #define CSP_SO_CRC32REQ			0x0040 // Require CRC32
 #define CSP_SO_CRC32PROHIB		0x0080 // Prohibit CRC32
 #define CSP_SO_CONN_LESS		0x0100 // Enable Connection Less mode
+#define CSP_SO_RDPFASTOPEN		0x0200 // Accept data in the RDP SYN
 
 /** CSP Connect options */
 #define CSP_O_NONE			CSP_SO_NONE // No connection options
@@ -158,6 +159,7 @@ typedef union {
 #define CSP_O_NOXTEA			CSP_SO_XTEAPROHIB // Disable XTEA
 #define CSP_O_CRC32			CSP_SO_CRC32REQ // Enable CRC32
 #define CSP_O_NOCRC32			CSP_SO_CRC32PROHIB // Disable CRC32
+#define CSP_O_RDPFASTOPEN		CSP_SO_RDPFASTOPEN // Send the first RDP segment with the SYN
 
 /**
  * CSP PACKET STRUCTURE
@@ -167,7 +169,8 @@ typedef union {
  */
 typedef struct __attribute__((__packed__)) {
 	uint8_t padding[CSP_PADDING_BYTES];	/**< Interface dependent padding */
-	uint16_t length;			/**< Length field must be just before CSP ID */
+	uint16_t length;			/**< Length of data */
+	uint8_t headroom[CSP_PACKET_HEADROOM];	/**< Link header room, see csp_packet_push() */
 	csp_id_t id;				/**< CSP id must be just before data */
 	union {
 		uint8_t data[0];		/**< This just points to the rest of the buffer, without a size indication. */
@@ -176,9 +179,32 @@ typedef struct __attribute__((__packed__)) {
 	};
 } csp_packet_t;
 
+/** Number of latency histogram buckets */
+#define CSP_IF_HIST_BUCKETS		12
+
+/**
+ * Latency histogram. Bucket 0 counts 0 ms, bucket n counts
+ * 2^(n-1) to 2^n - 1 ms, and the last bucket everything above.
+ */
+typedef struct {
+	uint32_t count[CSP_IF_HIST_BUCKETS];	/**< Samples per bucket */
+	uint32_t max;				/**< Highest sample [ms] */
+} csp_iface_hist_t;
+
+/** Packets discarded by the router, by reason */
+typedef struct {
+	uint32_t fifo_full;			/**< Router input queue full */
+	uint32_t no_route;			/**< No route to destination */
+	uint32_t split_horizon;			/**< Route leads back out the input interface */
+	uint32_t dedup;				/**< Duplicate packet */
+	uint32_t security;			/**< Unsupported options or failed security check */
+	uint32_t no_conn;			/**< No socket or connection to deliver to */
+} csp_iface_drops_t;
+
 /** Interface TX function */
 struct csp_iface_s;
 typedef int (*nexthop_t)(struct csp_iface_s * interface, csp_packet_t *packet, uint32_t timeout);
+typedef int (*rxhook_t)(struct csp_iface_s * interface, csp_packet_t *packet);
 
 /** Interface struct */
 typedef struct csp_iface_s {
@@ -197,6 +223,13 @@ typedef struct csp_iface_s {
 	uint32_t txbytes;			/**< Transmitted bytes */
 	uint32_t rxbytes;			/**< Received bytes */
 	uint32_t irq;				/**< Interrupts */
+	void * txq;				/**< TX queue, see csp_txq_enable() */
+	csp_iface_drops_t drops;		/**< Router discards of packets received on interface */
+	csp_iface_hist_t rx_latency;		/**< Time from reception to delivery to a socket */
+	csp_iface_hist_t dwell;			/**< Time spent in the router input queue */
+	csp_iface_hist_t tx_latency;		/**< Time from send until passed to the driver */
+	struct csp_iface_s *upper;		/**< Interface stacked on top, receives packets from this interface */
+	rxhook_t upper_rx;			/**< Receive function called by the router when this is an upper interface */
 	struct csp_iface_s *next;	/**< Next interface */
 } csp_iface_t;
 
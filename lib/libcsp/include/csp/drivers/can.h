@@ -34,33 +34,106 @@ extern "C" {
  * can_frame struct and can_id types in include/linux/can.h
  */
 
+/** Maximum number of data bytes in a CAN frame */
+#ifdef CSP_USE_CAN_FD
+#define CAN_FRAME_MAX_DLEN	64
+#else
+#define CAN_FRAME_MAX_DLEN	8
+#endif
+
 /** CAN Identifier */
 typedef uint32_t can_id_t;
 
-/** CAN Frame */
+/** CAN Frame (matches canfd_frame when CSP_USE_CAN_FD is set) */
 typedef struct {
 	/** 32 bit CAN identifier */
 	can_id_t id;
 	/** Data Length Code */
 	uint8_t dlc;
-	/**< Frame Data - 0 to 8 bytes */
+	/**< Frame Data - 0 to CAN_FRAME_MAX_DLEN bytes */
 	union __attribute__((aligned(8))) {
-		uint8_t data[8];
-		uint16_t data16[4];
-		uint32_t data32[2];
+		uint8_t data[CAN_FRAME_MAX_DLEN];
+		uint16_t data16[CAN_FRAME_MAX_DLEN / 2];
+		uint32_t data32[CAN_FRAME_MAX_DLEN / 4];
 	};
 } can_frame_t;
 
+/** CAN acceptance filter, a frame matches if (frame id & mask) == (id & mask) */
+typedef struct {
+	can_id_t id;
+	can_id_t mask;
+} can_filter_t;
+
 typedef enum {
 	CAN_ERROR = 0,
 	CAN_NO_ERROR = 1,
 } can_error_t;
 
+/** CAN error events reported by drivers */
+#define CAN_EVENT_WARNING	(1 << 0)	/**< Error counter reached warning level */
+#define CAN_EVENT_PASSIVE	(1 << 1)	/**< Controller is error passive */
+#define CAN_EVENT_BUS_OFF	(1 << 2)	/**< Controller is bus off */
+#define CAN_EVENT_ACTIVE	(1 << 3)	/**< Controller is error active again */
+#define CAN_EVENT_RESTARTED	(1 << 4)	/**< Controller restarted after bus off */
+#define CAN_EVENT_ARBITRATION	(1 << 5)	/**< Lost arbitration */
+#define CAN_EVENT_PROTOCOL	(1 << 6)	/**< Protocol violation or bus error */
+#define CAN_EVENT_NO_ACK	(1 << 7)	/**< Transmission not acknowledged */
+#define CAN_EVENT_OVERFLOW	(1 << 8)	/**< Controller buffer overflow */
+#define CAN_EVENT_COUNTERS	(1 << 9)	/**< Error counters are valid */
+
 int can_init(uint32_t id, uint32_t mask, struct csp_can_config *conf);
 int can_send(can_id_t id, uint8_t * data, uint8_t dlc);
 
+/** CAN transmit queue statistics */
+typedef struct {
+	uint32_t depth;		/**< Frames currently queued */
+	uint32_t depth_max;	/**< Highest number of frames queued */
+	uint32_t drops;		/**< Packets dropped because the queue was full */
+	uint32_t errors;	/**< Frames dropped on write errors */
+	uint32_t blocked_ms;	/**< Time spent waiting for the bus to accept frames */
+} can_tx_stats_t;
+
+/**
+ * Queue a batch of frames belonging to one CFP packet for transmission.
+ * Frames are sent in order by the driver, with higher priority packets
+ * sent first. Frames with a dlc above 8 are sent as CAN FD frames, padded
+ * to the next valid FD length.
+ * @param frames Array of frames to send in order
+ * @param count Number of frames in array
+ * @param prio CSP priority of the packet
+ * @param timeout Time in ms to wait for room in the queue
+ * @return 0 if all frames were queued, -1 otherwise
+ */
+int can_send_frames(can_frame_t * frames, int count, uint8_t prio, uint32_t timeout);
+
+/**
+ * Replace the acceptance filters of the driver. Frames matching any of
+ * the filters are received.
+ * @param filters Array of filters, or NULL to receive all frames
+ * @param count Number of filters in array
+ * @return 0 if filters were installed, -1 otherwise
+ */
+int can_set_filters(can_filter_t * filters, int count);
+
+/**
+ * Get transmit queue statistics
+ * @param stats Pointer to struct to fill
+ */
+void can_get_tx_stats(can_tx_stats_t * stats);
+
 int csp_can_rx_frame(can_frame_t *frame, CSP_BASE_TYPE *task_woken);
 
+/**
+ * Report a CAN error frame or controller state change to the interface.
+ * Counters are updated with atomic increments, so the driver may call this
+ * from its RX thread while other tasks send. From interrupt context it is
+ * only safe on targets where 32 bit atomics are lock-free.
+ * @param events Bitmask of CAN_EVENT_ flags
+ * @param tx_errors Transmit error counter, if CAN_EVENT_COUNTERS is set
+ * @param rx_errors Receive error counter, if CAN_EVENT_COUNTERS is set
+ */
+void csp_can_rx_error(uint32_t events, uint8_t tx_errors, uint8_t rx_errors);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -28,6 +28,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #ifndef I2C_H_
 #define I2C_H_
 
+#include <csp/csp_autoconfig.h>
+
 /**
  * The return value of the driver is a bit strange,
  * It should return E_NO_ERR if successfull and the value is -1
@@ -55,6 +57,7 @@ typedef struct __attribute__((packed)) i2c_frame_s {
 	uint8_t dest;
 	uint8_t len_rx;
 	uint16_t len;
+	uint8_t headroom[CSP_PACKET_HEADROOM];	// Matches csp_packet_t, data starts with the CSP id
 	uint8_t data[I2C_MTU];
 } i2c_frame_t;
 
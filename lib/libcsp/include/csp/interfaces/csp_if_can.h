@@ -41,8 +41,90 @@ struct csp_can_config {
 	uint32_t bitrate;
 	uint32_t clock_speed;
 	char *ifc;
+	uint8_t fd;		/**< Use 64 byte CAN FD frames for CFP (requires CSP_USE_CAN_FD) */
 };
 
+/* CFP reassembly statistics */
+typedef struct {
+	uint32_t in_use;	/**< Reassembly buffers currently in use */
+	uint32_t evictions;	/**< Partial packets evicted to make room for a new packet */
+	uint32_t timeouts;	/**< Partial packets dropped after timeout */
+	uint32_t out_of_order;	/**< MORE frames without a matching BEGIN or with unexpected remain */
+	uint32_t incomplete;	/**< BEGIN frames received while the previous packet was incomplete */
+	uint32_t completed;	/**< Packets reassembled */
+	uint32_t time_min;	/**< Shortest time from BEGIN to last frame in ms */
+	uint32_t time_max;	/**< Longest time from BEGIN to last frame in ms */
+	uint32_t time_total;	/**< Sum of reassembly times in ms, divide by completed for average */
+} csp_can_pbuf_stats_t;
+
+/** CAN controller error states */
+typedef enum {
+	CSP_CAN_STATE_ACTIVE = 0,
+	CSP_CAN_STATE_WARNING = 1,
+	CSP_CAN_STATE_PASSIVE = 2,
+	CSP_CAN_STATE_BUS_OFF = 3,
+} csp_can_state_t;
+
+/* CAN bus error statistics, as reported by the driver */
+typedef struct {
+	uint32_t error_frames;	/**< Error frames received from the driver */
+	uint32_t warning;	/**< Transitions to error warning */
+	uint32_t passive;	/**< Transitions to error passive */
+	uint32_t bus_off;	/**< Transitions to bus off */
+	uint32_t restarts;	/**< Controller restarts after bus off */
+	uint32_t arbitration;	/**< Lost arbitration */
+	uint32_t protocol;	/**< Protocol violations and bus errors */
+	uint32_t no_ack;	/**< Transmissions not acknowledged */
+	uint32_t overflow;	/**< Controller buffer overflows */
+	uint8_t state;		/**< Current csp_can_state_t */
+	uint8_t tx_errors;	/**< Last reported transmit error counter */
+	uint8_t rx_errors;	/**< Last reported receive error counter */
+} csp_can_error_stats_t;
+
+/* Per source address statistics */
+typedef struct {
+	uint32_t frames;	/**< Frames received */
+	uint32_t bytes;		/**< Data bytes received */
+	uint32_t frame_rate;	/**< Frames per second over the last window */
+	uint32_t byte_rate;	/**< Data bytes per second over the last window */
+} csp_can_node_stats_t;
+
+/* CAN interface statistics */
+typedef struct {
+	uint32_t rx_frames;	/**< Frames received */
+	uint32_t tx_frames;	/**< Frames queued for transmission */
+	uint32_t rx_bytes;	/**< Data bytes received */
+	uint32_t tx_bytes;	/**< Data bytes queued for transmission */
+	uint32_t bitrate;	/**< Configured bitrate, 0 if unknown */
+	uint32_t bus_load;	/**< Estimated bus load in per mille over the last window, 0 if bitrate is unknown */
+	csp_can_error_stats_t errors;
+	csp_can_pbuf_stats_t pbuf;
+	csp_can_node_stats_t nodes[CSP_ID_HOST_MAX + 1];
+} csp_can_stats_t;
+
+/**
+ * Get CFP reassembly statistics
+ * @param stats Pointer to struct to fill
+ */
+void csp_can_get_pbuf_stats(csp_can_pbuf_stats_t *stats);
+
+/**
+ * Get CAN interface statistics. Rates and bus load are estimated from
+ * the frames seen by this node, so traffic removed by the acceptance
+ * filters is only included in promiscuous mode. Counters are updated
+ * atomically, but the copy is not a snapshot of all counters at one time.
+ * @param stats Pointer to struct to fill
+ */
+void csp_can_get_stats(csp_can_stats_t *stats);
+
+/**
+ * Override the CAN mode. In CSP_CAN_MASKED mode, the driver only receives
+ * frames for our own address, broadcast and nodes routed through this node.
+ * The filters are updated when the routing table changes.
+ * @param promisc 1 to receive all frames, 0 to use masked filters
+ */
+void csp_can_set_promisc(uint8_t promisc);
+
 /**
  * Init CAN interface
  * @param mode Must be either CSP_CAN_MASKED or CSP_CAN_PROMISC
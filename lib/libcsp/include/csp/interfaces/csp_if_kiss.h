@@ -92,10 +92,28 @@ typedef struct csp_kiss_handle_s {
 	unsigned int rx_first;
 	volatile unsigned char *rx_cbuf;
 	csp_packet_t * rx_packet;
+#ifdef CSP_USE_FEC
+	uint8_t fec_depth;		/**< Interleaving depth, 0 when FEC is disabled */
+	uint8_t * fec_buf;		/**< Encoded frame being received */
+	uint32_t fec_corrected;		/**< Bytes corrected */
+	uint32_t fec_failed;		/**< Frames with too many errors */
+#endif
 } csp_kiss_handle_t;
 
 void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle, csp_kiss_putc_f kiss_putc_f, csp_kiss_discard_f kiss_discard_f, const char * name);
 
+#ifdef CSP_USE_FEC
+/**
+ * Enable Reed-Solomon forward error correction on a KISS interface, see
+ * csp_fec.h. Both ends must use the same depth. Frames are decoded in
+ * csp_kiss_rx(), which should then be called from task context.
+ * @param interface KISS interface
+ * @param depth Interleaving depth, 1 to CSP_FEC_MAX_DEPTH, or 0 to disable FEC
+ * @return CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_kiss_set_fec(csp_iface_t * interface, uint8_t depth);
+#endif
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
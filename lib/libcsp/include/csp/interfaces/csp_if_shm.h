@@ -0,0 +1,81 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CSP_IF_SHM_H_
+#define _CSP_IF_SHM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <csp/csp.h>
+#include <csp/csp_interface.h>
+
+/**
+ * The shared memory interface connects CSP processes on the same host.
+ * Each process receives on a ring in /dev/shm named after its address,
+ * and senders write packets directly into buffers in the ring of the next
+ * hop, which are passed on to the router without copying.
+ * The next hop is the routing table MAC, or the destination address for
+ * routes with CSP_NODE_MAC. Rings are only accessible to the user that
+ * created them.
+ */
+
+/** Maximum packet data length */
+#define CSP_SHM_MTU		256
+
+/** Number of slots in a ring, must be a power of two */
+#define CSP_SHM_SLOTS		256
+
+/** Opaque ring in shared memory */
+typedef struct csp_shm_ring_s csp_shm_ring_t;
+
+/**
+ * This structure should be statically allocated by the user
+ * and passed to the shared memory interface during the init function
+ * no member information should be changed
+ */
+typedef struct csp_shm_handle_s {
+	csp_shm_ring_t * rx_ring;		/**< Own ring, written by other processes */
+	csp_shm_ring_t * peers[256];		/**< Rings of next hops, mapped on first use */
+	pthread_mutex_t lock;			/**< Protects peers */
+	csp_packet_t * rx_packets[CSP_SHM_SLOTS];	/**< Buffer given to each slot of the own ring */
+	pthread_t thread;			/**< RX thread */
+	csp_iface_t * iface;
+} csp_shm_handle_t;
+
+/**
+ * Setup shared memory interface, and create the receive ring for addr
+ * @param iface Interface to setup, statically allocated by the user
+ * @param handle Driver handle, statically allocated by the user
+ * @param name Interface name
+ * @param addr Address other processes use as next hop to reach this process
+ * @return CSP_ERR
+ */
+int csp_shm_init(csp_iface_t * iface, csp_shm_handle_t * handle, const char * name, uint8_t addr);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CSP_IF_SHM_H_ */
@@ -0,0 +1,92 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CSP_IF_UDP_H_
+#define _CSP_IF_UDP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include <csp/csp.h>
+#include <csp/csp_interface.h>
+#include <csp/arch/csp_queue.h>
+
+/**
+ * The UDP interface carries one CSP packet per datagram, as the CSP header
+ * in network byte order followed by the data.
+ *
+ * Peers are selected by the routing table MAC field, so a route to node
+ * 5 via peer 2 is set up with csp_udp_peer_set(&iface, 2, "10.0.0.2", 9600)
+ * and csp_route_set(5, &iface, 2). Routes with CSP_NODE_MAC use the
+ * destination address as peer index.
+ */
+
+/** Number of datagrams read or written per syscall */
+#define CSP_UDP_BATCH		32
+
+/** Default maximum packet data length. The MTU of the interface may be raised
+ * up to the largest CSP buffer, see csp_buffer_init_class(). */
+#define CSP_UDP_MTU		256
+
+/**
+ * This structure should be statically allocated by the user
+ * and passed to the UDP interface during the init function
+ * no member information should be changed
+ */
+typedef struct csp_udp_handle_s {
+	int sockfd;				/**< UDP socket */
+	int eventfd;				/**< Wakes the I/O thread when packets are queued */
+	int tx_wakeup;				/**< Set when eventfd has been signalled */
+	csp_queue_handle_t tx_queue;		/**< Packets waiting to be sent */
+	struct sockaddr_in peers[256];		/**< Peer per MAC address, port 0 if unset */
+	pthread_t thread;			/**< I/O thread */
+	csp_iface_t * iface;
+} csp_udp_handle_t;
+
+/**
+ * Set the UDP peer for a MAC address
+ * @param iface UDP interface
+ * @param mac MAC address used in the routing table
+ * @param host IPv4 address or host name of peer
+ * @param port UDP port of peer
+ * @return CSP_ERR
+ */
+int csp_udp_peer_set(csp_iface_t * iface, uint8_t mac, const char * host, uint16_t port);
+
+/**
+ * Setup UDP interface
+ * @param iface Interface to setup, statically allocated by the user
+ * @param handle Driver handle, statically allocated by the user
+ * @param name Interface name
+ * @param lport Local UDP port to receive on
+ * @return CSP_ERR
+ */
+int csp_udp_init(csp_iface_t * iface, csp_udp_handle_t * handle, const char * name, uint16_t lport);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CSP_IF_UDP_H_ */
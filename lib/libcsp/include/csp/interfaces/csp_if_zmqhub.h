@@ -3,6 +3,11 @@
 
 #include <csp/csp.h>
 
+/**
+ * ZMQ interfaces start with an MTU of 256 bytes. On ground networks the
+ * MTU may be raised by setting csp_iface_t.mtu after init, up to the
+ * largest CSP buffer, see csp_buffer_init_class().
+ */
 extern csp_iface_t csp_if_zmqhub;
 
 /**
@@ -23,4 +28,26 @@ int csp_zmqhub_init(char addr, char * host);
 int csp_zmqhub_init_w_endpoints(char _addr, char * publisher_url,
 		char * subscriber_url);
 
+/**
+ * Setup an additional ZMQ interface. Each interface has its own sockets
+ * and subscriptions, and all share one ZMQ context.
+ * @param name Interface name, must stay valid and be unique
+ * @param rxfilter Addresses to receive messages for, NULL means all
+ * @param rxfilter_count Number of addresses in rxfilter
+ * @param publisher_endpoint Pointer to string containing zmqproxy publisher endpoint
+ * @param subscriber_endpoint Pointer to string containing zmqproxy subscriber endpoint
+ * @param iface Returns the new interface, may be NULL
+ * @return CSP_ERR
+ */
+int csp_zmqhub_init_w_name_endpoints_rxfilter(const char * name, const uint8_t rxfilter[], unsigned int rxfilter_count,
+		const char * publisher_endpoint, const char * subscriber_endpoint, csp_iface_t ** iface);
+
+/**
+ * Set the number of ZMQ I/O threads shared by all interfaces.
+ * Must be called before the first interface is initialized.
+ * @param count Number of I/O threads
+ * @return CSP_ERR
+ */
+int csp_zmqhub_set_io_threads(int count);
+
 #endif /* CSP_IF_ZMQHUB_H_ */
@@ -165,8 +165,10 @@ int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 	}
 
 	/* Truncate hash and copy to packet */
-	memcpy(&packet->data[packet->length], hmac, CSP_HMAC_LENGTH);
-	packet->length += CSP_HMAC_LENGTH;
+	void * tail = csp_packet_put(packet, CSP_HMAC_LENGTH);
+	if (tail == NULL)
+		return CSP_ERR_NOBUFS;
+	memcpy(tail, hmac, CSP_HMAC_LENGTH);
 
 	return CSP_ERR_NONE;
 
@@ -178,6 +180,9 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 	if (packet == NULL)
 		return CSP_ERR_INVAL;
 
+	if (packet->length < CSP_HMAC_LENGTH)
+		return CSP_ERR_INVAL;
+
 	uint8_t hmac[SHA1_DIGESTSIZE];
 
 	/* Calculate HMAC */
@@ -193,7 +198,7 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 		return CSP_ERR_HMAC;
 	} else {
 		/* Strip HMAC */
-		packet->length -= CSP_HMAC_LENGTH;
+		csp_packet_trim(packet, CSP_HMAC_LENGTH);
 		return CSP_ERR_NONE;
 	}
 
@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp.h>
 #include <csp/csp_interface.h>
 #include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
 #include "csp_route.h"
 #include "csp_qfifo.h"
 #include "csp_io.h"
@@ -38,10 +39,11 @@ CSP_DEFINE_TASK(csp_bridge) {
 	while (1) {
 
 		/* Get next packet to route */
-		if (csp_qfifo_read(&input) != CSP_ERR_NONE)
+		if (csp_qfifo_read(&input, FIFO_TIMEOUT) != CSP_ERR_NONE)
 			continue;
 
 		packet = input.packet;
+		csp_iflist_hist_add(&input.interface->dwell, csp_get_ms() - input.timestamp);
 
 		csp_log_packet("Input: Src %u, Dst %u, Dport %u, Sport %u, Pri %u, Flags 0x%02X, Size %"PRIu16,
 				packet->id.src, packet->id.dst, packet->id.dport,
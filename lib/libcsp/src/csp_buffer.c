@@ -33,77 +33,203 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define CSP_BUFFER_ALIGN	(sizeof(int *))
 #endif
 
+/* Maximum number of buffer classes */
+#define CSP_BUFFER_CLASSES	4
+
+/* Pool of equally sized buffers */
+typedef struct {
+	csp_queue_handle_t queue;
+	char * pool;
+	unsigned int count;
+	unsigned int size;
+	unsigned int skbfsize;
+} csp_buffer_class_t;
+
 typedef struct csp_skbf_s {
 	unsigned int refcount;
 	void * skbf_addr;
+	csp_buffer_class_t * class_ptr;
 	char skbf_data[];
 } csp_skbf_t;
 
-static csp_queue_handle_t csp_buffers;
-static char * csp_buffer_pool;
-static unsigned int count, size;
+/* Classes sorted by increasing size */
+static csp_buffer_class_t csp_buffer_classes[CSP_BUFFER_CLASSES];
+static unsigned int csp_buffer_class_count;
+
+/* Classes in memory provided by drivers, only used through csp_buffer_get_pool() */
+static csp_buffer_class_t csp_buffer_pools[CSP_BUFFER_CLASSES];
+static unsigned int csp_buffer_pool_count;
 
 CSP_DEFINE_CRITICAL(csp_critical_lock);
 
-int csp_buffer_init(int buf_count, int buf_size) {
+static unsigned int csp_buffer_skbf_size(int buf_size) {
+	unsigned int skbfsize = sizeof(csp_skbf_t) + buf_size + CSP_BUFFER_PACKET_OVERHEAD;
+	return CSP_BUFFER_ALIGN * ((skbfsize + CSP_BUFFER_ALIGN - 1) / CSP_BUFFER_ALIGN);
+}
+
+/* Create a class in pool, or in allocated memory if pool is NULL */
+static int csp_buffer_class_create(csp_buffer_class_t * c, int buf_count, int buf_size, void * pool) {
 
 	unsigned int i;
 	csp_skbf_t * buf;
 
-	count = buf_count;
-	size = buf_size + CSP_BUFFER_PACKET_OVERHEAD;
-	unsigned int skbfsize = (sizeof(csp_skbf_t) + size);
-	skbfsize = CSP_BUFFER_ALIGN * ((skbfsize + CSP_BUFFER_ALIGN - 1) / CSP_BUFFER_ALIGN);
-	unsigned int poolsize = count * skbfsize;
-
-	csp_buffer_pool = csp_malloc(poolsize);
-	if (csp_buffer_pool == NULL)
-		goto fail_malloc;
+	c->count = buf_count;
+	c->size = buf_size + CSP_BUFFER_PACKET_OVERHEAD;
+	c->skbfsize = csp_buffer_skbf_size(buf_size);
+	unsigned int poolsize = c->count * c->skbfsize;
 
-	csp_buffers = csp_queue_create(count, sizeof(void *));
-	if (!csp_buffers)
-		goto fail_queue;
+	c->pool = (pool != NULL) ? pool : csp_malloc(poolsize);
+	if (c->pool == NULL)
+		return CSP_ERR_NOMEM;
 
-	if (CSP_INIT_CRITICAL(csp_critical_lock) != CSP_ERR_NONE)
-		goto fail_critical;
+	c->queue = csp_queue_create(c->count, sizeof(void *));
+	if (!c->queue) {
+		if (pool == NULL)
+			csp_free(c->pool);
+		return CSP_ERR_NOMEM;
+	}
 
-	memset(csp_buffer_pool, 0, poolsize);
+	memset(c->pool, 0, poolsize);
 
-	for (i = 0; i < count; i++) {
+	for (i = 0; i < c->count; i++) {
 
 		/* We have already taken care of pointer alignment since
 		 * skbfsize is an integer multiple of sizeof(int *)
 		 * but the explicit cast to a void * is still necessary
 		 * to tell the compiler so.
 		 */
-		buf = (void *) &csp_buffer_pool[i * skbfsize];
+		buf = (void *) &c->pool[i * c->skbfsize];
 		buf->refcount = 0;
 		buf->skbf_addr = buf;
 
-		csp_queue_enqueue(csp_buffers, &buf, 0);
+		csp_queue_enqueue(c->queue, &buf, 0);
 
 	}
 
 	return CSP_ERR_NONE;
 
-fail_critical:
-	csp_queue_remove(csp_buffers);
-fail_queue:
-	csp_free(csp_buffer_pool);
-fail_malloc:
-	return CSP_ERR_NOMEM;
+}
+
+int csp_buffer_init(int buf_count, int buf_size) {
+
+	if (CSP_INIT_CRITICAL(csp_critical_lock) != CSP_ERR_NONE)
+		return CSP_ERR_NOMEM;
+
+	csp_buffer_class_count = 0;
+
+	return csp_buffer_init_class(buf_count, buf_size);
 
 }
 
-void *csp_buffer_get_isr(size_t buf_size) {
+int csp_buffer_init_class(int buf_count, int buf_size) {
+
+	unsigned int i;
+	csp_buffer_class_t c;
+
+	if (csp_buffer_class_count >= CSP_BUFFER_CLASSES)
+		return CSP_ERR_INVAL;
+
+	if (csp_buffer_class_create(&c, buf_count, buf_size, NULL) != CSP_ERR_NONE)
+		return CSP_ERR_NOMEM;
+
+	/* Insert sorted by size, and point the buffers at their class */
+	for (i = csp_buffer_class_count; i > 0 && csp_buffer_classes[i - 1].size > c.size; i--)
+		csp_buffer_classes[i] = csp_buffer_classes[i - 1];
+	csp_buffer_classes[i] = c;
+	csp_buffer_class_count++;
+
+	for (i = 0; i < csp_buffer_class_count; i++) {
+		csp_buffer_class_t * cls = &csp_buffer_classes[i];
+		unsigned int j;
+		for (j = 0; j < cls->count; j++) {
+			csp_skbf_t * buf = (void *) &cls->pool[j * cls->skbfsize];
+			buf->class_ptr = cls;
+		}
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
+size_t csp_buffer_pool_size(int buf_count, int buf_size) {
+	return buf_count * csp_buffer_skbf_size(buf_size);
+}
+
+int csp_buffer_init_pool(void * pool, int buf_count, int buf_size) {
+
+	if (((uintptr_t) pool % CSP_BUFFER_ALIGN) > 0)
+		return CSP_ERR_INVAL;
+
+	if (csp_buffer_pool_count >= CSP_BUFFER_CLASSES)
+		return CSP_ERR_INVAL;
+
+	csp_buffer_class_t * c = &csp_buffer_pools[csp_buffer_pool_count];
+	if (csp_buffer_class_create(c, buf_count, buf_size, pool) != CSP_ERR_NONE)
+		return CSP_ERR_NOMEM;
+
+	for (int i = 0; i < buf_count; i++) {
+		csp_skbf_t * buf = (void *) &c->pool[i * c->skbfsize];
+		buf->class_ptr = c;
+	}
+	csp_buffer_pool_count++;
+
+	return CSP_ERR_NONE;
+
+}
+
+void * csp_buffer_get_pool(void * pool) {
+
+	csp_skbf_t * buffer;
+	unsigned int i;
+
+	for (i = 0; i < csp_buffer_pool_count; i++) {
+		if (csp_buffer_pools[i].pool != pool)
+			continue;
+		if (csp_queue_dequeue(csp_buffer_pools[i].queue, &buffer, 0) != CSP_QUEUE_OK)
+			return NULL;
+		if (buffer != buffer->skbf_addr) {
+			csp_log_error("Corrupt CSP buffer");
+			return NULL;
+		}
+		buffer->refcount++;
+		return buffer->skbf_data;
+	}
+
+	return NULL;
+
+}
+
+/* Room kept for the trailers CSP appends in place: RDP header, CRC32, HMAC and XTEA nonce */
+#define CSP_BUFFER_TRAILER	32
+
+/* Take a buffer from the smallest class with room for the data and trailers,
+ * or with room for the data only if no such class has a free buffer */
+static csp_skbf_t * csp_buffer_take(size_t buf_size, int isr) {
 
 	csp_skbf_t * buffer = NULL;
 	CSP_BASE_TYPE task_woken = 0;
+	unsigned int pass, i;
+
+	for (pass = 0; pass < 2 && buffer == NULL; pass++) {
+		size_t need = buf_size + CSP_BUFFER_PACKET_OVERHEAD + (pass == 0 ? CSP_BUFFER_TRAILER : 0);
+		for (i = 0; i < csp_buffer_class_count && buffer == NULL; i++) {
+			if (need > csp_buffer_classes[i].size)
+				continue;
+			if (isr) {
+				csp_queue_dequeue_isr(csp_buffer_classes[i].queue, &buffer, &task_woken);
+			} else {
+				csp_queue_dequeue(csp_buffer_classes[i].queue, &buffer, 0);
+			}
+		}
+	}
 
-	if (buf_size + CSP_BUFFER_PACKET_OVERHEAD > size)
-		return NULL;
+	return buffer;
 
-	csp_queue_dequeue_isr(csp_buffers, &buffer, &task_woken);
+}
+
+void *csp_buffer_get_isr(size_t buf_size) {
+
+	csp_skbf_t * buffer = csp_buffer_take(buf_size, 1);
 	if (buffer == NULL)
 		return NULL;
 
@@ -117,14 +243,12 @@ void *csp_buffer_get_isr(size_t buf_size) {
 
 void *csp_buffer_get(size_t buf_size) {
 
-	csp_skbf_t * buffer = NULL;
-
-	if (buf_size + CSP_BUFFER_PACKET_OVERHEAD > size) {
+	if (csp_buffer_class_count == 0 || buf_size + CSP_BUFFER_PACKET_OVERHEAD > csp_buffer_classes[csp_buffer_class_count - 1].size) {
 		csp_log_error("Attempt to allocate too large block %u", buf_size);
 		return NULL;
 	}
 
-	csp_queue_dequeue(csp_buffers, &buffer, 0);
+	csp_skbf_t * buffer = csp_buffer_take(buf_size, 0);
 	if (buffer == NULL) {
 		csp_log_error("Out of buffers");
 		return NULL;
@@ -161,7 +285,7 @@ void csp_buffer_free_isr(void *packet) {
 		return;
 	} else {
 		buf->refcount = 0;
-		csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
+		csp_queue_enqueue_isr(buf->class_ptr->queue, &buf, &task_woken);
 	}
 
 }
@@ -194,7 +318,7 @@ void csp_buffer_free(void *packet) {
 	} else {
 		buf->refcount = 0;
 		csp_log_buffer("FREE: %p", buf);
-		csp_queue_enqueue(csp_buffers, &buf, 0);
+		csp_queue_enqueue(buf->class_ptr->queue, &buf, 0);
 	}
 
 }
@@ -208,17 +332,87 @@ void *csp_buffer_clone(void *buffer) {
 
 	csp_packet_t *clone = csp_buffer_get(packet->length);
 
-	if (clone)
-		memcpy(clone, packet, size);
+	/* Copy the whole buffer, up to the size of the smaller class */
+	if (clone) {
+		unsigned int src_size = csp_buffer_size_of(packet);
+		unsigned int dst_size = csp_buffer_size_of(clone);
+		memcpy(clone, packet, (src_size < dst_size) ? src_size : dst_size);
+	}
 
 	return clone;
 
 }
 
+csp_packet_t * csp_buffer_compact(csp_packet_t * packet) {
+
+	csp_skbf_t * buf = (void *) packet - sizeof(csp_skbf_t);
+	csp_skbf_t * small = NULL;
+	size_t need = packet->length + CSP_BUFFER_PACKET_OVERHEAD + CSP_BUFFER_TRAILER;
+	unsigned int i;
+
+	if (need > buf->class_ptr->size / 2)
+		return NULL;
+
+	/* Only classes smaller than the current one, without logging when empty */
+	for (i = 0; i < csp_buffer_class_count && &csp_buffer_classes[i] != buf->class_ptr; i++) {
+		if (need > csp_buffer_classes[i].size)
+			continue;
+		if (csp_queue_dequeue(csp_buffer_classes[i].queue, &small, 0) == CSP_QUEUE_OK)
+			break;
+		small = NULL;
+	}
+
+	if (small == NULL)
+		return NULL;
+
+	small->refcount++;
+	csp_packet_t * copy = (void *) small->skbf_data;
+	memcpy(copy, packet, CSP_BUFFER_PACKET_OVERHEAD + packet->length);
+
+	return copy;
+
+}
+
 int csp_buffer_remaining(void) {
-	return csp_queue_size(csp_buffers);
+	unsigned int i;
+	int remaining = 0;
+	for (i = 0; i < csp_buffer_class_count; i++)
+		remaining += csp_queue_size(csp_buffer_classes[i].queue);
+	return remaining;
 }
 
 int csp_buffer_size(void) {
-	return size;
+	if (csp_buffer_class_count == 0)
+		return 0;
+	return csp_buffer_classes[csp_buffer_class_count - 1].size;
+}
+
+int csp_buffer_size_of(void * packet) {
+	csp_skbf_t * buf = packet - sizeof(csp_skbf_t);
+	return buf->class_ptr->size;
+}
+
+void * csp_packet_push(csp_packet_t * packet, unsigned int len) {
+	if (len > CSP_PACKET_HEADROOM)
+		return NULL;
+	return (uint8_t *) &packet->id - len;
+}
+
+int csp_packet_tailroom(csp_packet_t * packet) {
+	return csp_buffer_size_of(packet) - CSP_BUFFER_PACKET_OVERHEAD - packet->length;
+}
+
+void * csp_packet_put(csp_packet_t * packet, unsigned int len) {
+	if ((int) len > csp_packet_tailroom(packet))
+		return NULL;
+	void * tail = &packet->data[packet->length];
+	packet->length += len;
+	return tail;
+}
+
+void * csp_packet_trim(csp_packet_t * packet, unsigned int len) {
+	if (len > packet->length)
+		return NULL;
+	packet->length -= len;
+	return &packet->data[packet->length];
 }
@@ -48,13 +48,124 @@ static uint8_t sport;
 /* Source port lock */
 static csp_bin_sem_handle_t sport_lock;
 
+#ifdef CSP_USE_RDP
+/* Connection timers, in a binary min-heap ordered by deadline */
+static csp_conn_t * conn_timers[CSP_CONN_MAX];
+static int conn_timer_count;
+
+/* Connection timer lock */
+static csp_bin_sem_handle_t conn_timer_lock;
+
+static inline int csp_conn_timer_before(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+static void csp_conn_timer_place(csp_conn_t * conn, int i) {
+	conn_timers[i] = conn;
+	conn->timer_index = i;
+}
+
+static void csp_conn_timer_up(int i) {
+	csp_conn_t * conn = conn_timers[i];
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!csp_conn_timer_before(conn->timer_deadline, conn_timers[parent]->timer_deadline))
+			break;
+		csp_conn_timer_place(conn_timers[parent], i);
+		i = parent;
+	}
+	csp_conn_timer_place(conn, i);
+}
+
+static void csp_conn_timer_down(int i) {
+	csp_conn_t * conn = conn_timers[i];
+	while (2 * i + 1 < conn_timer_count) {
+		int child = 2 * i + 1;
+		if (child + 1 < conn_timer_count && csp_conn_timer_before(conn_timers[child + 1]->timer_deadline, conn_timers[child]->timer_deadline))
+			child++;
+		if (!csp_conn_timer_before(conn_timers[child]->timer_deadline, conn->timer_deadline))
+			break;
+		csp_conn_timer_place(conn_timers[child], i);
+		i = child;
+	}
+	csp_conn_timer_place(conn, i);
+}
+
+static void csp_conn_timer_remove(csp_conn_t * conn) {
+	int i = conn->timer_index;
+	conn->timer_index = -1;
+	if (--conn_timer_count == i)
+		return;
+	csp_conn_t * last = conn_timers[conn_timer_count];
+	csp_conn_timer_place(last, i);
+	csp_conn_timer_up(i);
+	csp_conn_timer_down(last->timer_index);
+}
+
+void csp_conn_timer_set(csp_conn_t * conn, uint32_t deadline) {
+
+	csp_bin_sem_wait(&conn_timer_lock, CSP_MAX_DELAY);
+
+	/* An armed timer is only moved earlier */
+	if (conn->timer_index < 0) {
+		conn->timer_deadline = deadline;
+		csp_conn_timer_place(conn, conn_timer_count++);
+		csp_conn_timer_up(conn->timer_index);
+	} else if (csp_conn_timer_before(deadline, conn->timer_deadline)) {
+		conn->timer_deadline = deadline;
+		csp_conn_timer_up(conn->timer_index);
+	}
+
+	csp_bin_sem_post(&conn_timer_lock);
+
+}
+
+void csp_conn_timer_cancel(csp_conn_t * conn) {
+
+	csp_bin_sem_wait(&conn_timer_lock, CSP_MAX_DELAY);
+	if (conn->timer_index >= 0)
+		csp_conn_timer_remove(conn);
+	csp_bin_sem_post(&conn_timer_lock);
+
+}
+
+uint32_t csp_conn_timer_wait(uint32_t timeout) {
+
+	uint32_t wait = timeout;
+
+	csp_bin_sem_wait(&conn_timer_lock, CSP_MAX_DELAY);
+	if (conn_timer_count > 0) {
+		int32_t left = conn_timers[0]->timer_deadline - csp_get_ms();
+		if (left < 0)
+			left = 0;
+		if ((uint32_t) left < wait)
+			wait = left;
+	}
+	csp_bin_sem_post(&conn_timer_lock);
+
+	return wait;
+
+}
+#endif
+
 void csp_conn_check_timeouts(void) {
 #ifdef CSP_USE_RDP
-	int i;
-	for (i = 0; i < CSP_CONN_MAX; i++)
-		if (arr_conn[i].state == CONN_OPEN)
-			if (arr_conn[i].idin.flags & CSP_FRDP)
-				csp_rdp_check_timeouts(&arr_conn[i]);
+	csp_conn_t * due[CSP_CONN_MAX];
+	int i, count = 0;
+	uint32_t now = csp_get_ms();
+
+	/* Take the due timers off the heap, they are set again by the handler if needed */
+	csp_bin_sem_wait(&conn_timer_lock, CSP_MAX_DELAY);
+	while (conn_timer_count > 0 && !csp_conn_timer_before(now, conn_timers[0]->timer_deadline)) {
+		due[count++] = conn_timers[0];
+		csp_conn_timer_remove(conn_timers[0]);
+	}
+	csp_bin_sem_post(&conn_timer_lock);
+
+	for (i = 0; i < count; i++)
+		if (due[i]->state == CONN_OPEN)
+			if (due[i]->idin.flags & CSP_FRDP)
+				csp_rdp_check_timeouts(due[i]);
 #endif
 }
 
@@ -133,6 +244,9 @@ int csp_conn_init(void) {
 		arr_conn[i].rx_event = csp_queue_create(CSP_CONN_QUEUE_LENGTH, sizeof(int));
 #endif
 		arr_conn[i].state = CONN_CLOSED;
+#ifdef CSP_USE_RDP
+		arr_conn[i].timer_index = -1;
+#endif
 
 		if (csp_mutex_create(&arr_conn[i].lock) != CSP_MUTEX_OK) {
 			csp_log_error("Failed to create connection lock");
@@ -141,7 +255,7 @@ int csp_conn_init(void) {
 
 #ifdef CSP_USE_RDP
 		if (csp_rdp_allocate(&arr_conn[i]) != CSP_ERR_NONE) {
-			csp_log_error("Failed to create queues for RDP in csp_conn_init");
+			csp_log_error("Failed to allocate RDP state in csp_conn_init");
 			return CSP_ERR_NOMEM;
 		}
 #endif
@@ -152,6 +266,13 @@ int csp_conn_init(void) {
 		return CSP_ERR_NOMEM;
 	}
 
+#ifdef CSP_USE_RDP
+	if (csp_bin_sem_create(&conn_timer_lock) != CSP_SEMAPHORE_OK) {
+		csp_log_error("No more memory for conn timer semaphore");
+		return CSP_ERR_NOMEM;
+	}
+#endif
+
 	return CSP_ERR_NONE;
 
 }
@@ -286,6 +407,7 @@ int csp_close(csp_conn_t * conn) {
 
 	/* Reset RDP state */
 #ifdef CSP_USE_RDP
+	csp_conn_timer_cancel(conn);
 	if (conn->idin.flags & CSP_FRDP)
 		csp_rdp_flush_all(conn);
 #endif
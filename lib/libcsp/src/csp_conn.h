@@ -50,8 +50,20 @@ typedef enum {
 	RDP_SYN_RCVD,
 	RDP_OPEN,
 	RDP_CLOSE_WAIT,
+	RDP_SUSPENDED,
 } csp_rdp_state_t;
 
+/** Smallest power of two not less than n, up to the sequence number space */
+#define CSP_RDP_POW2(n)		((n) <= 8 ? 8 : (n) <= 16 ? 16 : (n) <= 32 ? 32 : (n) <= 64 ? 64 : \
+				(n) <= 128 ? 128 : (n) <= 256 ? 256 : (n) <= 512 ? 512 : (n) <= 1024 ? 1024 : \
+				(n) <= 2048 ? 2048 : (n) <= 4096 ? 4096 : (n) <= 8192 ? 8192 : (n) <= 16384 ? 16384 : 32768)
+
+/** Slots in the RDP windows. A power of two, so consecutive sequence numbers
+ * map to different slots across wrap-around. The TX window holds up to one
+ * segment more than the window size, and the RX window twice the window size. */
+#define CSP_RDP_TX_SLOTS	CSP_RDP_POW2(CSP_RDP_MAX_WINDOW + 1)
+#define CSP_RDP_RX_SLOTS	CSP_RDP_POW2(CSP_RDP_MAX_WINDOW * 2)
+
 /** @brief RDP Connection header
  *  @note Do not try to pack this struct, the posix sem handle will stop working */
 typedef struct {
@@ -68,10 +80,20 @@ typedef struct {
 	uint32_t delayed_acks;
 	uint32_t ack_timeout;
 	uint32_t ack_delay_count;
+	uint32_t options;		/**< Options negotiated in the SYN */
+	uint32_t srtt;			/**< Smoothed round-trip time in 1/8 ms, zero until sampled */
+	uint32_t rttvar;		/**< Round-trip time variation in 1/8 ms */
+	uint32_t rto;			/**< Retransmission timeout in ms */
+	uint32_t retransmits;		/**< Segments retransmitted after a timeout */
+	uint32_t fast_retransmits;	/**< Segments retransmitted after EACKs */
+	uint32_t rx_timestamp;		/**< Time the other end was last heard from */
+	uint32_t suspend_grace;		/**< Time to stay suspended before closing, zero to close on timeout */
+	uint32_t suspend_timestamp;	/**< Time the connection was suspended */
+	uint32_t suspends;		/**< Times the connection was suspended */
 	uint32_t ack_timestamp;
 	csp_bin_sem_handle_t tx_wait;
-	csp_queue_handle_t tx_queue;
-	csp_queue_handle_t rx_queue;
+	csp_packet_t * tx_window[CSP_RDP_TX_SLOTS];	/**< Unacknowledged segments, indexed by sequence number */
+	csp_packet_t * rx_window[CSP_RDP_RX_SLOTS];	/**< Segments received out of order, indexed by sequence number */
 } csp_rdp_t;
 
 /** @brief Connection struct */
@@ -90,6 +112,8 @@ struct csp_conn_s {
 	uint32_t opts;			/* Connection or socket options */
 #ifdef CSP_USE_RDP
 	csp_rdp_t rdp;			/* RDP state */
+	uint32_t timer_deadline;	/* Time the connection timer is due */
+	int timer_index;		/* Position in timer heap, -1 if not armed */
 #endif
 };
 
@@ -101,6 +125,9 @@ csp_conn_t * csp_conn_allocate(csp_conn_type_t type);
 csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask);
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout);
 void csp_conn_check_timeouts(void);
+void csp_conn_timer_set(csp_conn_t * conn, uint32_t deadline);
+void csp_conn_timer_cancel(csp_conn_t * conn);
+uint32_t csp_conn_timer_wait(uint32_t timeout);
 int csp_conn_get_rxq(int prio);
 
 #ifdef __cplusplus
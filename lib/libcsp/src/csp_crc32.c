@@ -97,8 +97,10 @@ int csp_crc32_append(csp_packet_t * packet, bool include_header) {
 	crc = csp_hton32(crc);
 
 	/* Copy checksum to packet */
-	memcpy(&packet->data[packet->length], &crc, sizeof(uint32_t));
-	packet->length += sizeof(uint32_t);
+	void * tail = csp_packet_put(packet, sizeof(uint32_t));
+	if (tail == NULL)
+		return CSP_ERR_NOBUFS;
+	memcpy(tail, &crc, sizeof(uint32_t));
 
 	return CSP_ERR_NONE;
 
@@ -129,7 +131,7 @@ int csp_crc32_verify(csp_packet_t * packet, bool include_header) {
 		return CSP_ERR_INVAL;
 	} else {
 		/* Strip CRC32 */
-		packet->length -= sizeof(uint32_t);
+		csp_packet_trim(packet, sizeof(uint32_t));
 		return CSP_ERR_NONE;
 	}
 
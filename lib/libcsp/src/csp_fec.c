@@ -0,0 +1,332 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Reed-Solomon RS(255,223) over GF(2^8), field polynomial 0x11d, first
+ * consecutive root 1. The codec uses log and antilog tables, with the
+ * Berlekamp-Massey algorithm, Chien search and Forney's formula for
+ * decoding. Short codewords are handled as shortened codes by padding
+ * with leading zeros that are never transmitted. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/csp_fec.h>
+
+#define RS_NN		255
+#define RS_A0		RS_NN		/* Log of zero */
+#define RS_NROOTS	CSP_FEC_PARITY
+#define RS_FCR		1
+#define RS_GFPOLY	0x11d
+
+static uint8_t rs_alpha_to[RS_NN + 1];	/* Antilog table */
+static uint8_t rs_index_of[RS_NN + 1];	/* Log table */
+static uint8_t rs_genpoly[RS_NROOTS + 1];	/* Generator polynomial in log form */
+static int rs_ready = 0;
+
+static inline unsigned int rs_modnn(unsigned int x) {
+	while (x >= RS_NN) {
+		x -= RS_NN;
+		x = (x >> 8) + (x & RS_NN);
+	}
+	return x;
+}
+
+static void rs_init(void) {
+
+	unsigned int i, j, sr = 1;
+
+	/* Generate Galois field tables */
+	rs_index_of[0] = RS_A0;
+	rs_alpha_to[RS_A0] = 0;
+	for (i = 0; i < RS_NN; i++) {
+		rs_index_of[sr] = i;
+		rs_alpha_to[i] = sr;
+		sr <<= 1;
+		if (sr & 0x100)
+			sr ^= RS_GFPOLY;
+		sr &= RS_NN;
+	}
+
+	/* Form generator polynomial from its roots */
+	rs_genpoly[0] = 1;
+	for (i = 0; i < RS_NROOTS; i++) {
+		unsigned int root = RS_FCR + i;
+		rs_genpoly[i + 1] = 1;
+		for (j = i; j > 0; j--) {
+			if (rs_genpoly[j] != 0)
+				rs_genpoly[j] = rs_genpoly[j - 1] ^ rs_alpha_to[rs_modnn(rs_index_of[rs_genpoly[j]] + root)];
+			else
+				rs_genpoly[j] = rs_genpoly[j - 1];
+		}
+		rs_genpoly[0] = rs_alpha_to[rs_modnn(rs_index_of[rs_genpoly[0]] + root)];
+	}
+	for (i = 0; i <= RS_NROOTS; i++)
+		rs_genpoly[i] = rs_index_of[rs_genpoly[i]];
+
+	rs_ready = 1;
+
+}
+
+/* Compute parity of len data bytes read with stride */
+static void rs_encode(const uint8_t * data, unsigned int len, unsigned int stride, uint8_t * parity) {
+
+	unsigned int i, j;
+
+	memset(parity, 0, RS_NROOTS);
+
+	for (i = 0; i < len; i++) {
+		uint8_t feedback = rs_index_of[data[i * stride] ^ parity[0]];
+		if (feedback != RS_A0) {
+			for (j = 1; j < RS_NROOTS; j++)
+				parity[j] ^= rs_alpha_to[rs_modnn(feedback + rs_genpoly[RS_NROOTS - j])];
+		}
+		memmove(&parity[0], &parity[1], RS_NROOTS - 1);
+		if (feedback != RS_A0)
+			parity[RS_NROOTS - 1] = rs_alpha_to[rs_modnn(feedback + rs_genpoly[0])];
+		else
+			parity[RS_NROOTS - 1] = 0;
+	}
+
+}
+
+/* Correct codeword of data followed by parity, shortened by pad bytes.
+ * Returns number of corrected bytes, or -1 if uncorrectable */
+static int rs_decode(uint8_t * data, unsigned int pad) {
+
+	uint8_t lambda[RS_NROOTS + 1], s[RS_NROOTS], b[RS_NROOTS + 1], t[RS_NROOTS + 1];
+	uint8_t omega[RS_NROOTS + 1], reg[RS_NROOTS + 1], root[RS_NROOTS], loc[RS_NROOTS];
+	unsigned int len = RS_NN - pad;
+	int i, j, r, el, count, deg_lambda, deg_omega;
+	uint8_t syn_error = 0, discr_r;
+
+	/* Syndromes, evaluated at the roots of the generator */
+	for (i = 0; i < RS_NROOTS; i++)
+		s[i] = data[0];
+	for (j = 1; j < (int) len; j++) {
+		for (i = 0; i < RS_NROOTS; i++) {
+			if (s[i] == 0)
+				s[i] = data[j];
+			else
+				s[i] = data[j] ^ rs_alpha_to[rs_modnn(rs_index_of[s[i]] + RS_FCR + i)];
+		}
+	}
+	for (i = 0; i < RS_NROOTS; i++) {
+		syn_error |= s[i];
+		s[i] = rs_index_of[s[i]];
+	}
+	if (syn_error == 0)
+		return 0;
+
+	/* Berlekamp-Massey, find the error locator polynomial */
+	memset(&lambda[1], 0, RS_NROOTS);
+	lambda[0] = 1;
+	for (i = 0; i < RS_NROOTS + 1; i++)
+		b[i] = rs_index_of[lambda[i]];
+
+	el = 0;
+	for (r = 1; r <= RS_NROOTS; r++) {
+		discr_r = 0;
+		for (i = 0; i < r; i++) {
+			if ((lambda[i] != 0) && (s[r - i - 1] != RS_A0))
+				discr_r ^= rs_alpha_to[rs_modnn(rs_index_of[lambda[i]] + s[r - i - 1])];
+		}
+		discr_r = rs_index_of[discr_r];
+		if (discr_r == RS_A0) {
+			memmove(&b[1], b, RS_NROOTS);
+			b[0] = RS_A0;
+		} else {
+			t[0] = lambda[0];
+			for (i = 0; i < RS_NROOTS; i++) {
+				if (b[i] != RS_A0)
+					t[i + 1] = lambda[i + 1] ^ rs_alpha_to[rs_modnn(discr_r + b[i])];
+				else
+					t[i + 1] = lambda[i + 1];
+			}
+			if (2 * el <= r - 1) {
+				el = r - el;
+				for (i = 0; i <= RS_NROOTS; i++)
+					b[i] = (lambda[i] == 0) ? RS_A0 : rs_modnn(rs_index_of[lambda[i]] - discr_r + RS_NN);
+			} else {
+				memmove(&b[1], b, RS_NROOTS);
+				b[0] = RS_A0;
+			}
+			memcpy(lambda, t, RS_NROOTS + 1);
+		}
+	}
+
+	deg_lambda = 0;
+	for (i = 0; i < RS_NROOTS + 1; i++) {
+		lambda[i] = rs_index_of[lambda[i]];
+		if (lambda[i] != RS_A0)
+			deg_lambda = i;
+	}
+
+	/* Chien search, find the roots of the error locator */
+	memcpy(&reg[1], &lambda[1], RS_NROOTS);
+	count = 0;
+	for (i = 1, j = 0; i <= RS_NN; i++, j++) {
+		uint8_t q = 1;
+		int k;
+		for (k = deg_lambda; k > 0; k--) {
+			if (reg[k] != RS_A0) {
+				reg[k] = rs_modnn(reg[k] + k);
+				q ^= rs_alpha_to[reg[k]];
+			}
+		}
+		if (q != 0)
+			continue;
+		root[count] = i;
+		loc[count] = j;
+		if (++count == deg_lambda)
+			break;
+	}
+	if (deg_lambda != count)
+		return -1;
+
+	/* Error evaluator polynomial */
+	deg_omega = deg_lambda - 1;
+	for (i = 0; i <= deg_omega; i++) {
+		uint8_t tmp = 0;
+		for (j = i; j >= 0; j--) {
+			if ((s[i - j] != RS_A0) && (lambda[j] != RS_A0))
+				tmp ^= rs_alpha_to[rs_modnn(s[i - j] + lambda[j])];
+		}
+		omega[i] = rs_index_of[tmp];
+	}
+
+	/* Forney, compute and apply error values */
+	for (j = count - 1; j >= 0; j--) {
+		uint8_t num1 = 0, num2, den = 0;
+		for (i = deg_omega; i >= 0; i--) {
+			if (omega[i] != RS_A0)
+				num1 ^= rs_alpha_to[rs_modnn(omega[i] + i * root[j])];
+		}
+		num2 = rs_alpha_to[rs_modnn(root[j] * (RS_FCR - 1) + RS_NN)];
+		for (i = (deg_lambda < RS_NROOTS - 1 ? deg_lambda : RS_NROOTS - 1) & ~1; i >= 0; i -= 2) {
+			if (lambda[i + 1] != RS_A0)
+				den ^= rs_alpha_to[rs_modnn(lambda[i + 1] + i * root[j])];
+		}
+
+		/* Errors in the padding mean the codeword was miscorrected */
+		if (den == 0 || loc[j] < pad)
+			return -1;
+
+		if (num1 != 0)
+			data[loc[j] - pad] ^= rs_alpha_to[rs_modnn(rs_index_of[num1] + rs_index_of[num2] + RS_NN - rs_index_of[den])];
+	}
+
+	return count;
+
+}
+
+/* Offset of the first parity byte of codeword i. Every byte m of the
+ * encoded frame belongs to codeword m % interleave, also across the end
+ * of the data, so a burst never hits one codeword more than the others */
+static unsigned int fec_parity_start(unsigned int len, unsigned int interleave, unsigned int i) {
+	return len + (i + interleave - len % interleave) % interleave;
+}
+
+/* Interleaving depth for a frame of len bytes */
+static unsigned int fec_depth(unsigned int len, uint8_t depth) {
+	unsigned int min = (len + CSP_FEC_BLOCK - 1) / CSP_FEC_BLOCK;
+	return (min > depth) ? min : depth;
+}
+
+int csp_fec_encode(const uint8_t * in, unsigned int len, uint8_t * out, uint8_t depth) {
+
+	uint8_t parity[RS_NROOTS];
+	unsigned int i, j, p;
+
+	if (depth == 0 || depth > CSP_FEC_MAX_DEPTH)
+		return CSP_ERR_INVAL;
+
+	unsigned int interleave = fec_depth(len, depth);
+	if (interleave > CSP_FEC_MAX_DEPTH)
+		return CSP_ERR_INVAL;
+
+	if (!rs_ready)
+		rs_init();
+
+	if (out != in)
+		memmove(out, in, len);
+
+	/* Codeword i holds every interleave'th byte starting at i */
+	for (i = 0; i < interleave; i++) {
+		unsigned int count = (len + interleave - 1 - i) / interleave;
+		rs_encode(&in[i], count, interleave, parity);
+		for (p = 0, j = fec_parity_start(len, interleave, i); p < RS_NROOTS; p++, j += interleave)
+			out[j] = parity[p];
+	}
+
+	return len + RS_NROOTS * interleave;
+
+}
+
+int csp_fec_decode(uint8_t * buf, unsigned int len, uint8_t depth, unsigned int * corrected) {
+
+	uint8_t cw[RS_NN];
+	unsigned int interleave, frame_len = 0, total = 0;
+	unsigned int i, j, k;
+
+	if (depth == 0 || depth > CSP_FEC_MAX_DEPTH)
+		return CSP_ERR_INVAL;
+
+	/* Find the depth the sender used for this length */
+	for (interleave = depth; interleave <= CSP_FEC_MAX_DEPTH; interleave++) {
+		if (len <= RS_NROOTS * interleave)
+			return CSP_ERR_INVAL;
+		frame_len = len - RS_NROOTS * interleave;
+		if (fec_depth(frame_len, depth) == interleave)
+			break;
+	}
+	if (interleave > CSP_FEC_MAX_DEPTH)
+		return CSP_ERR_INVAL;
+
+	if (!rs_ready)
+		rs_init();
+
+	for (i = 0; i < interleave; i++) {
+		unsigned int count = (frame_len + interleave - 1 - i) / interleave;
+
+		/* Gather codeword */
+		for (k = 0, j = i; k < count; k++, j += interleave)
+			cw[k] = buf[j];
+		for (j = fec_parity_start(frame_len, interleave, i); k < count + RS_NROOTS; k++, j += interleave)
+			cw[k] = buf[j];
+
+		int ret = rs_decode(cw, RS_NN - RS_NROOTS - count);
+		if (ret < 0)
+			return CSP_ERR_FEC;
+
+		/* Write back corrected data */
+		if (ret > 0) {
+			for (k = 0, j = i; k < count; k++, j += interleave)
+				buf[j] = cw[k];
+			total += ret;
+		}
+	}
+
+	if (corrected != NULL)
+		*corrected = total;
+
+	return frame_len;
+
+}
@@ -0,0 +1,277 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Router fragmentation and reassembly
+ *
+ * A packet larger than the MTU of the output interface is split into count
+ * fragments of equal size, except for a shorter last fragment. Each
+ * fragment keeps the CSP id of the packet with CSP_FRFRAG set, and carries
+ * a header with an identifier, the total length, and its index. Fragments
+ * are routed as normal packets and reassembled by the destination node.
+ *
+ * Reassembly contexts are kept in a small table hashed on source address
+ * and identifier. Each context holds one buffer for the complete packet,
+ * so the table size bounds the memory used, and a context is released if
+ * the packet is not complete within CSP_FRAG_TIMEOUT ms.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_io.h"
+#include "csp_frag.h"
+
+/* Maximum number of fragments per packet, one bit each in the context map */
+#define CSP_FRAG_MAX_COUNT	64
+
+/* Fragment header, in network byte order at the start of the data */
+typedef struct __attribute__((__packed__)) {
+	uint16_t ident;		/* Identifier, unique per source */
+	uint16_t total;		/* Length of the complete packet */
+	uint8_t index;		/* Fragment number */
+	uint8_t count;		/* Number of fragments */
+} csp_frag_header_t;
+
+/* Reassembly context */
+typedef struct {
+	csp_packet_t * packet;	/* Packet being assembled, NULL if free or complete */
+	uint8_t src;		/* Source address */
+	uint16_t ident;		/* Identifier */
+	uint8_t count;		/* Number of fragments */
+	uint8_t received;	/* Fragments received */
+	uint64_t map;		/* Bit n set when fragment n is received */
+	uint32_t timestamp;	/* Arrival of first fragment */
+} csp_frag_ctx_t;
+
+static csp_frag_ctx_t csp_frag_ctx[CSP_FRAG_CONTEXTS];
+static csp_bin_sem_handle_t csp_frag_lock;
+static uint16_t csp_frag_ident;
+static csp_frag_stats_t csp_frag_stats;
+
+int csp_frag_init(void) {
+
+	if (csp_bin_sem_create(&csp_frag_lock) != CSP_SEMAPHORE_OK) {
+		csp_log_error("No more memory for fragmentation lock");
+		return CSP_ERR_NOMEM;
+	}
+
+	/* Avoid reusing identifiers still held by receivers after a reboot */
+	csp_frag_ident = csp_get_ms();
+
+	return CSP_ERR_NONE;
+
+}
+
+/* Size of each fragment but the last, chosen so fragments are about equal */
+static inline unsigned int csp_frag_chunk(unsigned int total, unsigned int count) {
+	return (total + count - 1) / count;
+}
+
+int csp_frag_send(csp_iface_t * ifout, csp_packet_t * packet, uint32_t timeout) {
+
+	csp_frag_header_t header;
+	unsigned int total = packet->length;
+	unsigned int i;
+
+	/* Fragments are never split again */
+	if (packet->id.flags & CSP_FRFRAG) {
+		csp_log_warn("Fragment of %u bytes exceeds MTU %u of %s", total, ifout->mtu, ifout->name);
+		return CSP_ERR_INVAL;
+	}
+
+	if (ifout->mtu <= sizeof(header)) {
+		csp_log_warn("MTU %u of %s is too small for fragmentation", ifout->mtu, ifout->name);
+		return CSP_ERR_INVAL;
+	}
+
+	unsigned int max = ifout->mtu - sizeof(header);
+	unsigned int count = (total + max - 1) / max;
+	if (count > CSP_FRAG_MAX_COUNT) {
+		csp_log_warn("Packet of %u bytes needs too many fragments for %s", total, ifout->name);
+		return CSP_ERR_INVAL;
+	}
+	unsigned int chunk = csp_frag_chunk(total, count);
+
+	if (csp_bin_sem_wait(&csp_frag_lock, CSP_MAX_DELAY) != CSP_SEMAPHORE_OK)
+		return CSP_ERR_TIMEDOUT;
+	header.ident = csp_hton16(csp_frag_ident++);
+	csp_bin_sem_post(&csp_frag_lock);
+
+	header.total = csp_hton16(total);
+	header.count = count;
+
+	for (i = 0; i < count; i++) {
+		unsigned int offset = i * chunk;
+		unsigned int size = (i == count - 1) ? total - offset : chunk;
+
+		csp_packet_t * frag = csp_buffer_get(sizeof(header) + size);
+		if (frag == NULL)
+			return CSP_ERR_NOBUFS;
+
+		header.index = i;
+		frag->id.ext = packet->id.ext;
+		frag->id.flags |= CSP_FRFRAG;
+		memcpy(frag->data, &header, sizeof(header));
+		memcpy(frag->data + sizeof(header), packet->data + offset, size);
+		frag->length = sizeof(header) + size;
+
+		if (csp_send_iface(ifout, frag, timeout, csp_get_ms()) != CSP_ERR_NONE) {
+			csp_buffer_free(frag);
+			return CSP_ERR_TX;
+		}
+	}
+
+	csp_frag_stats.tx_packets++;
+	csp_frag_stats.tx_fragments += count;
+	csp_buffer_free(packet);
+
+	return CSP_ERR_NONE;
+
+}
+
+static void csp_frag_release(csp_frag_ctx_t * ctx) {
+	csp_buffer_free(ctx->packet);
+	ctx->packet = NULL;
+	ctx->count = 0;
+}
+
+void csp_frag_check_timeouts(void) {
+
+	uint32_t now = csp_get_ms();
+	int i;
+
+	for (i = 0; i < CSP_FRAG_CONTEXTS; i++) {
+		csp_frag_ctx_t * ctx = &csp_frag_ctx[i];
+		if (ctx->packet != NULL && now - ctx->timestamp > CSP_FRAG_TIMEOUT) {
+			csp_log_warn("Reassembly of packet %u from %u timed out, %u of %u fragments",
+					ctx->ident, ctx->src, ctx->received, ctx->count);
+			csp_frag_release(ctx);
+			csp_frag_stats.timeouts++;
+		}
+	}
+
+}
+
+/* Find context for source and identifier, or allocate a free one.
+ * A completed context is free, but still matches late duplicates. */
+static csp_frag_ctx_t * csp_frag_lookup(uint8_t src, uint16_t ident) {
+
+	unsigned int start = (src * 31 + ident) % CSP_FRAG_CONTEXTS;
+	csp_frag_ctx_t * unused = NULL;
+	unsigned int i;
+
+	for (i = 0; i < CSP_FRAG_CONTEXTS; i++) {
+		csp_frag_ctx_t * ctx = &csp_frag_ctx[(start + i) % CSP_FRAG_CONTEXTS];
+		if (ctx->count > 0 && ctx->src == src && ctx->ident == ident)
+			return ctx;
+		if (ctx->packet == NULL && unused == NULL)
+			unused = ctx;
+	}
+
+	return unused;
+
+}
+
+csp_packet_t * csp_frag_reassemble(csp_packet_t * packet) {
+
+	csp_frag_header_t header;
+
+	csp_frag_stats.rx_fragments++;
+	csp_frag_check_timeouts();
+
+	if (packet->length <= sizeof(header))
+		goto drop;
+
+	memcpy(&header, packet->data, sizeof(header));
+	header.ident = csp_ntoh16(header.ident);
+	header.total = csp_ntoh16(header.total);
+
+	if (header.count == 0 || header.count > CSP_FRAG_MAX_COUNT || header.index >= header.count)
+		goto drop;
+
+	/* The fragment must have the size the sender chose for its index */
+	unsigned int chunk = csp_frag_chunk(header.total, header.count);
+	unsigned int offset = header.index * chunk;
+	unsigned int size = packet->length - sizeof(header);
+	if (offset >= header.total || size != ((header.index == header.count - 1) ? header.total - offset : chunk))
+		goto drop;
+
+	csp_frag_ctx_t * ctx = csp_frag_lookup(packet->id.src, header.ident);
+	if (ctx == NULL) {
+		csp_log_warn("No free reassembly context for packet %u from %u", header.ident, packet->id.src);
+		goto drop;
+	}
+
+	/* Fragment of a packet already delivered */
+	if (ctx->packet == NULL && ctx->count > 0 && ctx->src == packet->id.src && ctx->ident == header.ident)
+		goto drop;
+
+	if (ctx->packet == NULL) {
+		ctx->packet = csp_buffer_get(header.total);
+		if (ctx->packet == NULL) {
+			csp_log_warn("No buffer for reassembly of %u bytes", header.total);
+			goto drop;
+		}
+		ctx->packet->id.ext = packet->id.ext;
+		ctx->packet->id.flags &= ~CSP_FRFRAG;
+		ctx->packet->length = header.total;
+		ctx->src = packet->id.src;
+		ctx->ident = header.ident;
+		ctx->count = header.count;
+		ctx->received = 0;
+		ctx->map = 0;
+		ctx->timestamp = csp_get_ms();
+	} else if (ctx->count != header.count || ctx->packet->length != header.total) {
+		goto drop;
+	}
+
+	/* Duplicate fragment */
+	if (ctx->map & ((uint64_t) 1 << header.index))
+		goto drop;
+
+	memcpy(ctx->packet->data + offset, packet->data + sizeof(header), size);
+	ctx->map |= (uint64_t) 1 << header.index;
+	ctx->received++;
+	csp_buffer_free(packet);
+
+	if (ctx->received < ctx->count)
+		return NULL;
+
+	packet = ctx->packet;
+	ctx->packet = NULL;
+	csp_frag_stats.rx_packets++;
+
+	return packet;
+
+drop:
+	csp_frag_stats.drops++;
+	csp_buffer_free(packet);
+	return NULL;
+
+}
+
+void csp_frag_get_stats(csp_frag_stats_t * stats) {
+	*stats = csp_frag_stats;
+}
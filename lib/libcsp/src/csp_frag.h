@@ -0,0 +1,53 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_FRAG_H_
+#define CSP_FRAG_H_
+
+#include <csp/csp.h>
+
+/**
+ * Initialise fragmentation and reassembly
+ * @return CSP_ERR_NONE on success, otherwise an error code
+ */
+int csp_frag_init(void);
+
+/**
+ * Split a packet larger than the interface MTU into fragments and send them
+ * @param ifout Output interface
+ * @param packet Packet to send, freed on success
+ * @param timeout Passed to the interface for each fragment
+ * @return CSP_ERR_NONE if all fragments were sent, otherwise the packet is still owned by the caller
+ */
+int csp_frag_send(csp_iface_t * ifout, csp_packet_t * packet, uint32_t timeout);
+
+/**
+ * Add a received fragment to its reassembly context
+ * @param packet Fragment, always consumed
+ * @return Reassembled packet when the last fragment arrives, otherwise NULL
+ */
+csp_packet_t * csp_frag_reassemble(csp_packet_t * packet);
+
+/**
+ * Release reassembly contexts that have timed out
+ */
+void csp_frag_check_timeouts(void);
+
+#endif /* CSP_FRAG_H_ */
@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdio.h>
 #include <csp/csp.h>
+#include <csp/csp_interface.h>
 
 /* Interfaces are stored in a linked list*/
 static csp_iface_t * interfaces = NULL;
@@ -34,6 +35,19 @@ csp_iface_t * csp_iflist_get_by_name(char *name) {
 	return ifc;
 }
 
+void csp_iflist_hist_add(csp_iface_hist_t * hist, uint32_t ms) {
+
+	unsigned int bucket = 0;
+
+	while (ms >> bucket && bucket < CSP_IF_HIST_BUCKETS - 1)
+		bucket++;
+
+	hist->count[bucket]++;
+	if (ms > hist->max)
+		hist->max = ms;
+
+}
+
 void csp_iflist_add(csp_iface_t *ifc) {
 
 	/* Add interface to pool */
@@ -75,6 +89,23 @@ int csp_bytesize(char *buf, int len, unsigned long int n) {
 	return snprintf(buf, len, "%.1f%c", size, postfix);
 }
 
+static void csp_iflist_hist_print(const char * name, csp_iface_hist_t * hist) {
+	unsigned int i;
+
+	printf("        %s:", name);
+	for (i = 0; i < CSP_IF_HIST_BUCKETS; i++) {
+		if (hist->count[i] == 0)
+			continue;
+		if (i == 0)
+			printf(" 0:%"PRIu32, hist->count[i]);
+		else if (i == CSP_IF_HIST_BUCKETS - 1)
+			printf(" %u+:%"PRIu32, 1 << (i - 1), hist->count[i]);
+		else
+			printf(" %u-%u:%"PRIu32, 1 << (i - 1), (1 << i) - 1, hist->count[i]);
+	}
+	printf(" max: %"PRIu32" ms\r\n", hist->max);
+}
+
 void csp_iflist_print(void) {
 	csp_iface_t * i = interfaces;
 	char txbuf[25], rxbuf[25];
@@ -84,9 +115,22 @@ void csp_iflist_print(void) {
 		csp_bytesize(rxbuf, 25, i->rxbytes);
 		printf("%-5s   tx: %05"PRIu32" rx: %05"PRIu32" txe: %05"PRIu32" rxe: %05"PRIu32"\r\n"
 		       "        drop: %05"PRIu32" autherr: %05"PRIu32 " frame: %05"PRIu32"\r\n"
-		       "        txb: %"PRIu32" (%s) rxb: %"PRIu32" (%s)\r\n\r\n",
+		       "        txb: %"PRIu32" (%s) rxb: %"PRIu32" (%s)\r\n",
 		       i->name, i->tx, i->rx, i->tx_error, i->rx_error, i->drop,
 		       i->autherr, i->frame, i->txbytes, txbuf, i->rxbytes, rxbuf);
+		printf("        fifo: %"PRIu32" route: %"PRIu32" split: %"PRIu32" dedup: %"PRIu32" sec: %"PRIu32" conn: %"PRIu32"\r\n",
+		       i->drops.fifo_full, i->drops.no_route, i->drops.split_horizon,
+		       i->drops.dedup, i->drops.security, i->drops.no_conn);
+		csp_iflist_hist_print("rxlat", &i->rx_latency);
+		csp_iflist_hist_print("dwell", &i->dwell);
+		csp_iflist_hist_print("txlat", &i->tx_latency);
+		if (i->txq != NULL) {
+			csp_txq_stats_t stats;
+			csp_txq_get_stats(i, &stats);
+			printf("        txq: %"PRIu32" (max %"PRIu32") drop: %"PRIu32" wait: %"PRIu32" ms (max %"PRIu32" ms)\r\n",
+			       stats.depth, stats.depth_max, stats.drops, stats.wait_avg, stats.wait_max);
+		}
+		printf("\r\n");
 		i = i->next;
 	}
 
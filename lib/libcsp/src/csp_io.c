@@ -46,6 +46,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "csp_route.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
+#include "csp_txq.h"
+#include "csp_frag.h"
 #include "transport/csp_transport.h"
 
 /** CSP address of this node */
@@ -119,6 +121,12 @@ int csp_init(unsigned char address) {
 	if (ret != CSP_ERR_NONE)
 		return ret;
 
+#ifdef CSP_USE_FRAG
+	ret = csp_frag_init();
+	if (ret != CSP_ERR_NONE)
+		return ret;
+#endif
+
 	/* Loopback */
 	csp_iflist_add(&csp_if_lo);
 
@@ -136,7 +144,7 @@ csp_socket_t * csp_socket(uint32_t opts) {
 	
 	/* Validate socket options */
 #ifndef CSP_USE_RDP
-	if (opts & CSP_SO_RDPREQ) {
+	if (opts & (CSP_SO_RDPREQ | CSP_SO_RDPFASTOPEN)) {
 		csp_log_error("Attempt to create socket that requires RDP, but CSP was compiled without RDP support");
 		return NULL;
 	}
@@ -164,7 +172,7 @@ csp_socket_t * csp_socket(uint32_t opts) {
 #endif
 	
 	/* Drop packet if reserved flags are set */
-	if (opts & ~(CSP_SO_RDPREQ | CSP_SO_XTEAREQ | CSP_SO_HMACREQ | CSP_SO_CRC32REQ | CSP_SO_CONN_LESS)) {
+	if (opts & ~(CSP_SO_RDPREQ | CSP_SO_XTEAREQ | CSP_SO_HMACREQ | CSP_SO_CRC32REQ | CSP_SO_CONN_LESS | CSP_SO_RDPFASTOPEN)) {
 		csp_log_error("Invalid socket option");
 		return NULL;
 	}
@@ -227,8 +235,11 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 
 #ifdef CSP_USE_RDP
 	/* Packet read could trigger ACK transmission */
-	if (conn->idin.flags & CSP_FRDP)
+	if (conn->idin.flags & CSP_FRDP) {
+		csp_conn_lock(conn, CSP_MAX_DELAY);
 		csp_rdp_check_ack(conn);
+		csp_conn_unlock(conn);
+	}
 #endif
 
 	return packet;
@@ -237,6 +248,8 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 
 int csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * ifout, uint32_t timeout) {
 
+	uint32_t start = csp_get_ms();
+
 	if (packet == NULL) {
 		csp_log_error("csp_send_direct called with NULL packet");
 		goto err;
@@ -299,7 +312,6 @@ int csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * ifout,
 			uint32_t nonce, nonce_n;
 			nonce = (uint32_t)rand();
 			nonce_n = csp_hton32(nonce);
-			memcpy(&packet->data[packet->length], &nonce_n, sizeof(nonce_n));
 
 			/* Create initialization vector */
 			uint32_t iv[2] = {nonce, 1};
@@ -311,7 +323,13 @@ int csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * ifout,
 				goto tx_err;
 			}
 
-			packet->length += sizeof(nonce_n);
+			/* Append nonce */
+			void * tail = csp_packet_put(packet, sizeof(nonce_n));
+			if (tail == NULL) {
+				csp_log_warn("No room for XTEA nonce! Discarding packet");
+				goto tx_err;
+			}
+			memcpy(tail, &nonce_n, sizeof(nonce_n));
 #else
 			csp_log_warn("Attempt to send XTEA encrypted packet, but CSP was compiled without XTEA support. Discarding packet");
 			goto tx_err;
@@ -319,18 +337,20 @@ int csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * ifout,
 		}
 	}
 
-	/* Store length before passing to interface */
-	uint16_t bytes = packet->length;
 	uint16_t mtu = ifout->mtu;
 
-	if (mtu > 0 && bytes > mtu)
+	if (mtu > 0 && packet->length > mtu) {
+#ifdef CSP_USE_FRAG
+		/* Split into fragments, reassembled by the destination */
+		if (csp_frag_send(ifout, packet, timeout) == CSP_ERR_NONE)
+			return CSP_ERR_NONE;
+#endif
 		goto tx_err;
+	}
 
-	if ((*ifout->nexthop)(ifout, packet, timeout) != CSP_ERR_NONE)
+	if (csp_send_iface(ifout, packet, timeout, start) != CSP_ERR_NONE)
 		goto tx_err;
 
-	ifout->tx++;
-	ifout->txbytes += bytes;
 	return CSP_ERR_NONE;
 
 tx_err:
@@ -340,6 +360,27 @@ err:
 
 }
 
+int csp_send_iface(csp_iface_t * ifout, csp_packet_t * packet, uint32_t timeout, uint32_t start) {
+
+	/* Store length before passing to interface */
+	uint16_t bytes = packet->length;
+
+	/* Interfaces with a TX queue are served by the queue scheduler task */
+	if (ifout->txq != NULL) {
+		if (csp_txq_push(ifout, packet, timeout) != CSP_ERR_NONE)
+			return CSP_ERR_TX;
+	} else {
+		if ((*ifout->nexthop)(ifout, packet, timeout) != CSP_ERR_NONE)
+			return CSP_ERR_TX;
+		csp_iflist_hist_add(&ifout->tx_latency, csp_get_ms() - start);
+	}
+
+	ifout->tx++;
+	ifout->txbytes += bytes;
+	return CSP_ERR_NONE;
+
+}
+
 int csp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 
 	int ret;
@@ -40,6 +40,16 @@ extern "C" {
  */
 int csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * ifout, uint32_t timeout);
 
+/**
+ * Pass a finished packet to the interface, or its TX queue, and count it
+ * @param ifout pointer to output interface
+ * @param packet pointer to packet, freed by the interface on success
+ * @param timeout a timeout to wait for TX to complete
+ * @param start time the send started, for the TX latency histogram
+ * @return CSP_ERR_NONE on success, otherwise the packet must be freed by the caller
+ */
+int csp_send_iface(csp_iface_t * ifout, csp_packet_t * packet, uint32_t timeout, uint32_t start);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
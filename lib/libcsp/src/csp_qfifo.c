@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/csp.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_time.h>
 #include "csp_qfifo.h"
 
 static csp_queue_handle_t qfifo[CSP_ROUTE_FIFOS];
@@ -50,13 +51,13 @@ int csp_qfifo_init(void) {
 
 }
 
-int csp_qfifo_read(csp_qfifo_t * input) {
+int csp_qfifo_read(csp_qfifo_t * input, uint32_t timeout) {
 
 #ifdef CSP_USE_QOS
 	int prio, found, event;
 
 	/* Wait for packet in any queue */
-	if (csp_queue_dequeue(qfifo_events, &event, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+	if (csp_queue_dequeue(qfifo_events, &event, timeout) != CSP_QUEUE_OK)
 		return CSP_ERR_TIMEDOUT;
 
 	/* Find packet with highest priority */
@@ -73,7 +74,7 @@ int csp_qfifo_read(csp_qfifo_t * input) {
 		return CSP_ERR_TIMEDOUT;
 	}
 #else
-	if (csp_queue_dequeue(qfifo[0], input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+	if (csp_queue_dequeue(qfifo[0], input, timeout) != CSP_QUEUE_OK)
 		return CSP_ERR_TIMEDOUT;
 #endif
 
@@ -100,6 +101,7 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * interface, CSP_BASE_TY
 	csp_qfifo_t queue_element;
 	queue_element.interface = interface;
 	queue_element.packet = packet;
+	queue_element.timestamp = (pxTaskWoken == NULL) ? csp_get_ms() : csp_get_ms_isr();
 
 #ifdef CSP_USE_QOS
 	int fifo = packet->id.pri;
@@ -126,6 +128,7 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * interface, CSP_BASE_TY
 	if (result != CSP_QUEUE_OK) {
 		csp_log_warn("ERROR: Routing input FIFO is FULL. Dropping packet.");
 		interface->drop++;
+		interface->drops.fifo_full++;
 		if (pxTaskWoken == NULL)
 			csp_buffer_free(packet);
 		else
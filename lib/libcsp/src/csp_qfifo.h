@@ -22,7 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define CSP_QFIFO_H_
 
 #ifdef CSP_USE_RDP
-#define FIFO_TIMEOUT 100				//! If RDP is enabled, the router needs to awake some times to check timeouts
+#define FIFO_TIMEOUT 100				//! If RDP is enabled, the router also wakes when a connection timer is due
 #else
 #define FIFO_TIMEOUT CSP_MAX_DELAY		//! If no RDP, the router can sleep untill data arrives
 #endif
@@ -36,13 +36,15 @@ int csp_qfifo_init(void);
 typedef struct {
 	csp_iface_t * interface;
 	csp_packet_t * packet;
+	uint32_t timestamp;		//! Time of reception in ms
 } csp_qfifo_t;
 
 /**
  * Read next packet from router input queue
  * @param input pointer to router queue item element
+ * @param timeout time to wait for a packet in ms
  * @return CSP_ERR type
  */
-int csp_qfifo_read(csp_qfifo_t * input);
+int csp_qfifo_read(csp_qfifo_t * input, uint32_t timeout);
 
 #endif /* CSP_QFIFO_H_ */
@@ -29,6 +29,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/arch/csp_thread.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_time.h>
 
 #include "crypto/csp_hmac.h"
 #include "crypto/csp_xtea.h"
@@ -38,9 +39,38 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "csp_io.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
+#include "csp_route.h"
 #include "csp_dedup.h"
+#include "csp_frag.h"
 #include "transport/csp_transport.h"
 
+/* Routing table change hook */
+static csp_rtable_hook_func_t csp_rtable_hook_func = NULL;
+
+void csp_rtable_hook_set(csp_rtable_hook_func_t f)
+{
+	csp_rtable_hook_func = f;
+}
+
+void csp_rtable_changed(void)
+{
+	if (csp_rtable_hook_func)
+		csp_rtable_hook_func();
+}
+
+int csp_rtable_find_mtu(uint8_t id)
+{
+	csp_iface_t * ifc = csp_rtable_find_iface(id);
+	if (ifc == NULL)
+		return 0;
+
+	int mtu = csp_buffer_size() - CSP_BUFFER_PACKET_OVERHEAD;
+	if (ifc->mtu > 0 && ifc->mtu < mtu)
+		mtu = ifc->mtu;
+
+	return mtu;
+}
+
 /**
  * Check supported packet options
  * @param interface pointer to incoming interface
@@ -75,6 +105,23 @@ static int csp_route_check_options(csp_iface_t *interface, csp_packet_t *packet)
 		return CSP_ERR_NOTSUP;
 	}
 #endif
+
+#ifndef CSP_USE_FRAG
+	/* Drop fragments */
+	if (packet->id.flags & CSP_FRFRAG) {
+		csp_log_error("Received fragment, but CSP was compiled without fragmentation support. Discarding packet");
+		interface->rx_error++;
+		return CSP_ERR_NOTSUP;
+	}
+#endif
+
+	/* Drop packets compressed by a link that this node does not decompress */
+	if (packet->id.flags & CSP_FCOMP) {
+		csp_log_error("Received compressed packet on interface without decompression. Discarding packet");
+		interface->rx_error++;
+		return CSP_ERR_NOTSUP;
+	}
+
 	return CSP_ERR_NONE;
 }
 
@@ -92,9 +139,14 @@ static int csp_route_security_check(uint32_t security_opts, csp_iface_t * interf
 	if (packet->id.flags & CSP_FXTEA) {
 		/* Read nonce */
 		uint32_t nonce;
-		memcpy(&nonce, &packet->data[packet->length - sizeof(nonce)], sizeof(nonce));
+		void * tail = csp_packet_trim(packet, sizeof(nonce));
+		if (tail == NULL) {
+			csp_log_error("XTEA packet too short! Discarding packet");
+			interface->autherr++;
+			return CSP_ERR_XTEA;
+		}
+		memcpy(&nonce, tail, sizeof(nonce));
 		nonce = csp_ntoh32(nonce);
-		packet->length -= sizeof(nonce);
 
 		/* Create initialization vector */
 		uint32_t iv[2] = {nonce, 1};
@@ -174,15 +226,37 @@ int csp_route_work(uint32_t timeout) {
 	csp_socket_t * socket;
 
 #ifdef CSP_USE_RDP
-	/* Check connection timeouts (currently only for RDP) */
+	/* Run connection timers that are due (currently only for RDP) */
 	csp_conn_check_timeouts();
+
+	/* Wake up again when the next connection timer is due */
+	timeout = csp_conn_timer_wait(timeout);
+#endif
+
+#ifdef CSP_USE_FRAG
+	/* Release incomplete packets */
+	csp_frag_check_timeouts();
 #endif
 
 	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE)
+	if (csp_qfifo_read(&input, timeout) != CSP_ERR_NONE)
 		return -1;
 
 	packet = input.packet;
+	csp_iflist_hist_add(&input.interface->dwell, csp_get_ms() - input.timestamp);
+
+	/* Pass packet up through stacked interfaces, such as link compression */
+	while (input.interface->upper != NULL) {
+		csp_iface_t * upper = input.interface->upper;
+		if (upper->upper_rx(upper, packet) != CSP_ERR_NONE) {
+			upper->rx_error++;
+			csp_buffer_free(packet);
+			return 0;
+		}
+		upper->rx++;
+		upper->rxbytes += packet->length;
+		input.interface = upper;
+	}
 
 	csp_log_packet("INP: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %"PRIu16" VIA: %s",
 			packet->id.src, packet->id.dst, packet->id.dport,
@@ -198,6 +272,7 @@ int csp_route_work(uint32_t timeout) {
 	if (csp_dedup_is_duplicate(packet)) {
 		/* Discard packet */
 		csp_log_packet("Duplicate packet discarded");
+		input.interface->drops.dedup++;
 		csp_buffer_free(packet);
 		return 0;
 	}
@@ -210,7 +285,13 @@ int csp_route_work(uint32_t timeout) {
 		csp_iface_t * dstif = csp_rtable_find_iface(packet->id.dst);
 
 		/* If the message resolves to the input interface, don't loop it back out */
-		if ((dstif == NULL) || ((dstif == input.interface) && (input.interface->split_horizon_off == 0))) {
+		if (dstif == NULL) {
+			input.interface->drops.no_route++;
+			csp_buffer_free(packet);
+			return 0;
+		}
+		if ((dstif == input.interface) && (input.interface->split_horizon_off == 0)) {
+			input.interface->drops.split_horizon++;
 			csp_buffer_free(packet);
 			return 0;
 		}
@@ -225,8 +306,18 @@ int csp_route_work(uint32_t timeout) {
 		return 0;
 	}
 
+#ifdef CSP_USE_FRAG
+	/* Collect fragments until the packet is complete */
+	if (packet->id.flags & CSP_FRFRAG) {
+		packet = csp_frag_reassemble(packet);
+		if (packet == NULL)
+			return 0;
+	}
+#endif
+
 	/* Discard packets with unsupported options */
 	if (csp_route_check_options(input.interface, packet) != CSP_ERR_NONE) {
+		input.interface->drops.security++;
 		csp_buffer_free(packet);
 		return 0;
 	}
@@ -237,9 +328,11 @@ int csp_route_work(uint32_t timeout) {
 	/* If the socket is connection-less, deliver now */
 	if (socket && (socket->opts & CSP_SO_CONN_LESS)) {
 		if (csp_route_security_check(socket->opts, input.interface, packet) < 0) {
+			input.interface->drops.security++;
 			csp_buffer_free(packet);
 			return 0;
 		}
+		csp_iflist_hist_add(&input.interface->rx_latency, csp_get_ms() - input.timestamp);
 		if (csp_queue_enqueue(socket->socket, &packet, 0) != CSP_QUEUE_OK) {
 			csp_log_error("Conn-less socket queue full");
 			csp_buffer_free(packet);
@@ -256,12 +349,14 @@ int csp_route_work(uint32_t timeout) {
 
 		/* Reject packet if no matching socket is found */
 		if (!socket) {
+			input.interface->drops.no_conn++;
 			csp_buffer_free(packet);
 			return 0;
 		}
 
 		/* Run security check on incoming packet */
 		if (csp_route_security_check(socket->opts, input.interface, packet) < 0) {
+			input.interface->drops.security++;
 			csp_buffer_free(packet);
 			return 0;
 		}
@@ -281,6 +376,7 @@ int csp_route_work(uint32_t timeout) {
 
 		if (!conn) {
 			csp_log_error("No more connections available");
+			input.interface->drops.no_conn++;
 			csp_buffer_free(packet);
 			return 0;
 		}
@@ -294,12 +390,15 @@ int csp_route_work(uint32_t timeout) {
 
 		/* Run security check on incoming packet */
 		if (csp_route_security_check(conn->opts, input.interface, packet) < 0) {
+			input.interface->drops.security++;
 			csp_buffer_free(packet);
 			return 0;
 		}
 
 	}
 
+	csp_iflist_hist_add(&input.interface->rx_latency, csp_get_ms() - input.timestamp);
+
 #ifdef CSP_USE_RDP
 	/* Pass packet to RDP module */
 	if (packet->id.flags & CSP_FRDP) {
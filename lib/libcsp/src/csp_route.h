@@ -21,4 +21,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #ifndef _CSP_ROUTE_H_
 #define _CSP_ROUTE_H_
 
+/**
+ * Notify the routing table change hook, called by the rtable implementations
+ */
+void csp_rtable_changed(void);
+
 #endif // _CSP_ROUTE_H_
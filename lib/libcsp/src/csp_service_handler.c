@@ -114,6 +114,40 @@ static int do_cmp_if_stats(struct csp_cmp_message *cmp) {
 	return CSP_ERR_NONE;
 }
 
+/* Copy histogram to message buckets followed by max, which may be unaligned */
+static void do_cmp_if_hist(void * out, csp_iface_hist_t * hist) {
+
+	uint32_t buf[CSP_IF_HIST_BUCKETS + 1];
+	int i;
+
+	for (i = 0; i < CSP_IF_HIST_BUCKETS; i++)
+		buf[i] = csp_hton32(hist->count[i]);
+	buf[CSP_IF_HIST_BUCKETS] = csp_hton32(hist->max);
+
+	memcpy(out, buf, sizeof(buf));
+
+}
+
+static int do_cmp_if_xstats(struct csp_cmp_message *cmp) {
+
+	csp_iface_t *ifc = csp_iflist_get_by_name(cmp->if_xstats.interface);
+	if (ifc == NULL)
+		return CSP_ERR_INVAL;
+
+	cmp->if_xstats.fifo_full =     csp_hton32(ifc->drops.fifo_full);
+	cmp->if_xstats.no_route =      csp_hton32(ifc->drops.no_route);
+	cmp->if_xstats.split_horizon = csp_hton32(ifc->drops.split_horizon);
+	cmp->if_xstats.dedup =         csp_hton32(ifc->drops.dedup);
+	cmp->if_xstats.security =      csp_hton32(ifc->drops.security);
+	cmp->if_xstats.no_conn =       csp_hton32(ifc->drops.no_conn);
+
+	do_cmp_if_hist(cmp->if_xstats.rx_latency, &ifc->rx_latency);
+	do_cmp_if_hist(cmp->if_xstats.dwell, &ifc->dwell);
+	do_cmp_if_hist(cmp->if_xstats.tx_latency, &ifc->tx_latency);
+
+	return CSP_ERR_NONE;
+}
+
 static int do_cmp_peek(struct csp_cmp_message *cmp) {
 
 	cmp->peek.addr = csp_hton32(cmp->peek.addr);
@@ -197,6 +231,11 @@ int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 			ret = do_cmp_clock(cmp);
 			break;
 
+		case CSP_CMP_IF_XSTATS:
+			ret = do_cmp_if_xstats(cmp);
+			packet->length = CMP_SIZE(if_xstats);
+			break;
+
 		default:
 			ret = CSP_ERR_INVAL;
 			break;
@@ -20,11 +20,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <csp/csp.h>
 #include <csp/csp_endian.h>
 #include <csp/arch/csp_malloc.h>
 #include "csp_conn.h"
 
+#if defined(CSP_POSIX) || defined(CSP_MACOSX)
+#include <unistd.h>
+#endif
+
 typedef struct __attribute__((__packed__)) {
 	uint32_t offset;
 	uint32_t totalsize;
@@ -36,21 +41,30 @@ typedef struct __attribute__((__packed__)) {
  * information that needs to be appended to all data packets.
  */
 static sfp_header_t * csp_sfp_header_add(csp_packet_t * packet) {
-	sfp_header_t * header = (sfp_header_t *) &packet->data[packet->length];
-	packet->length += sizeof(sfp_header_t);
-	memset(header, 0, sizeof(sfp_header_t));
+	sfp_header_t * header = csp_packet_put(packet, sizeof(sfp_header_t));
+	if (header != NULL)
+		memset(header, 0, sizeof(sfp_header_t));
 	return header;
 }
 
 static sfp_header_t * csp_sfp_header_remove(csp_packet_t * packet) {
-	sfp_header_t * header = (sfp_header_t *) &packet->data[packet->length-sizeof(sfp_header_t)];
-	packet->length -= sizeof(sfp_header_t);
-	return header;
+	return csp_packet_trim(packet, sizeof(sfp_header_t));
 }
 
-int csp_sfp_send_own_memcpy(csp_conn_t * conn, void * data, int totalsize, int mtu, uint32_t timeout, void * (*memcpyfcn)(void *, const void *, size_t)) {
+/* Room left below the MTU for the RDP header, CRC32, HMAC and XTEA nonce */
+#define SFP_OPTIONS_MAX	24
+
+int csp_sfp_send_stream(csp_conn_t * conn, uint32_t totalsize, int mtu, uint32_t timeout, csp_sfp_read_t readfcn, void * data) {
+
+	uint32_t count = 0;
+
+	/* Use the MTU of the route to the destination */
+	if (mtu <= 0) {
+		mtu = csp_rtable_find_mtu(conn->idout.dst) - sizeof(sfp_header_t) - SFP_OPTIONS_MAX;
+		if (mtu <= 0)
+			return -1;
+	}
 
-	int count = 0;
 	while(count < totalsize) {
 
 		/* Allocate packet */
@@ -59,15 +73,19 @@ int csp_sfp_send_own_memcpy(csp_conn_t * conn, void * data, int totalsize, int m
 			return -1;
 
 		/* Calculate sending size */
-		int size = totalsize - count;
-		if (size > mtu)
+		uint32_t size = totalsize - count;
+		if (size > (uint32_t) mtu)
 			size = mtu;
 
 		/* Print debug */
-		csp_debug(CSP_PROTOCOL, "Sending SFP at %x size %u", data + count, size);
+		csp_debug(CSP_PROTOCOL, "Sending SFP at %u size %u", count, size);
 
-		/* Copy data */
-		(*memcpyfcn)(packet->data, data + count, size);
+		/* Read data */
+		if ((*readfcn)(data, count, packet->data, size) != (int) size) {
+			csp_debug(CSP_ERROR, "SFP read at %u failed", count);
+			csp_buffer_free(packet);
+			return -1;
+		}
 		packet->length = size;
 
 		/* Set fragment flag */
@@ -75,6 +93,10 @@ int csp_sfp_send_own_memcpy(csp_conn_t * conn, void * data, int totalsize, int m
 
 		/* Add SFP header */
 		sfp_header_t * sfp_header = csp_sfp_header_add(packet);
+		if (sfp_header == NULL) {
+			csp_buffer_free(packet);
+			return -1;
+		}
 		sfp_header->totalsize = csp_hton32(totalsize);
 		sfp_header->offset = csp_hton32(count);
 
@@ -93,6 +115,24 @@ int csp_sfp_send_own_memcpy(csp_conn_t * conn, void * data, int totalsize, int m
 
 }
 
+typedef struct {
+	void * data;
+	void * (*memcpyfcn)(void *, const void *, size_t);
+} sfp_memcpy_t;
+
+static int csp_sfp_memcpy_read(void * data, uint32_t offset, void * buf, uint32_t len) {
+	sfp_memcpy_t * m = data;
+	(*m->memcpyfcn)(buf, m->data + offset, len);
+	return len;
+}
+
+int csp_sfp_send_own_memcpy(csp_conn_t * conn, void * data, int totalsize, int mtu, uint32_t timeout, void * (*memcpyfcn)(void *, const void *, size_t)) {
+	sfp_memcpy_t m = {data, memcpyfcn};
+	if (totalsize < 0)
+		return -1;
+	return csp_sfp_send_stream(conn, totalsize, mtu, timeout, csp_sfp_memcpy_read, &m);
+}
+
 int csp_sfp_send(csp_conn_t * conn, void * data, int totalsize, int mtu, uint32_t timeout) {
 	return csp_sfp_send_own_memcpy(conn, data, totalsize, mtu, timeout, &memcpy);
 }
@@ -121,6 +161,11 @@ int csp_sfp_recv_fp(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t
 
 		/* Read SFP header */
 		sfp_header_t * sfp_header = csp_sfp_header_remove(packet);
+		if (sfp_header == NULL) {
+			csp_debug(CSP_ERROR, "SFP packet too short");
+			csp_buffer_free(packet);
+			return -1;
+		}
 		sfp_header->offset = csp_ntoh32(sfp_header->offset);
 		sfp_header->totalsize = csp_ntoh32(sfp_header->totalsize);
 
@@ -165,3 +210,203 @@ int csp_sfp_recv(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t ti
 	return csp_sfp_recv_fp(conn, dataout, datasize, timeout, NULL);
 }
 
+
+/**
+ * Holes:
+ * The holes are kept sorted by offset. A hole that would not fit in the list
+ * is merged into the last one, and a hole that would have to be split is kept
+ * whole, so the list may report more than is missing but never less.
+ */
+static void csp_sfp_hole_add(csp_sfp_hole_t * holes, unsigned int * count, unsigned int max, uint32_t offset, uint32_t end) {
+	if (max == 0)
+		return;
+	if (*count < max) {
+		holes[*count].offset = offset;
+		holes[*count].length = end - offset;
+		(*count)++;
+	} else {
+		holes[*count - 1].length = end - holes[*count - 1].offset;
+	}
+}
+
+static void csp_sfp_hole_fill(csp_sfp_hole_t * holes, unsigned int * count, unsigned int max, uint32_t offset, uint32_t end) {
+	unsigned int i = 0;
+	while (i < *count) {
+		uint32_t hole_end = holes[i].offset + holes[i].length;
+		if (end <= holes[i].offset || offset >= hole_end) {
+			i++;
+		} else if (offset <= holes[i].offset && end >= hole_end) {
+			/* Hole filled */
+			memmove(&holes[i], &holes[i + 1], (*count - i - 1) * sizeof(*holes));
+			(*count)--;
+		} else if (offset <= holes[i].offset) {
+			holes[i].length = hole_end - end;
+			holes[i].offset = end;
+			i++;
+		} else if (end >= hole_end) {
+			holes[i].length = offset - holes[i].offset;
+			i++;
+		} else {
+			/* Split in two, if there is room */
+			if (*count < max) {
+				memmove(&holes[i + 2], &holes[i + 1], (*count - i - 1) * sizeof(*holes));
+				holes[i + 1].offset = end;
+				holes[i + 1].length = hole_end - end;
+				holes[i].length = offset - holes[i].offset;
+				(*count)++;
+			}
+			i += 2;
+		}
+	}
+}
+
+int csp_sfp_recv_stream(csp_conn_t * conn, csp_sfp_write_t writefcn, void * data, csp_sfp_hole_t * holes, unsigned int max_holes, uint32_t timeout, csp_packet_t * first_packet) {
+
+	uint32_t last_byte = 0, totalsize = 0;
+	unsigned int hole_count = 0;
+	int started = 0, missing = 0;
+
+	/* Get first packet from user, or from connection */
+	csp_packet_t * packet = first_packet;
+	if (packet == NULL)
+		packet = csp_read(conn, timeout);
+
+	for (; packet != NULL; packet = csp_read(conn, timeout)) {
+
+		/* Check that SFP header is present */
+		if ((packet->id.flags & CSP_FFRAG) == 0) {
+			csp_debug(CSP_ERROR, "Missing SFP header");
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		/* Read SFP header */
+		sfp_header_t * sfp_header = csp_sfp_header_remove(packet);
+		if (sfp_header == NULL) {
+			csp_debug(CSP_ERROR, "SFP packet too short");
+			csp_buffer_free(packet);
+			continue;
+		}
+		uint32_t offset = csp_ntoh32(sfp_header->offset);
+		uint32_t size = csp_ntoh32(sfp_header->totalsize);
+		uint32_t end = offset + packet->length;
+
+		if (!started) {
+			totalsize = size;
+			started = 1;
+		}
+		if (size != totalsize || end > totalsize || end < offset) {
+			csp_debug(CSP_ERROR, "SFP fragment %u+%u outside %u bytes", offset, packet->length, totalsize);
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		csp_debug(CSP_PROTOCOL, "SFP fragment %u/%u", end, totalsize);
+
+		/* Record the gap in front of this fragment, or fill an earlier one */
+		if (offset > last_byte) {
+			csp_debug(CSP_WARN, "SFP missing %u bytes at %u", offset - last_byte, last_byte);
+			csp_sfp_hole_add(holes, &hole_count, max_holes, last_byte, offset);
+			missing = 1;
+		} else if (offset < last_byte) {
+			csp_sfp_hole_fill(holes, &hole_count, max_holes, offset, end);
+		}
+		if (end > last_byte)
+			last_byte = end;
+
+		if ((*writefcn)(data, offset, packet->data, packet->length, totalsize) < 0) {
+			csp_debug(CSP_ERROR, "SFP write at %u failed", offset);
+			csp_buffer_free(packet);
+			return -1;
+		}
+		csp_buffer_free(packet);
+
+		if (last_byte >= totalsize)
+			break;
+
+	}
+
+	if (!started)
+		return -1;
+
+	/* A timeout leaves the tail missing */
+	if (last_byte < totalsize) {
+		csp_debug(CSP_WARN, "SFP timeout with %u of %u bytes", last_byte, totalsize);
+		csp_sfp_hole_add(holes, &hole_count, max_holes, last_byte, totalsize);
+		missing = 1;
+	}
+
+	/* Without a hole list, report a single hole if anything is missing */
+	if (max_holes == 0)
+		return missing;
+
+	csp_debug(CSP_PROTOCOL, "SFP complete with %u holes", hole_count);
+	return hole_count;
+
+}
+
+int csp_sfp_iov_write(void * data, uint32_t offset, const void * buf, uint32_t len, uint32_t totalsize) {
+	csp_sfp_iov_t * iov = data;
+	const uint8_t * src = buf;
+	for (; iov->base != NULL && len > 0; iov++) {
+		if (offset >= iov->len) {
+			offset -= iov->len;
+			continue;
+		}
+		uint32_t chunk = iov->len - offset < len ? iov->len - offset : len;
+		memcpy((uint8_t *) iov->base + offset, src, chunk);
+		src += chunk;
+		len -= chunk;
+		offset = 0;
+	}
+	return len == 0 ? 0 : -1;
+}
+
+int csp_sfp_iov_read(void * data, uint32_t offset, void * buf, uint32_t len) {
+	csp_sfp_iov_t * iov = data;
+	uint8_t * dst = buf;
+	uint32_t left = len;
+	for (; iov->base != NULL && left > 0; iov++) {
+		if (offset >= iov->len) {
+			offset -= iov->len;
+			continue;
+		}
+		uint32_t chunk = iov->len - offset < left ? iov->len - offset : left;
+		memcpy(dst, (uint8_t *) iov->base + offset, chunk);
+		dst += chunk;
+		left -= chunk;
+		offset = 0;
+	}
+	return left == 0 ? (int) len : -1;
+}
+
+#if defined(CSP_POSIX) || defined(CSP_MACOSX)
+
+int csp_sfp_fd_write(void * data, uint32_t offset, const void * buf, uint32_t len, uint32_t totalsize) {
+	int fd = *(int *) data;
+	while (len > 0) {
+		ssize_t written = pwrite(fd, buf, len, offset);
+		if (written <= 0)
+			return -1;
+		buf = (const uint8_t *) buf + written;
+		offset += written;
+		len -= written;
+	}
+	return 0;
+}
+
+int csp_sfp_fd_read(void * data, uint32_t offset, void * buf, uint32_t len) {
+	int fd = *(int *) data;
+	uint32_t left = len;
+	while (left > 0) {
+		ssize_t bytes = pread(fd, buf, left, offset);
+		if (bytes <= 0)
+			return -1;
+		buf = (uint8_t *) buf + bytes;
+		offset += bytes;
+		left -= bytes;
+	}
+	return len;
+}
+
+#endif
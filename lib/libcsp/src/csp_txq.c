@@ -0,0 +1,228 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/csp_interface.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_malloc.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_txq.h"
+
+/* Queued packet */
+typedef struct {
+	csp_packet_t * packet;
+	uint32_t timeout;
+	uint32_t queued;	/* Timestamp in ms when queued */
+} csp_txq_element_t;
+
+/* TX queue state, stored in csp_iface_t.txq */
+typedef struct {
+	csp_iface_t * ifc;
+	csp_queue_handle_t queue[CSP_PRIORITIES];
+	csp_queue_handle_t events;	/* One event per queued packet, like the QoS router fifo */
+	uint32_t bitrate;		/* Rate limit in bits/s, 0 for none */
+	uint64_t burst;			/* Bucket size in millibits */
+	int64_t tokens;			/* Bucket level in millibits, negative after oversized packets */
+	uint32_t last_refill;
+	csp_bin_sem_handle_t lock;	/* Protects stats, updated by senders and the TX task */
+	csp_txq_stats_t stats;
+	uint64_t wait_total;
+	csp_thread_handle_t handle;
+} csp_txq_t;
+
+static void csp_txq_refill(csp_txq_t * txq) {
+
+	uint32_t now = csp_get_ms();
+
+	/* bits/s times ms gives millibits */
+	txq->tokens += (int64_t) (now - txq->last_refill) * txq->bitrate;
+	if (txq->tokens > (int64_t) txq->burst)
+		txq->tokens = txq->burst;
+	txq->last_refill = now;
+
+}
+
+/* Wait until the token bucket allows sending bytes */
+static void csp_txq_shape(csp_txq_t * txq, uint32_t bytes) {
+
+	if (txq->bitrate == 0)
+		return;
+
+	/* Packets larger than the burst are sent when the bucket is full */
+	int64_t cost = (int64_t) bytes * 8 * 1000;
+	int64_t need = (cost > (int64_t) txq->burst) ? (int64_t) txq->burst : cost;
+
+	csp_txq_refill(txq);
+	while (txq->tokens < need) {
+		csp_sleep_ms((need - txq->tokens + txq->bitrate - 1) / txq->bitrate);
+		csp_txq_refill(txq);
+	}
+
+	txq->tokens -= cost;
+
+}
+
+static CSP_DEFINE_TASK(csp_txq_task) {
+
+	csp_txq_t * txq = param;
+	csp_txq_element_t element;
+	int prio, event, found;
+
+	while (1) {
+		if (csp_queue_dequeue(txq->events, &event, CSP_MAX_DELAY) != CSP_QUEUE_OK)
+			continue;
+
+		/* Highest priority first */
+		found = 0;
+		for (prio = 0; prio < CSP_PRIORITIES; prio++) {
+			if (csp_queue_dequeue(txq->queue[prio], &element, 0) == CSP_QUEUE_OK) {
+				found = 1;
+				break;
+			}
+		}
+
+		if (!found)
+			continue;
+
+		csp_txq_shape(txq, element.packet->length + sizeof(csp_id_t));
+
+		uint32_t wait = csp_get_ms() - element.queued;
+		csp_bin_sem_wait(&txq->lock, CSP_MAX_DELAY);
+		if (wait > txq->stats.wait_max)
+			txq->stats.wait_max = wait;
+		txq->wait_total += wait;
+		txq->stats.depth--;
+		txq->stats.sent++;
+		txq->stats.wait_avg = txq->wait_total / txq->stats.sent;
+		csp_bin_sem_post(&txq->lock);
+
+		if ((*txq->ifc->nexthop)(txq->ifc, element.packet, element.timeout) != CSP_ERR_NONE) {
+			txq->ifc->tx_error++;
+			csp_buffer_free(element.packet);
+		} else {
+			csp_iflist_hist_add(&txq->ifc->tx_latency, csp_get_ms() - element.queued);
+		}
+	}
+
+	return CSP_TASK_RETURN;
+
+}
+
+int csp_txq_push(csp_iface_t * ifc, csp_packet_t * packet, uint32_t timeout) {
+
+	csp_txq_t * txq = ifc->txq;
+	csp_txq_element_t element;
+	int event = 0;
+
+	element.packet = packet;
+	element.timeout = timeout;
+	element.queued = csp_get_ms();
+
+	if (csp_queue_enqueue(txq->queue[packet->id.pri], &element, timeout) != CSP_QUEUE_OK) {
+		csp_bin_sem_wait(&txq->lock, CSP_MAX_DELAY);
+		txq->stats.drops++;
+		csp_bin_sem_post(&txq->lock);
+		return CSP_ERR_NOBUFS;
+	}
+
+	/* Counted before the event, so the TX task never sees a negative depth */
+	csp_bin_sem_wait(&txq->lock, CSP_MAX_DELAY);
+	if (++txq->stats.depth > txq->stats.depth_max)
+		txq->stats.depth_max = txq->stats.depth;
+	csp_bin_sem_post(&txq->lock);
+
+	csp_queue_enqueue(txq->events, &event, CSP_MAX_DELAY);
+
+	return CSP_ERR_NONE;
+
+}
+
+int csp_txq_enable(csp_iface_t * ifc, unsigned int length, uint32_t bitrate, uint32_t burst) {
+
+	csp_txq_t * txq;
+	int prio;
+
+	if (ifc->txq != NULL)
+		return CSP_ERR_USED;
+
+	txq = csp_malloc(sizeof(*txq));
+	if (txq == NULL)
+		return CSP_ERR_NOMEM;
+	memset(txq, 0, sizeof(*txq));
+
+	if (csp_bin_sem_create(&txq->lock) != CSP_SEMAPHORE_OK) {
+		csp_free(txq);
+		return CSP_ERR_NOMEM;
+	}
+
+	for (prio = 0; prio < CSP_PRIORITIES; prio++) {
+		txq->queue[prio] = csp_queue_create(length, sizeof(csp_txq_element_t));
+		if (txq->queue[prio] == NULL)
+			goto err;
+	}
+
+	txq->events = csp_queue_create(length * CSP_PRIORITIES, sizeof(int));
+	if (txq->events == NULL)
+		goto err;
+
+	txq->ifc = ifc;
+	txq->bitrate = bitrate;
+	txq->burst = (uint64_t) burst * 8 * 1000;
+	txq->tokens = txq->burst;
+	txq->last_refill = csp_get_ms();
+
+	if (csp_thread_create(csp_txq_task, "TXQ", 1000, txq, 0, &txq->handle) != 0)
+		goto err;
+
+	ifc->txq = txq;
+
+	return CSP_ERR_NONE;
+
+err:
+	if (txq->events)
+		csp_queue_remove(txq->events);
+	for (prio = 0; prio < CSP_PRIORITIES; prio++)
+		if (txq->queue[prio])
+			csp_queue_remove(txq->queue[prio]);
+	csp_bin_sem_remove(&txq->lock);
+	csp_free(txq);
+	return CSP_ERR_NOMEM;
+
+}
+
+int csp_txq_get_stats(csp_iface_t * ifc, csp_txq_stats_t * stats) {
+
+	csp_txq_t * txq = ifc->txq;
+
+	if (txq == NULL)
+		return CSP_ERR_INVAL;
+
+	csp_bin_sem_wait(&txq->lock, CSP_MAX_DELAY);
+	*stats = txq->stats;
+	csp_bin_sem_post(&txq->lock);
+
+	return CSP_ERR_NONE;
+
+}
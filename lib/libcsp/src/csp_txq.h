@@ -0,0 +1,35 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_TXQ_H_
+#define CSP_TXQ_H_
+
+#include <csp/csp.h>
+
+/**
+ * Queue packet for transmission by the interface scheduler task
+ * @param ifc Interface with TX queue enabled
+ * @param packet Packet to send, freed by the scheduler
+ * @param timeout Time to wait for room in the queue, also passed to nexthop
+ * @return CSP_ERR_NONE if queued, otherwise the packet is still owned by the caller
+ */
+int csp_txq_push(csp_iface_t * ifc, csp_packet_t * packet, uint32_t timeout);
+
+#endif /* CSP_TXQ_H_ */
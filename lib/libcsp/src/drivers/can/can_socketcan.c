@@ -20,6 +20,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 /* SocketCAN driver */
 
+/* Required for recvmmsg and sendmmsg */
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <stdio.h>
 
@@ -33,6 +36,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <poll.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -45,6 +49,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/error.h>
 #include <linux/socket.h>
 #include <bits/socket.h>
 
@@ -56,73 +61,356 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <libsocketcan.h>
 #endif
 
+/* Number of frames read or written per syscall */
+#define SOCKETCAN_BATCH		32
+
+/* Frame type matching can_frame_t */
+#ifdef CSP_USE_CAN_FD
+typedef struct canfd_frame socketcan_frame_t;
+#else
+typedef struct can_frame socketcan_frame_t;
+#endif
+
+/* Number of frames in TX queue for each CSP priority */
+#define SOCKETCAN_TXQ_LEN	256
+
+/* Time to wait for the socket to become writable in ms */
+#define SOCKETCAN_POLL_MS	100
+
+/* TX frame ring for one priority */
+typedef struct {
+	socketcan_frame_t frames[SOCKETCAN_TXQ_LEN];
+	uint8_t first[SOCKETCAN_TXQ_LEN];	/* Frame starts a CSP packet */
+	unsigned int head;
+	unsigned int count;
+} socketcan_txq_t;
+
 static int can_socket; /** SocketCAN socket handle */
 
+/* TX queues are drained by the writer thread, highest priority first */
+static socketcan_txq_t can_txq[CSP_PRIORITIES];
+static pthread_mutex_t can_txq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t can_txq_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t can_txq_space = PTHREAD_COND_INITIALIZER;
+static can_tx_stats_t can_tx_stats;
+
+/* Translate a SocketCAN error frame to CAN_EVENT flags */
+static void socketcan_rx_error(socketcan_frame_t *frame)
+{
+	uint32_t events = 0;
+	uint8_t tx_errors = 0, rx_errors = 0;
+	canid_t err = frame->can_id & CAN_ERR_MASK;
+
+	if (err & CAN_ERR_LOSTARB)
+		events |= CAN_EVENT_ARBITRATION;
+	if (err & CAN_ERR_CRTL) {
+		if (frame->data[1] & (CAN_ERR_CRTL_RX_OVERFLOW | CAN_ERR_CRTL_TX_OVERFLOW))
+			events |= CAN_EVENT_OVERFLOW;
+		if (frame->data[1] & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING))
+			events |= CAN_EVENT_WARNING;
+		if (frame->data[1] & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE))
+			events |= CAN_EVENT_PASSIVE;
+#ifdef CAN_ERR_CRTL_ACTIVE
+		if (frame->data[1] & CAN_ERR_CRTL_ACTIVE)
+			events |= CAN_EVENT_ACTIVE;
+#endif
+	}
+	if (err & (CAN_ERR_PROT | CAN_ERR_TRX | CAN_ERR_BUSERROR))
+		events |= CAN_EVENT_PROTOCOL;
+	if (err & CAN_ERR_ACK)
+		events |= CAN_EVENT_NO_ACK;
+	if (err & CAN_ERR_BUSOFF)
+		events |= CAN_EVENT_BUS_OFF;
+	if (err & CAN_ERR_RESTARTED)
+		events |= CAN_EVENT_RESTARTED;
+#ifdef CAN_ERR_CNT
+	if (err & CAN_ERR_CNT) {
+		events |= CAN_EVENT_COUNTERS;
+		tx_errors = frame->data[6];
+		rx_errors = frame->data[7];
+	}
+#endif
+
+	csp_can_rx_error(events, tx_errors, rx_errors);
+}
+
 static void * socketcan_rx_thread(void * parameters)
 {
-	struct can_frame frame;
-	int nbytes;
+	socketcan_frame_t frames[SOCKETCAN_BATCH];
+	struct iovec iov[SOCKETCAN_BATCH];
+	struct mmsghdr msgs[SOCKETCAN_BATCH];
+	int i, count;
+
+	/* Setup one message per frame */
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < SOCKETCAN_BATCH; i++) {
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = sizeof(frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
 	while (1) {
-		/* Read CAN frame */
-		nbytes = read(can_socket, &frame, sizeof(frame));
-		if (nbytes < 0) {
-			csp_log_error("read: %s", strerror(errno));
+		/* Read available CAN frames, blocking until the first arrives */
+		count = recvmmsg(can_socket, msgs, SOCKETCAN_BATCH, MSG_WAITFORONE, NULL);
+		if (count < 0) {
+			if (errno != EINTR)
+				csp_log_error("recvmmsg: %s", strerror(errno));
 			continue;
 		}
 
-		if (nbytes != sizeof(frame)) {
-			csp_log_warn("Read incomplete CAN frame");
-			continue;
+		for (i = 0; i < count; i++) {
+			socketcan_frame_t *frame = &frames[i];
+
+			if (msgs[i].msg_len != CAN_MTU && msgs[i].msg_len != sizeof(*frame)) {
+				csp_log_warn("Read incomplete CAN frame");
+				continue;
+			}
+
+			/* Error frames are counted by the interface */
+			if (frame->can_id & CAN_ERR_FLAG) {
+				socketcan_rx_error(frame);
+				continue;
+			}
+
+			/* Frame type */
+			if (frame->can_id & CAN_RTR_FLAG || !(frame->can_id & CAN_EFF_FLAG)) {
+				/* Drop remote and standard frames */
+				csp_log_warn("Discarding RTR/SFF frame");
+				continue;
+			}
+
+			/* Strip flags */
+			frame->can_id &= CAN_EFF_MASK;
+
+			/* Call RX callback */
+			csp_can_rx_frame((can_frame_t *)frame, NULL);
 		}
+	}
 
-		/* Frame type */
-		if (frame.can_id & (CAN_ERR_FLAG | CAN_RTR_FLAG) || !(frame.can_id & CAN_EFF_FLAG)) {
-			/* Drop error and remote frames */
-			csp_log_warn("Discarding ERR/RTR/SFF frame");
-			continue;
+	/* We should never reach this point */
+	pthread_exit(NULL);
+}
+
+#ifdef CSP_USE_CAN_FD
+/* Round data length up to a valid CAN FD length */
+static uint8_t socketcan_fd_len(uint8_t dlc)
+{
+	static const uint8_t lengths[] = {12, 16, 20, 24, 32, 48, 64};
+	unsigned int i;
+
+	if (dlc <= 8)
+		return dlc;
+
+	for (i = 0; i < sizeof(lengths) - 1; i++)
+		if (dlc <= lengths[i])
+			break;
+
+	return lengths[i];
+}
+#endif
+
+static uint32_t socketcan_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void * socketcan_tx_thread(void * parameters)
+{
+	struct iovec iov[SOCKETCAN_BATCH];
+	struct mmsghdr msgs[SOCKETCAN_BATCH];
+	struct pollfd pfd = {.fd = can_socket, .events = POLLOUT};
+	socketcan_txq_t *q;
+	uint32_t start, blocked;
+	int i, prio, batch, sent, err, failed;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < SOCKETCAN_BATCH; i++) {
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (1) {
+		/* Wait for frames and pick the highest priority queue */
+		pthread_mutex_lock(&can_txq_lock);
+		while (can_tx_stats.depth == 0)
+			pthread_cond_wait(&can_txq_ready, &can_txq_lock);
+		for (prio = 0; prio < CSP_PRIORITIES - 1; prio++)
+			if (can_txq[prio].count > 0)
+				break;
+		q = &can_txq[prio];
+
+		/* Frames are only appended by senders, so the head can be sent unlocked */
+		batch = q->count;
+		if (batch > SOCKETCAN_TXQ_LEN - q->head)
+			batch = SOCKETCAN_TXQ_LEN - q->head;
+		if (batch > SOCKETCAN_BATCH)
+			batch = SOCKETCAN_BATCH;
+		pthread_mutex_unlock(&can_txq_lock);
+
+		for (i = 0; i < batch; i++) {
+			socketcan_frame_t *frame = &q->frames[q->head + i];
+			iov[i].iov_base = frame;
+#ifdef CSP_USE_CAN_FD
+			iov[i].iov_len = (frame->len > 8) ? CANFD_MTU : CAN_MTU;
+#else
+			iov[i].iov_len = CAN_MTU;
+#endif
 		}
 
-		/* Strip flags */
-		frame.can_id &= CAN_EFF_MASK;
+		failed = 0;
+		sent = sendmmsg(can_socket, msgs, batch, MSG_DONTWAIT);
+		if (sent <= 0) {
+			err = (sent == 0) ? EAGAIN : errno;
+			if (err == EAGAIN || err == ENOBUFS || err == EINTR) {
+				/* Bus is busy, wait for room in the kernel queue */
+				start = socketcan_ms();
+				if (err == ENOBUFS) {
+					/* A full device queue is not reported by poll */
+					poll(NULL, 0, 1);
+				} else {
+					poll(&pfd, 1, SOCKETCAN_POLL_MS);
+				}
+				blocked = socketcan_ms() - start;
+				pthread_mutex_lock(&can_txq_lock);
+				can_tx_stats.blocked_ms += blocked;
+				pthread_mutex_unlock(&can_txq_lock);
+				continue;
+			}
+
+			/* Drop frames that can not be sent, tx_error counts packets */
+			csp_log_error("sendmmsg: %s", strerror(err));
+			failed = batch;
+			for (i = 0; i < batch; i++)
+				if (q->first[q->head + i])
+					__atomic_fetch_add(&csp_if_can.tx_error, 1, __ATOMIC_RELAXED);
+			sent = batch;
+		}
 
-		/* Call RX callback */
-		csp_can_rx_frame((can_frame_t *)&frame, NULL);
+		/* Release sent frames, stats are only changed under the lock */
+		pthread_mutex_lock(&can_txq_lock);
+		can_tx_stats.errors += failed;
+		q->head = (q->head + sent) % SOCKETCAN_TXQ_LEN;
+		q->count -= sent;
+		can_tx_stats.depth -= sent;
+		pthread_cond_broadcast(&can_txq_space);
+		pthread_mutex_unlock(&can_txq_lock);
 	}
 
 	/* We should never reach this point */
 	pthread_exit(NULL);
 }
 
-int can_send(can_id_t id, uint8_t data[], uint8_t dlc)
+int can_send_frames(can_frame_t *frames, int count, uint8_t prio, uint32_t timeout)
 {
-	struct can_frame frame;
-	int i, tries = 0;
+	socketcan_txq_t *q;
+	struct timespec ts;
+	socketcan_frame_t *out;
+	int i, ret = 0;
 
-	if (dlc > 8)
+	if (count > SOCKETCAN_TXQ_LEN)
 		return -1;
 
-	/* Copy identifier */
-	frame.can_id = id | CAN_EFF_FLAG;
+	for (i = 0; i < count; i++)
+		if (frames[i].dlc > CAN_FRAME_MAX_DLEN)
+			return -1;
 
-	/* Copy data to frame */
-	for (i = 0; i < dlc; i++)
-		frame.data[i] = data[i];
+	if (prio >= CSP_PRIORITIES)
+		prio = CSP_PRIORITIES - 1;
+	q = &can_txq[prio];
+
+	/* Absolute deadline for waiting on queue space */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (timeout % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
 
-	/* Set DLC */
-	frame.can_dlc = dlc;
+	pthread_mutex_lock(&can_txq_lock);
 
-	/* Send frame */
-	while (write(can_socket, &frame, sizeof(frame)) != sizeof(frame)) {
-		if (++tries < 1000 && errno == ENOBUFS) {
-			/* Wait 10 ms and try again */
-			usleep(10000);
-		} else {
-			csp_log_error("write: %s", strerror(errno));
-			break;
+	/* Wait for room for the whole packet */
+	while (SOCKETCAN_TXQ_LEN - q->count < (unsigned int) count) {
+		if (timeout == 0 || pthread_cond_timedwait(&can_txq_space, &can_txq_lock, &ts) != 0) {
+			can_tx_stats.drops++;
+			ret = -1;
+			goto out;
 		}
 	}
 
+	/* Append frames */
+	for (i = 0; i < count; i++) {
+		q->first[(q->head + q->count) % SOCKETCAN_TXQ_LEN] = (i == 0);
+		out = &q->frames[(q->head + q->count) % SOCKETCAN_TXQ_LEN];
+		memset(out, 0, sizeof(*out));
+		out->can_id = frames[i].id | CAN_EFF_FLAG;
+		memcpy(out->data, frames[i].data, frames[i].dlc);
+#ifdef CSP_USE_CAN_FD
+		out->len = socketcan_fd_len(frames[i].dlc);
+#else
+		out->can_dlc = frames[i].dlc;
+#endif
+		q->count++;
+	}
+
+	can_tx_stats.depth += count;
+	if (can_tx_stats.depth > can_tx_stats.depth_max)
+		can_tx_stats.depth_max = can_tx_stats.depth;
+
+	pthread_cond_signal(&can_txq_ready);
+
+out:
+	pthread_mutex_unlock(&can_txq_lock);
+	return ret;
+}
+
+void can_get_tx_stats(can_tx_stats_t *stats)
+{
+	pthread_mutex_lock(&can_txq_lock);
+	*stats = can_tx_stats;
+	pthread_mutex_unlock(&can_txq_lock);
+}
+
+int can_send(can_id_t id, uint8_t data[], uint8_t dlc)
+{
+	can_frame_t frame;
+
+	if (dlc > CAN_FRAME_MAX_DLEN)
+		return -1;
+
+	frame.id = id;
+	frame.dlc = dlc;
+	memcpy(frame.data, data, dlc);
+
+	return can_send_frames(&frame, 1, CSP_PRIO_NORM, 0);
+}
+
+int can_set_filters(can_filter_t *filters, int count)
+{
+	struct can_filter kfilters[count > 0 ? count : 1];
+	int i;
+
+	/* Match extended data frames only */
+	for (i = 0; i < count; i++) {
+		kfilters[i].can_id = (filters[i].id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		kfilters[i].can_mask = (filters[i].mask & CAN_EFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	}
+
+	/* Receive all frames */
+	if (filters == NULL || count == 0) {
+		kfilters[0].can_id = 0;
+		kfilters[0].can_mask = 0;
+		count = 1;
+	}
+
+	if (setsockopt(can_socket, SOL_CAN_RAW, CAN_RAW_FILTER, kfilters, count * sizeof(kfilters[0])) < 0) {
+		csp_log_error("setsockopt: %s", strerror(errno));
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -130,7 +418,7 @@ int can_init(uint32_t id, uint32_t mask, struct csp_can_config *conf)
 {
 	struct ifreq ifr;
 	struct sockaddr_can addr;
-	pthread_t rx_thread;
+	pthread_t rx_thread, tx_thread;
 
 	csp_assert(conf && conf->ifc);
 
@@ -164,6 +452,24 @@ int can_init(uint32_t id, uint32_t mask, struct csp_can_config *conf)
 		return -1;
 	}
 
+#ifdef CSP_USE_CAN_FD
+	/* Enable CAN FD frames */
+	if (conf->fd) {
+		int enable = 1;
+		if (setsockopt(can_socket, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0) {
+			csp_log_error("setsockopt: %s", strerror(errno));
+			return -1;
+		}
+	}
+#endif
+
+	/* Receive error frames for bus monitoring */
+	can_err_mask_t err_mask = CAN_ERR_MASK;
+	if (setsockopt(can_socket, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask)) < 0) {
+		csp_log_error("setsockopt: %s", strerror(errno));
+		return -1;
+	}
+
 	/* Set promiscuous mode */
 	if (mask) {
 		struct can_filter filter;
@@ -175,6 +481,12 @@ int can_init(uint32_t id, uint32_t mask, struct csp_can_config *conf)
 		}
 	}
 
+	/* Create transmit thread */
+	if (pthread_create(&tx_thread, NULL, socketcan_tx_thread, NULL) != 0) {
+		csp_log_error("pthread_create: %s", strerror(errno));
+		return -1;
+	}
+
 	/* Create receive thread */
 	if (pthread_create(&rx_thread, NULL, socketcan_rx_thread, NULL) != 0) {
 		csp_log_error("pthread_create: %s", strerror(errno));
@@ -37,6 +37,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  * decremented by one for each fragment sent. The identifier field serves the
  * same purpose as in the Internet Protocol, and should be an auto incrementing
  * integer to uniquely separate sessions.
+ *
+ * In CAN FD mode, the same header is used with frames of up to 64 bytes, so
+ * a full CSP packet fits in five frames. The receiver does not need to know
+ * the mode, since fragments are tracked by the remain field and data length.
+ * The last frame may be padded to a valid CAN FD length, and the padding is
+ * discarded by the receiver.
  */
 
 #include <stdint.h>
@@ -49,6 +55,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp_interface.h>
 #include <csp/csp_endian.h>
 #include <csp/interfaces/csp_if_can.h>
+#include <csp/interfaces/csp_if_lo.h>
 
 #include <csp/arch/csp_semaphore.h>
 #include <csp/arch/csp_time.h>
@@ -87,15 +94,30 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 /* Maximum Transmission Unit for CSP over CAN */
 #define CSP_CAN_MTU		256
 
+/* CFP header size in BEGIN frame */
+#define CFP_OVERHEAD		(sizeof(csp_id_t) + sizeof(uint16_t))
+
+/* Maximum number of frames in a CFP packet */
+#define CFP_FRAMES_MAX		((CSP_CAN_MTU + CFP_OVERHEAD + 7) / 8)
+
 /* Maximum number of frames in RX queue */
 #define CSP_CAN_RX_QUEUE_SIZE	100
 
 /* Number of packet buffer elements */
-#define PBUF_ELEMENTS		CSP_CONN_MAX
+#define PBUF_ELEMENTS		CSP_CAN_PBUF_COUNT
+
+/* Number of hash buckets for packet buffer lookup */
+#define PBUF_HASH_SIZE		(2 * PBUF_ELEMENTS)
 
 /* Buffer element timeout in ms */
 #define PBUF_TIMEOUT_MS		10000
 
+/* Window for rate and bus load estimates in ms */
+#define CAN_STATS_WINDOW_MS	1000
+
+/* Bits in an extended data frame besides the data field, excluding stuff bits */
+#define CAN_FRAME_BITS		67
+
 /* CFP Frame Types */
 enum cfp_frame_t {
 	CFP_BEGIN = 0,
@@ -114,6 +136,24 @@ static csp_thread_handle_t csp_can_rx_task_h;
 /* RX frame queue */
 static csp_queue_handle_t csp_can_rx_queue;
 
+/* Data bytes per transmitted frame, 8 for classic CAN or 64 for CAN FD */
+static uint8_t csp_can_frame_size = 8;
+
+/* Interface mode, CSP_CAN_MASKED or CSP_CAN_PROMISC */
+static uint8_t csp_can_mode;
+
+/* Interface statistics, rates are updated by the RX task. Counters are also
+ * updated by senders and the driver, so they are only changed atomically */
+static csp_can_stats_t csp_can_stats;
+
+#define CAN_STATS_ADD(counter, n)	__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+/* Counters for the current statistics window */
+static uint32_t csp_can_window_start;
+static uint32_t csp_can_window_bits;
+static uint32_t csp_can_window_frames[CSP_ID_HOST_MAX + 1];
+static uint32_t csp_can_window_bytes[CSP_ID_HOST_MAX + 1];
+
 /* Identification number */
 static int csp_can_id_init(void)
 {
@@ -146,47 +186,132 @@ typedef enum {
 	BUF_USED = 1,			/* Buffer element used */
 } csp_can_pbuf_state_t;
 
-typedef struct {
+typedef struct csp_can_pbuf_element_s {
 	uint16_t rx_count;		/* Received bytes */
 	uint32_t remain;		/* Remaining packets */
 	uint32_t cfpid;			/* Connection CFP identification number */
 	csp_packet_t *packet;		/* Pointer to packet buffer */
 	csp_can_pbuf_state_t state;	/* Element state */
 	uint32_t last_used;		/* Timestamp in ms for last use of buffer */
+	uint32_t started;		/* Timestamp in ms of BEGIN frame */
+	struct csp_can_pbuf_element_s *next;	/* Next element in hash bucket or free list */
+	struct csp_can_pbuf_element_s *older;	/* Previous element in timer list */
+	struct csp_can_pbuf_element_s *newer;	/* Next element in timer list */
 } csp_can_pbuf_element_t;
 
 static csp_can_pbuf_element_t csp_can_pbuf[PBUF_ELEMENTS];
 
+/* Used elements are hashed by the CFP_ID_CONN_MASK fields */
+static csp_can_pbuf_element_t *csp_can_pbuf_hash[PBUF_HASH_SIZE];
+
+/* Free elements */
+static csp_can_pbuf_element_t *csp_can_pbuf_free_list;
+
+/* Used elements ordered by last use, oldest first */
+static csp_can_pbuf_element_t *csp_can_pbuf_oldest;
+static csp_can_pbuf_element_t *csp_can_pbuf_newest;
+
+/* Reassembly statistics */
+static csp_can_pbuf_stats_t csp_can_pbuf_stats;
+
 static int csp_can_pbuf_init(void)
 {
 	/* Initialize packet buffers */
 	int i;
 	csp_can_pbuf_element_t *buf;
 
-	for (i = 0; i < PBUF_ELEMENTS; i++) {
+	csp_can_pbuf_free_list = NULL;
+	csp_can_pbuf_oldest = NULL;
+	csp_can_pbuf_newest = NULL;
+
+	for (i = 0; i < PBUF_HASH_SIZE; i++)
+		csp_can_pbuf_hash[i] = NULL;
+
+	for (i = PBUF_ELEMENTS - 1; i >= 0; i--) {
 		buf = &csp_can_pbuf[i];
 		buf->rx_count = 0;
 		buf->cfpid = 0;
 		buf->packet = NULL;
 		buf->state = BUF_FREE;
 		buf->last_used = 0;
+		buf->started = 0;
 		buf->remain = 0;
+		buf->older = NULL;
+		buf->newer = NULL;
+		buf->next = csp_can_pbuf_free_list;
+		csp_can_pbuf_free_list = buf;
 	}
 
+	memset(&csp_can_pbuf_stats, 0, sizeof(csp_can_pbuf_stats));
+
 	return CSP_ERR_NONE;
 }
 
+static csp_can_pbuf_element_t **csp_can_pbuf_bucket(uint32_t id)
+{
+	uint32_t key = id & CFP_ID_CONN_MASK;
+	return &csp_can_pbuf_hash[(key ^ (key >> CFP_ID_SIZE)) % PBUF_HASH_SIZE];
+}
+
+static void csp_can_pbuf_unlink(csp_can_pbuf_element_t *buf)
+{
+	/* Remove from timer list */
+	if (buf->older)
+		buf->older->newer = buf->newer;
+	else
+		csp_can_pbuf_oldest = buf->newer;
+
+	if (buf->newer)
+		buf->newer->older = buf->older;
+	else
+		csp_can_pbuf_newest = buf->older;
+
+	buf->older = NULL;
+	buf->newer = NULL;
+}
+
+static void csp_can_pbuf_append(csp_can_pbuf_element_t *buf)
+{
+	/* Insert at the end of the timer list */
+	buf->older = csp_can_pbuf_newest;
+	buf->newer = NULL;
+	if (csp_can_pbuf_newest)
+		csp_can_pbuf_newest->newer = buf;
+	else
+		csp_can_pbuf_oldest = buf;
+	csp_can_pbuf_newest = buf;
+}
+
 static void csp_can_pbuf_timestamp(csp_can_pbuf_element_t *buf)
 {
 	buf->last_used = csp_get_ms();
+
+	/* Move to the end of the timer list */
+	if (buf != csp_can_pbuf_newest) {
+		csp_can_pbuf_unlink(buf);
+		csp_can_pbuf_append(buf);
+	}
 }
 
 static int csp_can_pbuf_free(csp_can_pbuf_element_t *buf)
 {
+	csp_can_pbuf_element_t **bucket;
+
 	/* Free CSP packet */
 	if (buf->packet != NULL)
 		csp_buffer_free(buf->packet);
 
+	/* Remove from hash bucket */
+	for (bucket = csp_can_pbuf_bucket(buf->cfpid); *bucket != NULL; bucket = &(*bucket)->next) {
+		if (*bucket == buf) {
+			*bucket = buf->next;
+			break;
+		}
+	}
+
+	csp_can_pbuf_unlink(buf);
+	csp_can_pbuf_stats.in_use--;
+
 	/* Mark buffer element free */
 	buf->packet = NULL;
 	buf->state = BUF_FREE;
@@ -194,79 +319,178 @@ static int csp_can_pbuf_free(csp_can_pbuf_element_t *buf)
 	buf->cfpid = 0;
 	buf->last_used = 0;
 	buf->remain = 0;
+	buf->next = csp_can_pbuf_free_list;
+	csp_can_pbuf_free_list = buf;
 
 	return CSP_ERR_NONE;
 }
 
 static csp_can_pbuf_element_t *csp_can_pbuf_new(uint32_t id)
 {
-	int i;
-	csp_can_pbuf_element_t *buf, *ret = NULL;
+	csp_can_pbuf_element_t *buf, **bucket;
+
+	/* Evict the least recently used element if all are in use */
+	if (csp_can_pbuf_free_list == NULL) {
+		if (csp_can_pbuf_oldest == NULL)
+			return NULL;
+		csp_log_warn("CAN buffer element evicted");
+		csp_can_pbuf_stats.evictions++;
+		csp_can_pbuf_free(csp_can_pbuf_oldest);
+	}
 
-	for (i = 0; i < PBUF_ELEMENTS; i++) {
-		buf = &csp_can_pbuf[i];
-		if (buf->state == BUF_FREE) {
-			buf->state = BUF_USED;
-			buf->cfpid = id;
-			buf->remain = 0;
+	buf = csp_can_pbuf_free_list;
+	csp_can_pbuf_free_list = buf->next;
+
+	buf->state = BUF_USED;
+	buf->cfpid = id;
+	buf->remain = 0;
+
+	bucket = csp_can_pbuf_bucket(id);
+	buf->next = *bucket;
+	*bucket = buf;
+
+	buf->last_used = csp_get_ms();
+	csp_can_pbuf_append(buf);
+	csp_can_pbuf_stats.in_use++;
+
+	return buf;
+}
+
+static csp_can_pbuf_element_t *csp_can_pbuf_find(uint32_t id)
+{
+	csp_can_pbuf_element_t *buf;
+
+	for (buf = *csp_can_pbuf_bucket(id); buf != NULL; buf = buf->next) {
+		if ((buf->cfpid & CFP_ID_CONN_MASK) == (id & CFP_ID_CONN_MASK)) {
 			csp_can_pbuf_timestamp(buf);
-			ret = buf;
 			break;
 		}
 	}
 
-	return ret;
+	return buf;
 }
 
-static csp_can_pbuf_element_t *csp_can_pbuf_find(uint32_t id, uint32_t mask)
+static void csp_can_pbuf_cleanup(void)
 {
-	int i;
-	csp_can_pbuf_element_t *buf, *ret = NULL;
+	uint32_t now = csp_get_ms();
+
+	/* Elements are ordered by last use, so stop at the first one not timed out */
+	while (csp_can_pbuf_oldest != NULL && now - csp_can_pbuf_oldest->last_used > PBUF_TIMEOUT_MS) {
+		csp_log_warn("CAN Buffer element timed out");
+		csp_can_pbuf_stats.timeouts++;
+		/* Recycle packet buffer */
+		csp_can_pbuf_free(csp_can_pbuf_oldest);
+	}
+}
 
-	for (i = 0; i < PBUF_ELEMENTS; i++) {
-		buf = &csp_can_pbuf[i];
+void csp_can_get_pbuf_stats(csp_can_pbuf_stats_t *stats)
+{
+	*stats = csp_can_pbuf_stats;
+}
 
-		if ((buf->state == BUF_USED) && ((buf->cfpid & mask) == (id & mask))) {
-			csp_can_pbuf_timestamp(buf);
-			ret = buf;
-			break;
-		}
+static void csp_can_stats_frame(can_frame_t *frame, int rx)
+{
+	uint32_t bits = CAN_FRAME_BITS + 8 * frame->dlc;
+
+	if (rx) {
+		uint8_t src = CFP_SRC(frame->id);
+		CAN_STATS_ADD(csp_can_stats.rx_frames, 1);
+		CAN_STATS_ADD(csp_can_stats.rx_bytes, frame->dlc);
+		CAN_STATS_ADD(csp_can_stats.nodes[src].frames, 1);
+		CAN_STATS_ADD(csp_can_stats.nodes[src].bytes, frame->dlc);
+		CAN_STATS_ADD(csp_can_window_frames[src], 1);
+		CAN_STATS_ADD(csp_can_window_bytes[src], frame->dlc);
+	} else {
+		CAN_STATS_ADD(csp_can_stats.tx_frames, 1);
+		CAN_STATS_ADD(csp_can_stats.tx_bytes, frame->dlc);
 	}
 
-	return ret;
+	CAN_STATS_ADD(csp_can_window_bits, bits);
 }
 
-static void csp_can_pbuf_cleanup(void)
+static void csp_can_stats_window(void)
 {
+	uint32_t now = csp_get_ms();
+	uint32_t elapsed = now - csp_can_window_start;
+	uint64_t load;
 	int i;
-	csp_can_pbuf_element_t *buf;
 
-	for (i = 0; i < PBUF_ELEMENTS; i++) {
-		buf = &csp_can_pbuf[i];
+	if (elapsed < CAN_STATS_WINDOW_MS)
+		return;
 
-		/* Skip if not used */
-		if (buf->state != BUF_USED)
-			continue;
+	/* Take and reset each window counter in one step, so no frame is lost */
+	for (i = 0; i <= CSP_ID_HOST_MAX; i++) {
+		uint32_t frames = __atomic_exchange_n(&csp_can_window_frames[i], 0, __ATOMIC_RELAXED);
+		uint32_t bytes = __atomic_exchange_n(&csp_can_window_bytes[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&csp_can_stats.nodes[i].frame_rate, (uint64_t) frames * 1000 / elapsed, __ATOMIC_RELAXED);
+		__atomic_store_n(&csp_can_stats.nodes[i].byte_rate, (uint64_t) bytes * 1000 / elapsed, __ATOMIC_RELAXED);
+	}
 
-		/* Check timeout */
-		uint32_t now = csp_get_ms();
-		if (now - buf->last_used > PBUF_TIMEOUT_MS) {
-			csp_log_warn("CAN Buffer element timed out");
-			/* Recycle packet buffer */
-			csp_can_pbuf_free(buf);
-		}
+	/* Bits on the bus relative to the bits available in the window */
+	uint32_t bits = __atomic_exchange_n(&csp_can_window_bits, 0, __ATOMIC_RELAXED);
+	if (csp_can_stats.bitrate > 0) {
+		load = (uint64_t) bits * 1000 * 1000 / ((uint64_t) csp_can_stats.bitrate * elapsed);
+		__atomic_store_n(&csp_can_stats.bus_load, (load > 1000) ? 1000 : load, __ATOMIC_RELAXED);
+	}
+
+	csp_can_window_start = now;
+}
+
+void csp_can_get_stats(csp_can_stats_t *stats)
+{
+	*stats = csp_can_stats;
+	stats->pbuf = csp_can_pbuf_stats;
+}
+
+void csp_can_rx_error(uint32_t events, uint8_t tx_errors, uint8_t rx_errors)
+{
+	csp_can_error_stats_t *err = &csp_can_stats.errors;
+
+	CAN_STATS_ADD(err->error_frames, 1);
+	CAN_STATS_ADD(csp_if_can.rx_error, 1);
+
+	if (events & CAN_EVENT_WARNING)
+		CAN_STATS_ADD(err->warning, 1);
+	if (events & CAN_EVENT_PASSIVE)
+		CAN_STATS_ADD(err->passive, 1);
+	if (events & CAN_EVENT_BUS_OFF)
+		CAN_STATS_ADD(err->bus_off, 1);
+	if (events & CAN_EVENT_RESTARTED)
+		CAN_STATS_ADD(err->restarts, 1);
+	if (events & CAN_EVENT_ARBITRATION)
+		CAN_STATS_ADD(err->arbitration, 1);
+	if (events & CAN_EVENT_PROTOCOL)
+		CAN_STATS_ADD(err->protocol, 1);
+	if (events & CAN_EVENT_NO_ACK)
+		CAN_STATS_ADD(err->no_ack, 1);
+	if (events & CAN_EVENT_OVERFLOW)
+		CAN_STATS_ADD(err->overflow, 1);
+
+	/* Most severe state reported wins */
+	if (events & CAN_EVENT_BUS_OFF)
+		err->state = CSP_CAN_STATE_BUS_OFF;
+	else if (events & CAN_EVENT_PASSIVE)
+		err->state = CSP_CAN_STATE_PASSIVE;
+	else if (events & CAN_EVENT_WARNING)
+		err->state = CSP_CAN_STATE_WARNING;
+	else if (events & (CAN_EVENT_ACTIVE | CAN_EVENT_RESTARTED))
+		err->state = CSP_CAN_STATE_ACTIVE;
+
+	if (events & CAN_EVENT_COUNTERS) {
+		err->tx_errors = tx_errors;
+		err->rx_errors = rx_errors;
 	}
 }
 
 static int csp_can_process_frame(can_frame_t *frame)
 {
 	csp_can_pbuf_element_t *buf;
-	uint8_t offset;
+	uint8_t offset, bytes;
 
 	can_id_t id = frame->id;
 
 	/* Bind incoming frame to a packet buffer */
-	buf = csp_can_pbuf_find(id, CFP_ID_CONN_MASK);
+	buf = csp_can_pbuf_find(id);
 
 	/* Check returned buffer */
 	if (buf == NULL) {
@@ -279,6 +503,7 @@ static int csp_can_process_frame(can_frame_t *frame)
 			}
 		} else {
 			csp_log_warn("Out of order MORE frame received");
+			csp_can_pbuf_stats.out_of_order++;
 			csp_if_can.frame++;
 			return CSP_ERR_INVAL;
 		}
@@ -303,6 +528,7 @@ static int csp_can_process_frame(can_frame_t *frame)
 		if (buf->packet != NULL) {
 			/* Reuse the buffer */
 			csp_log_warn("Incomplete frame");
+			csp_can_pbuf_stats.incomplete++;
 			csp_if_can.frame++;
 		} else {
 			/* Allocate memory for frame */
@@ -321,6 +547,14 @@ static int csp_can_process_frame(can_frame_t *frame)
 		memcpy(&(buf->packet->length), frame->data + sizeof(csp_id_t), sizeof(uint16_t));
 		buf->packet->length = csp_ntoh16(buf->packet->length);
 
+		/* Discard packet if it does not fit in the buffer */
+		if (buf->packet->length > CSP_CAN_MTU) {
+			csp_log_warn("Too large BEGIN frame received");
+			csp_if_can.frame++;
+			csp_can_pbuf_free(buf);
+			break;
+		}
+
 		/* Reset RX count */
 		buf->rx_count = 0;
 
@@ -329,6 +563,7 @@ static int csp_can_process_frame(can_frame_t *frame)
 
 		/* Set remain field - increment to include begin packet */
 		buf->remain = CFP_REMAIN(id) + 1;
+		buf->started = csp_get_ms();
 
 		/* FALLTHROUGH */
 
@@ -337,6 +572,7 @@ static int csp_can_process_frame(can_frame_t *frame)
 		/* Check 'remain' field match */
 		if (CFP_REMAIN(id) != buf->remain - 1) {
 			csp_log_error("CAN frame lost in CSP packet");
+			csp_can_pbuf_stats.out_of_order++;
 			csp_can_pbuf_free(buf);
 			csp_if_can.frame++;
 			break;
@@ -346,21 +582,35 @@ static int csp_can_process_frame(can_frame_t *frame)
 		buf->remain--;
 
 		/* Check for overflow */
-		if ((buf->rx_count + frame->dlc - offset) > buf->packet->length) {
-			csp_log_error("RX buffer overflow");
-			csp_if_can.frame++;
-			csp_can_pbuf_free(buf);
-			break;
+		bytes = frame->dlc - offset;
+		if ((buf->rx_count + bytes) > buf->packet->length) {
+			/* CAN FD frames may be padded to a valid length */
+			if (frame->dlc <= 8 || buf->remain > 0) {
+				csp_log_error("RX buffer overflow");
+				csp_if_can.frame++;
+				csp_can_pbuf_free(buf);
+				break;
+			}
+			bytes = buf->packet->length - buf->rx_count;
 		}
 
-		/* Copy dlc bytes into buffer */
-		memcpy(&buf->packet->data[buf->rx_count], frame->data + offset, frame->dlc - offset);
-		buf->rx_count += frame->dlc - offset;
+		/* Copy data bytes into buffer */
+		memcpy(&buf->packet->data[buf->rx_count], frame->data + offset, bytes);
+		buf->rx_count += bytes;
 
 		/* Check if more data is expected */
 		if (buf->rx_count != buf->packet->length)
 			break;
 
+		/* Record reassembly time */
+		uint32_t elapsed = csp_get_ms() - buf->started;
+		if (csp_can_pbuf_stats.completed == 0 || elapsed < csp_can_pbuf_stats.time_min)
+			csp_can_pbuf_stats.time_min = elapsed;
+		if (elapsed > csp_can_pbuf_stats.time_max)
+			csp_can_pbuf_stats.time_max = elapsed;
+		csp_can_pbuf_stats.time_total += elapsed;
+		csp_can_pbuf_stats.completed++;
+
 		/* Data is available */
 		csp_new_packet(buf->packet, &csp_if_can, NULL);
 
@@ -389,12 +639,16 @@ static CSP_DEFINE_TASK(csp_can_rx_task)
 
 	while (1) {
 		ret = csp_queue_dequeue(csp_can_rx_queue, &frame, 1000);
-		if (ret != CSP_QUEUE_OK) {
-			csp_can_pbuf_cleanup();
-			continue;
+		if (ret == CSP_QUEUE_OK) {
+			csp_can_stats_frame(&frame, 1);
+			csp_can_process_frame(&frame);
 		}
 
-		csp_can_process_frame(&frame);
+		/* Only checks the oldest element unless some have timed out */
+		csp_can_pbuf_cleanup();
+
+		/* Dequeue timeout ensures rates are updated on an idle bus */
+		csp_can_stats_window();
 	}
 
 	csp_thread_exit();
@@ -410,9 +664,19 @@ int csp_can_rx_frame(can_frame_t *frame, CSP_BASE_TYPE *task_woken)
 
 int csp_can_tx(csp_iface_t *interface, csp_packet_t *packet, uint32_t timeout)
 {
+	can_frame_t frames[CFP_FRAMES_MAX];
 	uint16_t tx_count;
-	uint8_t bytes, overhead, avail, dest;
-	uint8_t frame_buf[8];
+	uint8_t bytes, dest, size;
+	int count;
+
+	/* Frame size is fixed for the interface */
+	size = csp_can_frame_size;
+
+	/* Check that the packet fits in the frame array */
+	if ((packet->length + CFP_OVERHEAD + size - 1) / size > CFP_FRAMES_MAX) {
+		csp_log_warn("Packet too large for CAN: %u", packet->length);
+		return CSP_ERR_TX;
+	}
 
 	/* Get CFP identification number */
 	int ident = csp_can_id_get();
@@ -421,9 +685,6 @@ int csp_can_tx(csp_iface_t *interface, csp_packet_t *packet, uint32_t timeout)
 		return CSP_ERR_INVAL;
 	}
 
-	/* Calculate overhead */
-	overhead = sizeof(csp_id_t) + sizeof(uint16_t);
-
 	/* Insert destination node mac address into the CFP destination field */
 	dest = csp_rtable_find_mac(packet->id.dst);
 	if (dest == CSP_NODE_MAC)
@@ -435,33 +696,29 @@ int csp_can_tx(csp_iface_t *interface, csp_packet_t *packet, uint32_t timeout)
 	id |= CFP_MAKE_DST(dest);
 	id |= CFP_MAKE_ID(ident);
 	id |= CFP_MAKE_TYPE(CFP_BEGIN);
-	id |= CFP_MAKE_REMAIN((packet->length + overhead - 1) / 8);
+	id |= CFP_MAKE_REMAIN((packet->length + CFP_OVERHEAD - 1) / size);
 
 	/* Calculate first frame data bytes */
-	avail = 8 - overhead;
-	bytes = (packet->length <= avail) ? packet->length : avail;
+	bytes = (packet->length <= size - CFP_OVERHEAD) ? packet->length : size - CFP_OVERHEAD;
 
 	/* Copy CSP headers and data */
 	uint32_t csp_id_be = csp_hton32(packet->id.ext);
 	uint16_t csp_length_be = csp_hton16(packet->length);
 
-	memcpy(frame_buf, &csp_id_be, sizeof(csp_id_be));
-	memcpy(frame_buf + sizeof(csp_id_be), &csp_length_be, sizeof(csp_length_be));
-	memcpy(frame_buf + overhead, packet->data, bytes);
+	frames[0].id = id;
+	frames[0].dlc = CFP_OVERHEAD + bytes;
+	memcpy(frames[0].data, &csp_id_be, sizeof(csp_id_be));
+	memcpy(frames[0].data + sizeof(csp_id_be), &csp_length_be, sizeof(csp_length_be));
+	memcpy(frames[0].data + CFP_OVERHEAD, packet->data, bytes);
 
 	/* Increment tx counter */
 	tx_count = bytes;
+	count = 1;
 
-	/* Send first frame */
-	if (can_send(id, frame_buf, overhead + bytes)) {
-		csp_log_warn("Failed to send CAN frame in csp_tx_can");
-		return CSP_ERR_DRIVER;
-	}
-
-	/* Send next frames if not complete */
+	/* Prepare next frames if not complete */
 	while (tx_count < packet->length) {
 		/* Calculate frame data bytes */
-		bytes = (packet->length - tx_count >= 8) ? 8 : packet->length - tx_count;
+		bytes = (packet->length - tx_count >= size) ? size : packet->length - tx_count;
 
 		/* Prepare identifier */
 		can_id_t id = 0;
@@ -469,24 +726,70 @@ int csp_can_tx(csp_iface_t *interface, csp_packet_t *packet, uint32_t timeout)
 		id |= CFP_MAKE_DST(dest);
 		id |= CFP_MAKE_ID(ident);
 		id |= CFP_MAKE_TYPE(CFP_MORE);
-		id |= CFP_MAKE_REMAIN((packet->length - tx_count - bytes + 7) / 8);
+		id |= CFP_MAKE_REMAIN((packet->length - tx_count - bytes + size - 1) / size);
+
+		frames[count].id = id;
+		frames[count].dlc = bytes;
+		memcpy(frames[count].data, packet->data + tx_count, bytes);
 
 		/* Increment tx counter */
 		tx_count += bytes;
+		count++;
+	}
 
-		/* Send frame */
-		if (can_send(id, packet->data + tx_count - bytes, bytes)) {
-			csp_log_warn("Failed to send CAN frame in Tx callback");
-			csp_if_can.tx_error++;
-			return CSP_ERR_DRIVER;
-		}
+	/* Queue all frames in one batch */
+	if (can_send_frames(frames, count, packet->id.pri, timeout)) {
+		csp_log_warn("Failed to send CAN frames in csp_tx_can");
+		return CSP_ERR_DRIVER;
 	}
 
+	for (int i = 0; i < count; i++)
+		csp_can_stats_frame(&frames[i], 0);
+
 	csp_buffer_free(packet);
 
 	return CSP_ERR_NONE;
 }
 
+/* Install driver filters for the CFP destinations we accept frames for */
+static void csp_can_filter_update(void)
+{
+	can_filter_t filters[CSP_ID_HOST_MAX + 1];
+	csp_iface_t *ifc;
+	int addr, count = 0;
+
+	if (csp_can_mode == CSP_CAN_PROMISC) {
+		can_set_filters(NULL, 0);
+		return;
+	}
+
+	for (addr = 0; addr <= CSP_ID_HOST_MAX; addr++) {
+		/* Own address and broadcast are always accepted */
+		if (addr != csp_get_address() && addr != CSP_BROADCAST_ADDR) {
+			/* Accept frames that are routed on, unless split horizon would drop them */
+			ifc = csp_rtable_find_iface(addr);
+			if (ifc == NULL || ifc == &csp_if_lo || (ifc == &csp_if_can && csp_if_can.split_horizon_off == 0))
+				continue;
+		}
+		filters[count].id = CFP_MAKE_DST(addr);
+		filters[count].mask = CFP_MAKE_DST((1 << CFP_HOST_SIZE) - 1);
+		count++;
+	}
+
+	/* A single filter is cheaper than one per address */
+	if (count == CSP_ID_HOST_MAX + 1)
+		count = 0;
+
+	if (can_set_filters(count ? filters : NULL, count) != 0)
+		csp_log_warn("Failed to update CAN filters");
+}
+
+void csp_can_set_promisc(uint8_t promisc)
+{
+	csp_can_mode = promisc ? CSP_CAN_PROMISC : CSP_CAN_MASKED;
+	csp_can_filter_update();
+}
+
 int csp_can_init(uint8_t mode, struct csp_can_config *conf)
 {
 	int ret;
@@ -504,6 +807,18 @@ int csp_can_init(uint8_t mode, struct csp_can_config *conf)
 		return CSP_ERR_NOMEM;
 	}
 
+	/* Select frame size */
+	if (conf->fd) {
+#ifdef CSP_USE_CAN_FD
+		csp_can_frame_size = 64;
+#else
+		csp_log_error("CAN FD requested, but CSP was compiled without CAN FD support");
+		return CSP_ERR_NOTSUP;
+#endif
+	} else {
+		csp_can_frame_size = 8;
+	}
+
 	if (mode == CSP_CAN_MASKED) {
 		mask = CFP_MAKE_DST((1 << CFP_HOST_SIZE) - 1);
 	} else if (mode == CSP_CAN_PROMISC) {
@@ -512,6 +827,12 @@ int csp_can_init(uint8_t mode, struct csp_can_config *conf)
 		csp_log_error("Unknown CAN mode");
 		return CSP_ERR_INVAL;
 	}
+	csp_can_mode = mode;
+
+	/* Bitrate is needed for bus load estimate */
+	memset(&csp_can_stats, 0, sizeof(csp_can_stats));
+	csp_can_stats.bitrate = conf->bitrate;
+	csp_can_window_start = csp_get_ms();
 
 	csp_can_rx_queue = csp_queue_create(CSP_CAN_RX_QUEUE_SIZE, sizeof(can_frame_t));
 	if (!csp_can_rx_queue) {
@@ -534,6 +855,10 @@ int csp_can_init(uint8_t mode, struct csp_can_config *conf)
 	/* Regsiter interface */
 	csp_iflist_add(&csp_if_can);
 
+	/* Derive filters from own address and routing table, and follow changes */
+	csp_can_filter_update();
+	csp_rtable_hook_set(csp_can_filter_update);
+
 	return CSP_ERR_NONE;
 }
 
@@ -30,9 +30,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/interfaces/csp_if_kiss.h>
 #include <csp/arch/csp_semaphore.h>
 #include <csp/csp_crc32.h>
+#include <csp/csp_fec.h>
+#include <csp/arch/csp_malloc.h>
 
 #define KISS_MTU				256
 
+/* Largest frame on the line: header, data and CRC32, plus FEC parity */
+#define KISS_FEC_FRAME			CSP_FEC_ENCODED_MAX(CSP_HEADER_LENGTH + KISS_MTU + sizeof(uint32_t))
+
 #define FEND  					0xC0
 #define FESC  					0xDB
 #define TFEND 					0xDC
@@ -45,6 +50,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 static int kiss_lock_init = 0;
 static csp_bin_sem_handle_t kiss_lock;
 
+#ifdef CSP_USE_FEC
+/* Encoded frame, protected by kiss_lock */
+static uint8_t kiss_fec_txbuf[KISS_FEC_FRAME];
+#endif
+
 /* Send a CSP packet over the KISS RS232 protocol */
 static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
 
@@ -61,19 +71,36 @@ static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t
 	/* Lock */
 	csp_bin_sem_wait(&kiss_lock, 1000);
 
-	/* Transmit data */
 	csp_kiss_handle_t * driver = interface->driver;
+	unsigned char * frame = (unsigned char *) &packet->id.ext;
+	unsigned int length = packet->length;
+
+#ifdef CSP_USE_FEC
+	/* Add parity between the CSP frame and the KISS encoding */
+	if (driver->fec_depth > 0) {
+		int ret = csp_fec_encode(frame, length, kiss_fec_txbuf, driver->fec_depth);
+		if (ret < 0) {
+			csp_bin_sem_post(&kiss_lock);
+			return CSP_ERR_TX;
+		}
+		frame = kiss_fec_txbuf;
+		length = ret;
+	}
+#endif
+
+	/* Transmit data */
 	driver->kiss_putc(FEND);
 	driver->kiss_putc(TNC_DATA);
-	for (unsigned int i = 0; i < packet->length; i++) {
-		if (((unsigned char *) &packet->id.ext)[i] == FEND) {
-			((unsigned char *) &packet->id.ext)[i] = TFEND;
+	for (unsigned int i = 0; i < length; i++) {
+		if (frame[i] == FEND) {
 			driver->kiss_putc(FESC);
-		} else if (((unsigned char *) &packet->id.ext)[i] == FESC) {
-			((unsigned char *) &packet->id.ext)[i] = TFESC;
+			driver->kiss_putc(TFEND);
+		} else if (frame[i] == FESC) {
 			driver->kiss_putc(FESC);
+			driver->kiss_putc(TFESC);
+		} else {
+			driver->kiss_putc(frame[i]);
 		}
-		driver->kiss_putc(((unsigned char *) &packet->id.ext)[i]);
 	}
 	driver->kiss_putc(FEND);
 
@@ -86,6 +113,17 @@ static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t
 	return CSP_ERR_NONE;
 }
 
+/* Store received byte in the packet, or in the FEC buffer when FEC is enabled */
+static inline void csp_kiss_rx_byte(csp_kiss_handle_t * driver, unsigned char c) {
+#ifdef CSP_USE_FEC
+	if (driver->fec_depth > 0) {
+		driver->fec_buf[driver->rx_length++] = c;
+		return;
+	}
+#endif
+	((char *) &driver->rx_packet->id.ext)[driver->rx_length++] = c;
+}
+
 /**
  * When a frame is received, decode the kiss-stuff
  * and eventually send it directly to the CSP new packet function.
@@ -101,7 +139,12 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 		unsigned char inputbyte = *buf++;
 
 		/* If packet was too long */
-		if (driver->rx_length > interface->mtu) {
+		unsigned int rx_max = interface->mtu;
+#ifdef CSP_USE_FEC
+		if (driver->fec_depth > 0)
+			rx_max = KISS_FEC_FRAME - 1;
+#endif
+		if (driver->rx_length > rx_max) {
 			csp_log_warn("KISS RX overflow");
 			interface->rx_error++;
 			driver->rx_mode = KISS_MODE_NOT_STARTED;
@@ -154,6 +197,24 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 				/* Accept message */
 				if (driver->rx_length > 0) {
 
+#ifdef CSP_USE_FEC
+					/* Correct errors and move the frame into the packet */
+					if (driver->fec_depth > 0) {
+						unsigned int corrected;
+						int ret = csp_fec_decode(driver->fec_buf, driver->rx_length, driver->fec_depth, &corrected);
+						if (ret < 0 || (unsigned int) ret > interface->mtu) {
+							csp_log_warn("KISS FEC frame skipped, len: %u", driver->rx_length);
+							driver->fec_failed++;
+							interface->rx_error++;
+							driver->rx_mode = KISS_MODE_NOT_STARTED;
+							break;
+						}
+						driver->fec_corrected += corrected;
+						memcpy(&driver->rx_packet->id.ext, driver->fec_buf, ret);
+						driver->rx_length = ret;
+					}
+#endif
+
 					/* Check for valid length */
 					if (driver->rx_length < CSP_HEADER_LENGTH + sizeof(uint32_t)) {
 						csp_log_warn("KISS short frame skipped, len: %u", driver->rx_length);
@@ -198,7 +259,7 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 			}
 
 			/* Valid data char */
-			((char *) &driver->rx_packet->id.ext)[driver->rx_length++] = inputbyte;
+			csp_kiss_rx_byte(driver, inputbyte);
 
 			break;
 
@@ -206,11 +267,11 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 
 			/* Escaped escape char */
 			if (inputbyte == TFESC)
-				((char *) &driver->rx_packet->id.ext)[driver->rx_length++] = FESC;
+				csp_kiss_rx_byte(driver, FESC);
 
 			/* Escaped fend char */
 			if (inputbyte == TFEND)
-				((char *) &driver->rx_packet->id.ext)[driver->rx_length++] = FEND;
+				csp_kiss_rx_byte(driver, FEND);
 
 			/* Go back to started mode */
 			driver->rx_mode = KISS_MODE_STARTED;
@@ -244,6 +305,10 @@ void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle,
 	csp_kiss_handle->kiss_putc = kiss_putc_f;
 	csp_kiss_handle->rx_packet = NULL;
 	csp_kiss_handle->rx_mode = KISS_MODE_NOT_STARTED;
+#ifdef CSP_USE_FEC
+	csp_kiss_handle->fec_depth = 0;
+	csp_kiss_handle->fec_buf = NULL;
+#endif
 
 	/* Setop other mandatories */
 	csp_iface->mtu = KISS_MTU;
@@ -254,3 +319,26 @@ void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle,
 	csp_iflist_add(csp_iface);
 
 }
+
+#ifdef CSP_USE_FEC
+int csp_kiss_set_fec(csp_iface_t * interface, uint8_t depth) {
+
+	csp_kiss_handle_t * driver = interface->driver;
+
+	if (depth > CSP_FEC_MAX_DEPTH)
+		return CSP_ERR_INVAL;
+
+	if (depth > 0 && driver->fec_buf == NULL) {
+		driver->fec_buf = csp_malloc(KISS_FEC_FRAME);
+		if (driver->fec_buf == NULL)
+			return CSP_ERR_NOMEM;
+	}
+
+	/* Restart reception, a partial frame may be in the other buffer */
+	driver->rx_mode = KISS_MODE_NOT_STARTED;
+	driver->fec_depth = depth;
+
+	return CSP_ERR_NONE;
+
+}
+#endif
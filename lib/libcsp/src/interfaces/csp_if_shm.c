@@ -0,0 +1,344 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Shared memory interface
+ *
+ * The receiving process owns a segment with a ring and a pool of CSP
+ * buffers. Each ring slot holds a free buffer from the pool, and senders
+ * copy the packet directly into it, so the receiver passes the buffer on
+ * to the router without copying. The buffer returns to the pool when the
+ * router or application frees it, and the receiver gives the slot a new one.
+ *
+ * Each ring is a bounded multi-producer single-consumer queue. Every slot
+ * has a sequence number: a producer claims a position by advancing head,
+ * copies the packet into the slot buffer and publishes it by setting the
+ * sequence to position + 1. The consumer reads slots in order and releases
+ * them by setting the sequence to position + number of slots. A slot that
+ * is claimed but not published within SHM_PUBLISH_TIMEOUT, because the
+ * producer died, is skipped and its buffer is not reused.
+ *
+ * The consumer spins briefly when the ring is empty, and then sleeps on a
+ * futex in the ring. Producers only make the wake syscall when the
+ * consumer has announced that it is going to sleep.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <csp/csp.h>
+#include <csp/csp_interface.h>
+#include <csp/interfaces/csp_if_shm.h>
+#include <csp/arch/csp_time.h>
+#include <csp/arch/csp_thread.h>
+
+/* Buffers in the pool, packets held by the router or application beyond the slots */
+#define SHM_BUFFERS		(2 * CSP_SHM_SLOTS)
+
+/* Empty polls before the consumer sleeps */
+#define SHM_SPIN		2000
+
+/* Time in ms a claimed slot may stay unpublished before it is skipped */
+#define SHM_PUBLISH_TIMEOUT	1000
+
+/* Identifies an initialized ring */
+#define SHM_MAGIC		0x43535052
+
+typedef struct {
+	uint32_t seq;
+	uint16_t length;
+	uint32_t offset;	/* Buffer for the packet, from the start of the pool */
+} csp_shm_slot_t;
+
+struct csp_shm_ring_s {
+	uint32_t magic;
+	uint32_t head __attribute__((aligned(64)));	/* Next position to claim, shared by producers */
+	uint32_t tail __attribute__((aligned(64)));	/* Next position to read, consumer only */
+	uint32_t waiting;				/* Consumer is about to sleep */
+	uint32_t futex;					/* Incremented to wake the consumer */
+	csp_shm_slot_t slots[CSP_SHM_SLOTS] __attribute__((aligned(64)));
+	uint8_t pool[] __attribute__((aligned(64)));	/* Buffers of the consumer */
+};
+
+static size_t csp_shm_size(void) {
+	return sizeof(csp_shm_ring_t) + csp_buffer_pool_size(SHM_BUFFERS, CSP_SHM_MTU);
+}
+
+static int csp_shm_futex(uint32_t * addr, int op, uint32_t val, const struct timespec * timeout) {
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static csp_shm_ring_t * csp_shm_map(uint8_t addr, int create) {
+
+	char name[32];
+	struct stat st;
+	csp_shm_ring_t * ring;
+	size_t size = csp_shm_size();
+
+	snprintf(name, sizeof(name), "/csp-shm-%u", addr);
+
+	/* Only processes of the same user may inject packets */
+	int fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0600);
+	if (fd < 0)
+		return NULL;
+
+	if (create && ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	/* A ring created with another layout is not used */
+	if (!create && (fstat(fd, &st) < 0 || (size_t) st.st_size != size)) {
+		close(fd);
+		return NULL;
+	}
+
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	/* The owner resets the ring, stale content from a previous run is discarded */
+	if (create) {
+		memset(ring, 0, sizeof(*ring));
+	} else if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+		munmap(ring, size);
+		return NULL;
+	}
+
+	return ring;
+
+}
+
+/* Give a slot a free buffer from the pool and release it to producers */
+static int csp_shm_rx_refill(csp_shm_handle_t * handle, uint32_t pos) {
+
+	csp_shm_ring_t * ring = handle->rx_ring;
+	csp_shm_slot_t * slot = &ring->slots[pos & (CSP_SHM_SLOTS - 1)];
+
+	csp_packet_t * packet = csp_buffer_get_pool(ring->pool);
+	if (packet == NULL)
+		return CSP_ERR_NOMEM;
+
+	handle->rx_packets[pos & (CSP_SHM_SLOTS - 1)] = packet;
+	slot->offset = (uint8_t *) packet - ring->pool;
+	__atomic_store_n(&slot->seq, pos + CSP_SHM_SLOTS, __ATOMIC_RELEASE);
+
+	return CSP_ERR_NONE;
+
+}
+
+static int csp_shm_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
+
+	csp_shm_handle_t * handle = interface->driver;
+	csp_shm_slot_t * slot;
+	uint32_t pos;
+
+	if (packet->length > CSP_SHM_MTU)
+		return CSP_ERR_TX;
+
+	/* Find next hop */
+	uint8_t mac = csp_rtable_find_mac(packet->id.dst);
+	if (mac == CSP_NODE_MAC)
+		mac = packet->id.dst;
+
+	pthread_mutex_lock(&handle->lock);
+	csp_shm_ring_t * ring = handle->peers[mac];
+	if (ring == NULL) {
+		ring = csp_shm_map(mac, 0);
+		handle->peers[mac] = ring;
+	}
+	pthread_mutex_unlock(&handle->lock);
+
+	if (ring == NULL) {
+		csp_log_warn("SHM: No ring for %u", mac);
+		return CSP_ERR_TX;
+	}
+
+	/* Claim a slot */
+	pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	while (1) {
+		slot = &ring->slots[pos & (CSP_SHM_SLOTS - 1)];
+		int32_t dif = (int32_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			/* Full, the receiver is not keeping up */
+			interface->drop++;
+			return CSP_ERR_TX;
+		} else {
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	/* Copy into the buffer of the slot */
+	uint32_t offset = __atomic_load_n(&slot->offset, __ATOMIC_RELAXED);
+	if (offset > csp_buffer_pool_size(SHM_BUFFERS, CSP_SHM_MTU) - CSP_BUFFER_PACKET_OVERHEAD - CSP_SHM_MTU) {
+		interface->tx_error++;
+		return CSP_ERR_TX;
+	}
+	csp_packet_t * out = (void *) &ring->pool[offset];
+	out->id = packet->id;
+	memcpy(out->data, packet->data, packet->length);
+	slot->length = packet->length;
+
+	/* Publish, unless the consumer gave up on the slot meanwhile */
+	uint32_t claimed = pos;
+	if (!__atomic_compare_exchange_n(&slot->seq, &claimed, pos + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		interface->drop++;
+		return CSP_ERR_TX;
+	}
+
+	if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(&ring->futex, 1, __ATOMIC_SEQ_CST);
+		csp_shm_futex(&ring->futex, FUTEX_WAKE, 1, NULL);
+	}
+
+	csp_buffer_free(packet);
+
+	return CSP_ERR_NONE;
+
+}
+
+static int csp_shm_rx_ready(csp_shm_ring_t * ring) {
+	csp_shm_slot_t * slot = &ring->slots[ring->tail & (CSP_SHM_SLOTS - 1)];
+	return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == ring->tail + 1;
+}
+
+static void * csp_shm_task(void * param) {
+
+	csp_shm_handle_t * handle = param;
+	csp_shm_ring_t * ring = handle->rx_ring;
+	const struct timespec poll = {.tv_sec = 0, .tv_nsec = 10000000};
+	uint32_t claimed_ms = 0;
+	int idle = 0, claimed = 0;
+
+	while (1) {
+		csp_shm_slot_t * slot = &ring->slots[ring->tail & (CSP_SHM_SLOTS - 1)];
+
+		if (!csp_shm_rx_ready(ring)) {
+			/* Skip a slot whose producer claimed it and never published */
+			if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) != ring->tail) {
+				if (!claimed) {
+					claimed = 1;
+					claimed_ms = csp_get_ms();
+				} else if (csp_get_ms() - claimed_ms > SHM_PUBLISH_TIMEOUT) {
+					/* Move the sequence away from the claimed position, so a late publish fails and the ring looks full */
+					uint32_t pos = ring->tail;
+					if (__atomic_compare_exchange_n(&slot->seq, &pos, ring->tail - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+						/* The producer may still write to the buffer, so it is left out of the pool */
+						csp_log_warn("SHM: Skipping unpublished slot %u", ring->tail);
+						handle->iface->frame++;
+						while (csp_shm_rx_refill(handle, ring->tail) != CSP_ERR_NONE)
+							csp_sleep_ms(1);
+						ring->tail++;
+						claimed = 0;
+					}
+					continue;
+				}
+			}
+
+			if (++idle < SHM_SPIN)
+				continue;
+
+			/* Announce sleep, and check again before waiting so no wakeup is lost */
+			uint32_t val = __atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+			if (!csp_shm_rx_ready(ring))
+				csp_shm_futex(&ring->futex, FUTEX_WAIT, val, claimed ? &poll : NULL);
+			__atomic_store_n(&ring->waiting, 0, __ATOMIC_SEQ_CST);
+			idle = 0;
+			continue;
+		}
+
+		idle = 0;
+		claimed = 0;
+		csp_packet_t * packet = handle->rx_packets[ring->tail & (CSP_SHM_SLOTS - 1)];
+
+		/* The slot is writable by other processes, read the length once */
+		uint16_t length = __atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+
+		if (length > CSP_SHM_MTU) {
+			handle->iface->frame++;
+			csp_buffer_free(packet);
+		} else {
+			packet->length = length;
+			csp_qfifo_write(packet, handle->iface, NULL);
+		}
+
+		/* Release slot to producers with a new buffer, once the router has freed one */
+		while (csp_shm_rx_refill(handle, ring->tail) != CSP_ERR_NONE)
+			csp_sleep_ms(1);
+		ring->tail++;
+	}
+
+	return NULL;
+
+}
+
+int csp_shm_init(csp_iface_t * iface, csp_shm_handle_t * handle, const char * name, uint8_t addr) {
+
+	memset(handle, 0, sizeof(*handle));
+	handle->iface = iface;
+	pthread_mutex_init(&handle->lock, NULL);
+
+	csp_shm_ring_t * ring = csp_shm_map(addr, 1);
+	if (ring == NULL) {
+		csp_log_error("SHM: Failed to create ring for %u: %s", addr, strerror(errno));
+		return CSP_ERR_DRIVER;
+	}
+	handle->rx_ring = ring;
+
+	/* Fill every slot with a buffer from the shared pool before announcing the ring */
+	if (csp_buffer_init_pool(ring->pool, SHM_BUFFERS, CSP_SHM_MTU) != CSP_ERR_NONE) {
+		csp_log_error("SHM: Failed to create buffer pool");
+		return CSP_ERR_NOMEM;
+	}
+	for (uint32_t i = 0; i < CSP_SHM_SLOTS; i++)
+		csp_shm_rx_refill(handle, i - CSP_SHM_SLOTS);
+	__atomic_store_n(&ring->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+	/* Setup interface */
+	iface->driver = handle;
+	iface->name = name;
+	iface->nexthop = csp_shm_tx;
+	iface->mtu = CSP_SHM_MTU;
+
+	if (pthread_create(&handle->thread, NULL, csp_shm_task, handle) != 0) {
+		csp_log_error("SHM: pthread_create: %s", strerror(errno));
+		return CSP_ERR_DRIVER;
+	}
+
+	/* Regsiter interface */
+	csp_iflist_add(iface);
+
+	return CSP_ERR_NONE;
+
+}
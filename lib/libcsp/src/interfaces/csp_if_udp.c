@@ -0,0 +1,327 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* Required for recvmmsg and sendmmsg */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+#include <csp/csp_interface.h>
+#include <csp/interfaces/csp_if_udp.h>
+
+/* Number of packets waiting for the I/O thread */
+#define UDP_TX_QUEUE_SIZE	100
+
+/* Datagrams carry the CSP header followed by the data */
+#define UDP_HEADER		sizeof(csp_id_t)
+
+/* Receive buffer for datagrams arriving while out of CSP buffers, they are truncated and dropped */
+static uint8_t udp_discard[UDP_HEADER];
+
+static int csp_udp_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
+
+	csp_udp_handle_t * handle = interface->driver;
+	uint64_t one = 1;
+
+	if (csp_queue_enqueue(handle->tx_queue, &packet, timeout) != CSP_QUEUE_OK) {
+		interface->drop++;
+		return CSP_ERR_TX;
+	}
+
+	/* Only the first packet since the I/O thread last woke up needs to signal it */
+	if (__atomic_exchange_n(&handle->tx_wakeup, 1, __ATOMIC_SEQ_CST) == 0) {
+		if (write(handle->eventfd, &one, sizeof(one)) < 0)
+			csp_log_error("UDP: eventfd write: %s", strerror(errno));
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
+/* Point a receive slot at a CSP buffer, or at the discard buffer when none are available.
+ * A slot keeps its buffer until a datagram is delivered, unless the MTU has changed. */
+static void csp_udp_rx_slot(csp_iface_t * iface, csp_packet_t ** packet, struct iovec * iov) {
+
+	if (*packet != NULL) {
+		if (iov->iov_len == UDP_HEADER + iface->mtu)
+			return;
+		csp_buffer_free(*packet);
+	}
+
+	*packet = csp_buffer_get(iface->mtu);
+	if (*packet != NULL) {
+		iov->iov_base = &(*packet)->id;
+		iov->iov_len = UDP_HEADER + iface->mtu;
+	} else {
+		iov->iov_base = udp_discard;
+		iov->iov_len = sizeof(udp_discard);
+	}
+
+}
+
+static void csp_udp_rx(csp_udp_handle_t * handle, csp_packet_t * packets[], struct iovec iov[], struct mmsghdr msgs[]) {
+
+	int i, count;
+
+	/* Refill slots, and resize them if the MTU has changed */
+	for (i = 0; i < CSP_UDP_BATCH; i++) {
+		msgs[i].msg_hdr.msg_flags = 0;
+		csp_udp_rx_slot(handle->iface, &packets[i], &iov[i]);
+	}
+
+	count = recvmmsg(handle->sockfd, msgs, CSP_UDP_BATCH, MSG_DONTWAIT, NULL);
+	if (count < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			csp_log_error("UDP: recvmmsg: %s", strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		csp_packet_t * packet = packets[i];
+		unsigned int len = msgs[i].msg_len;
+
+		if (packet == NULL) {
+			handle->iface->drop++;
+		} else if (len < UDP_HEADER || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+			csp_log_warn("UDP: Invalid datagram length %u", len);
+			handle->iface->frame++;
+		} else {
+			packet->id.ext = csp_ntoh32(packet->id.ext);
+			packet->length = len - UDP_HEADER;
+
+			/* Small packets move to a smaller buffer, and the slot keeps its buffer */
+			csp_packet_t * copy = csp_buffer_compact(packet);
+			if (copy != NULL) {
+				csp_qfifo_write(copy, handle->iface, NULL);
+				continue;
+			}
+
+			csp_qfifo_write(packet, handle->iface, NULL);
+			packets[i] = NULL;
+		}
+	}
+
+}
+
+static void csp_udp_flush(csp_udp_handle_t * handle) {
+
+	csp_packet_t * packets[CSP_UDP_BATCH];
+	struct iovec iov[CSP_UDP_BATCH];
+	struct mmsghdr msgs[CSP_UDP_BATCH];
+	int i, count = 0, sent = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	/* Collect a batch of queued packets with a known peer */
+	while (count < CSP_UDP_BATCH && csp_queue_dequeue(handle->tx_queue, &packets[count], 0) == CSP_QUEUE_OK) {
+		csp_packet_t * packet = packets[count];
+
+		uint8_t mac = csp_rtable_find_mac(packet->id.dst);
+		if (mac == CSP_NODE_MAC)
+			mac = packet->id.dst;
+
+		struct sockaddr_in * peer = &handle->peers[mac];
+		if (peer->sin_port == 0) {
+			csp_log_warn("UDP: No peer for MAC %u", mac);
+			handle->iface->tx_error++;
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		packet->id.ext = csp_hton32(packet->id.ext);
+		iov[count].iov_base = &packet->id;
+		iov[count].iov_len = UDP_HEADER + packet->length;
+		msgs[count].msg_hdr.msg_name = peer;
+		msgs[count].msg_hdr.msg_namelen = sizeof(*peer);
+		msgs[count].msg_hdr.msg_iov = &iov[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+		count++;
+	}
+
+	/* sendmmsg stops at the first failing datagram, which is dropped */
+	while (sent < count) {
+		int ret = sendmmsg(handle->sockfd, &msgs[sent], count - sent, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			csp_log_warn("UDP: sendmmsg: %s", strerror(errno));
+			handle->iface->tx_error++;
+			ret = 1;
+		}
+		sent += ret;
+	}
+
+	for (i = 0; i < count; i++)
+		csp_buffer_free(packets[i]);
+
+}
+
+static void * csp_udp_task(void * param) {
+
+	csp_udp_handle_t * handle = param;
+	csp_packet_t * packets[CSP_UDP_BATCH];
+	struct iovec iov[CSP_UDP_BATCH];
+	struct mmsghdr msgs[CSP_UDP_BATCH];
+	struct pollfd fds[2];
+	uint64_t events;
+	int i;
+
+	/* Setup one message per receive buffer */
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < CSP_UDP_BATCH; i++) {
+		packets[i] = NULL;
+		csp_udp_rx_slot(handle->iface, &packets[i], &iov[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	fds[0].fd = handle->sockfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = handle->eventfd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno != EINTR)
+				csp_log_error("UDP: poll: %s", strerror(errno));
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN)
+			csp_udp_rx(handle, packets, iov, msgs);
+
+		/* Clear the wakeup before draining, so packets queued meanwhile wake us again */
+		if (fds[1].revents & POLLIN) {
+			if (read(handle->eventfd, &events, sizeof(events)) < 0)
+				csp_log_error("UDP: eventfd read: %s", strerror(errno));
+			__atomic_store_n(&handle->tx_wakeup, 0, __ATOMIC_SEQ_CST);
+			while (csp_queue_size(handle->tx_queue) > 0)
+				csp_udp_flush(handle);
+		}
+	}
+
+	return NULL;
+
+}
+
+int csp_udp_peer_set(csp_iface_t * iface, uint8_t mac, const char * host, uint16_t port) {
+
+	csp_udp_handle_t * handle = iface->driver;
+	struct addrinfo hints, * res;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+		csp_log_error("UDP: Failed to resolve %s", host);
+		return CSP_ERR_INVAL;
+	}
+
+	struct sockaddr_in peer = *(struct sockaddr_in *) res->ai_addr;
+	peer.sin_port = htons(port);
+	freeaddrinfo(res);
+
+	handle->peers[mac] = peer;
+
+	return CSP_ERR_NONE;
+
+}
+
+int csp_udp_init(csp_iface_t * iface, csp_udp_handle_t * handle, const char * name, uint16_t lport) {
+
+	struct sockaddr_in addr;
+	int ret = CSP_ERR_DRIVER;
+
+	memset(handle, 0, sizeof(*handle));
+	handle->iface = iface;
+
+	handle->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (handle->sockfd < 0) {
+		csp_log_error("UDP: socket: %s", strerror(errno));
+		return CSP_ERR_DRIVER;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(lport);
+	if (bind(handle->sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		csp_log_error("UDP: bind port %u: %s", lport, strerror(errno));
+		goto err_socket;
+	}
+
+	handle->eventfd = eventfd(0, EFD_NONBLOCK);
+	if (handle->eventfd < 0) {
+		csp_log_error("UDP: eventfd: %s", strerror(errno));
+		goto err_socket;
+	}
+
+	handle->tx_queue = csp_queue_create(UDP_TX_QUEUE_SIZE, sizeof(csp_packet_t *));
+	if (handle->tx_queue == NULL) {
+		csp_log_error("UDP: Failed to create TX queue");
+		ret = CSP_ERR_NOMEM;
+		goto err_eventfd;
+	}
+
+	/* Setup interface */
+	iface->driver = handle;
+	iface->name = name;
+	iface->nexthop = csp_udp_tx;
+	iface->mtu = CSP_UDP_MTU;
+
+	/* The thread allocates its receive buffers, so there are none to free here */
+	int err = pthread_create(&handle->thread, NULL, csp_udp_task, handle);
+	if (err != 0) {
+		csp_log_error("UDP: pthread_create: %s", strerror(err));
+		iface->driver = NULL;
+		iface->nexthop = NULL;
+		csp_queue_remove(handle->tx_queue);
+		handle->tx_queue = NULL;
+		goto err_eventfd;
+	}
+
+	/* Regsiter interface */
+	csp_iflist_add(iface);
+
+	return CSP_ERR_NONE;
+
+err_eventfd:
+	close(handle->eventfd);
+	handle->eventfd = -1;
+err_socket:
+	close(handle->sockfd);
+	handle->sockfd = -1;
+	return ret;
+
+}
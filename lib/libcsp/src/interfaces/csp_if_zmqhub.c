@@ -19,90 +19,281 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 /* CSP includes */
 #include <csp/csp.h>
 #include <csp/csp_debug.h>
 #include <csp/csp_interface.h>
 #include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_malloc.h>
 #include <csp/interfaces/csp_if_zmqhub.h>
 
 /* ZMQ */
 #include <zmq.h>
 
+/* Default maximum packet data length */
+#define ZMQHUB_MTU		256
+
+/* Envelope is the one byte satellite id followed by the CSP header */
+#define ZMQHUB_HEADER		(sizeof(char) + sizeof(csp_id_t))
+
+/* Number of packets waiting for the TX task */
+#define ZMQHUB_TX_QUEUE_SIZE	100
+
+/* Per interface driver state, stored in csp_iface_t.driver */
+typedef struct {
+	void * publisher;
+	void * subscriber;
+	csp_queue_handle_t tx_queue;	/* Packets waiting to be sent, the publisher is only used by the TX task */
+	csp_iface_t * iface;
+	csp_thread_handle_t rx_task;
+	csp_thread_handle_t tx_task;
+} zmq_driver_t;
+
+/* Context shared by all hubs, and with it the ZMQ I/O threads */
 static void * context;
-static void * publisher;
-static void * subscriber;
+
+static void * csp_zmqhub_context(void) {
+
+	if (context == NULL)
+		context = zmq_ctx_new();
+
+	return context;
+
+}
+
+int csp_zmqhub_set_io_threads(int count) {
+
+	void * ctx = csp_zmqhub_context();
+	if (ctx == NULL || zmq_ctx_set(ctx, ZMQ_IO_THREADS, count) != 0)
+		return CSP_ERR_DRIVER;
+
+	return CSP_ERR_NONE;
+
+}
 
 /**
  * Interface transmit function
+ * Queues the packet for the TX task.
  * @param packet Packet to transmit
  * @param timeout Timout in ms
- * @return 1 if packet was successfully transmitted, 0 on error
+ * @return CSP_ERR_NONE if packet was queued, CSP_ERR_TX otherwise
  */
 int csp_zmqhub_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
 
+	zmq_driver_t * drv = interface->driver;
+
+	if (packet->length > interface->mtu) {
+		csp_log_warn("ZMQ: Packet too large: %u", packet->length);
+		return CSP_ERR_TX;
+	}
+
+	if (csp_queue_enqueue(drv->tx_queue, &packet, timeout) != CSP_QUEUE_OK) {
+		interface->drop++;
+		return CSP_ERR_TX;
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
+/* Called by ZMQ when the message data is no longer used */
+static void csp_zmqhub_free(void * data, void * hint) {
+	csp_buffer_free(hint);
+}
+
+static void csp_zmqhub_send(zmq_driver_t * drv, csp_packet_t * packet) {
+
 	/* Send envelope */
 	char satid = (char) csp_rtable_find_mac(packet->id.dst);
 	if (satid == (char) 255)
 		satid = packet->id.dst;
 
+	/* The envelope overwrites the length field */
 	uint16_t length = packet->length;
-	char * satidptr = ((char *) &packet->id) - 1;
-	memcpy(satidptr, &satid, 1);
-	int result = zmq_send(publisher, satidptr, length + sizeof(packet->id) + sizeof(char), 0);
-	if (result < 0)
-		csp_log_error("ZMQ send error: %u %s\r\n", result, strerror(result));
+	char * satidptr = csp_packet_push(packet, sizeof(satid));
+	*satidptr = satid;
+
+	/* Hand the buffer to ZMQ, it is freed once the message is sent */
+	zmq_msg_t msg;
+	if (zmq_msg_init_data(&msg, satidptr, length + ZMQHUB_HEADER, csp_zmqhub_free, packet) != 0) {
+		csp_log_error("ZMQ: %s", zmq_strerror(zmq_errno()));
+		csp_buffer_free(packet);
+		return;
+	}
+
+	if (zmq_msg_send(&msg, drv->publisher, 0) < 0) {
+		csp_log_error("ZMQ send error: %s", zmq_strerror(zmq_errno()));
+		drv->iface->tx_error++;
+		zmq_msg_close(&msg);
+	}
+
+}
 
-	csp_buffer_free(packet);
+CSP_DEFINE_TASK(csp_zmqhub_tx_task) {
 
-	return CSP_ERR_NONE;
+	zmq_driver_t * drv = param;
+	csp_packet_t * packet;
+
+	while(1) {
+		if (csp_queue_dequeue(drv->tx_queue, &packet, CSP_MAX_DELAY) != CSP_QUEUE_OK)
+			continue;
+
+		/* Send everything queued before blocking again */
+		do {
+			csp_zmqhub_send(drv, packet);
+		} while (csp_queue_dequeue(drv->tx_queue, &packet, 0) == CSP_QUEUE_OK);
+	}
+
+	return CSP_TASK_RETURN;
 
 }
 
 CSP_DEFINE_TASK(csp_zmqhub_task) {
 
+	zmq_driver_t * drv = param;
+	csp_packet_t * packet = NULL;
+	unsigned int mtu = 0;
+	char discard[ZMQHUB_HEADER];
+
 	while(1) {
-		zmq_msg_t msg;
-		assert(zmq_msg_init_size(&msg, 1024) == 0);
+		/* Reuse the packet from a rejected message, unless the MTU has changed */
+		if (packet != NULL && mtu != drv->iface->mtu) {
+			csp_buffer_free(packet);
+			packet = NULL;
+		}
+		if (packet == NULL) {
+			mtu = drv->iface->mtu;
+			packet = csp_buffer_get(mtu);
+		}
 
-		/* Receive data */
-		if (zmq_msg_recv(&msg, subscriber, 0) < 0) {
-			zmq_msg_close(&msg);
+		/* Receive directly into the packet, or drain the socket when out of buffers */
+		char * satidptr = (packet != NULL) ? csp_packet_push(packet, sizeof(char)) : discard;
+		int datalen = zmq_recv(drv->subscriber, satidptr, (packet != NULL) ? ZMQHUB_HEADER + mtu : sizeof(discard), 0);
+		if (datalen < 0) {
 			csp_log_error("ZMQ: %s", zmq_strerror(zmq_errno()));
 			continue;
 		}
 
-		int datalen = zmq_msg_size(&msg);
-		if (datalen < 5) {
+		if (packet == NULL) {
+			drv->iface->drop++;
+			continue;
+		}
+
+		if (datalen < (int) ZMQHUB_HEADER) {
 			csp_log_warn("ZMQ: Too short datalen: %u", datalen);
-			while(zmq_msg_recv(&msg, subscriber, ZMQ_NOBLOCK) > 0)
-			zmq_msg_close(&msg);
+			drv->iface->frame++;
 			continue;
 		}
 
-		/* Create new csp packet */
-		csp_packet_t * packet = csp_buffer_get(256);
-		if (packet == NULL) {
-			zmq_msg_close(&msg);
+		/* zmq_recv truncates and returns the full message length */
+		if (datalen > (int) (ZMQHUB_HEADER + mtu)) {
+			csp_log_warn("ZMQ: Too long datalen: %u", datalen);
+			drv->iface->frame++;
 			continue;
 		}
 
-		/* Copy the data from zmq to csp */
-		char * satidptr = ((char *) &packet->id) - 1;
-		memcpy(satidptr, zmq_msg_data(&msg), datalen);
-		packet->length = datalen - 4 - 1;
+		packet->length = datalen - ZMQHUB_HEADER;
 
-		/* Queue up packet to router */
-		csp_qfifo_write(packet, &csp_if_zmqhub, NULL);
+		/* Small packets move to a smaller buffer, and the MTU sized one is reused */
+		csp_packet_t * copy = csp_buffer_compact(packet);
+		if (copy != NULL) {
+			csp_qfifo_write(copy, drv->iface, NULL);
+			continue;
+		}
 
-		zmq_msg_close(&msg);
+		/* Queue up packet to router */
+		csp_qfifo_write(packet, drv->iface, NULL);
+		packet = NULL;
 	}
 
 	return CSP_TASK_RETURN;
 
 }
 
+static int csp_zmqhub_setup(csp_iface_t * iface, const char * name, const uint8_t rxfilter[], unsigned int rxfilter_count,
+		const char * publisher_endpoint, const char * subscriber_endpoint) {
+
+	void * ctx = csp_zmqhub_context();
+	if (ctx == NULL) {
+		csp_log_error("ZMQ: Failed to create context");
+		return CSP_ERR_DRIVER;
+	}
+
+	int ret;
+	zmq_driver_t * drv = csp_malloc(sizeof(*drv));
+	if (drv == NULL)
+		return CSP_ERR_NOMEM;
+	memset(drv, 0, sizeof(*drv));
+	drv->iface = iface;
+
+	csp_log_info("INIT %s to servers %s / %s\r\n", name, publisher_endpoint, subscriber_endpoint);
+
+	/* Publisher (TX) */
+	drv->publisher = zmq_socket(ctx, ZMQ_PUB);
+	if (drv->publisher == NULL || zmq_connect(drv->publisher, publisher_endpoint) != 0) {
+		csp_log_error("ZMQ: Failed to connect publisher %s: %s", publisher_endpoint, zmq_strerror(zmq_errno()));
+		goto err_driver;
+	}
+
+	/* Subscriber (RX) */
+	drv->subscriber = zmq_socket(ctx, ZMQ_SUB);
+	if (drv->subscriber == NULL || zmq_connect(drv->subscriber, subscriber_endpoint) != 0) {
+		csp_log_error("ZMQ: Failed to connect subscriber %s: %s", subscriber_endpoint, zmq_strerror(zmq_errno()));
+		goto err_driver;
+	}
+
+	/* Messages are prefixed with the destination address, no filter means all */
+	if (rxfilter == NULL || rxfilter_count == 0) {
+		if (zmq_setsockopt(drv->subscriber, ZMQ_SUBSCRIBE, "", 0) != 0)
+			goto err_driver;
+	} else {
+		for (unsigned int i = 0; i < rxfilter_count; i++) {
+			if (zmq_setsockopt(drv->subscriber, ZMQ_SUBSCRIBE, &rxfilter[i], 1) != 0)
+				goto err_driver;
+		}
+	}
+
+	/* TX queue */
+	drv->tx_queue = csp_queue_create(ZMQHUB_TX_QUEUE_SIZE, sizeof(csp_packet_t *));
+	if (drv->tx_queue == NULL) {
+		ret = CSP_ERR_NOMEM;
+		goto err;
+	}
+
+	iface->driver = drv;
+	iface->name = name;
+	iface->nexthop = csp_zmqhub_tx;
+	iface->mtu = ZMQHUB_MTU;
+
+	/* Start RX thread */
+	ret = csp_thread_create(csp_zmqhub_task, "ZMQ", 10000, drv, 0, &drv->rx_task);
+	csp_log_info("Task start %d\r\n", ret);
+
+	/* Start TX thread */
+	ret = csp_thread_create(csp_zmqhub_tx_task, "ZMQTX", 10000, drv, 0, &drv->tx_task);
+	csp_log_info("Task start %d\r\n", ret);
+
+	/* Regsiter interface */
+	csp_iflist_add(iface);
+
+	return CSP_ERR_NONE;
+
+err_driver:
+	ret = CSP_ERR_DRIVER;
+err:
+	if (drv->subscriber)
+		zmq_close(drv->subscriber);
+	if (drv->publisher)
+		zmq_close(drv->publisher);
+	csp_free(drv);
+	return ret;
+
+}
+
 int csp_zmqhub_init(char _addr, char * host) {
 	char url_pub[100];
 	char url_sub[100];
@@ -116,37 +307,30 @@ int csp_zmqhub_init(char _addr, char * host) {
 int csp_zmqhub_init_w_endpoints(char _addr, char * publisher_endpoint,
 		char * subscriber_endpoint) {
 
-	context = zmq_ctx_new();
-	assert(context);
+	uint8_t addr = _addr;
 
-	char addr = _addr;
+	/* Address 255 subscribes to all messages */
+	return csp_zmqhub_setup(&csp_if_zmqhub, csp_if_zmqhub.name, &addr, (addr == 255) ? 0 : 1,
+			publisher_endpoint, subscriber_endpoint);
 
-	csp_log_info("INIT ZMQ with addr %hhu to servers %s / %s\r\n", addr,
-		publisher_endpoint, subscriber_endpoint);
+}
 
-	/* Publisher (TX) */
-    publisher = zmq_socket(context, ZMQ_PUB);
-    assert(publisher);
-    assert(zmq_connect(publisher, publisher_endpoint) == 0);
+int csp_zmqhub_init_w_name_endpoints_rxfilter(const char * name, const uint8_t rxfilter[], unsigned int rxfilter_count,
+		const char * publisher_endpoint, const char * subscriber_endpoint, csp_iface_t ** iface) {
 
-    /* Subscriber (RX) */
-    subscriber = zmq_socket(context, ZMQ_SUB);
-    assert(subscriber);
-	assert(zmq_connect(subscriber, subscriber_endpoint) == 0);
+	csp_iface_t * ifc = csp_malloc(sizeof(*ifc));
+	if (ifc == NULL)
+		return CSP_ERR_NOMEM;
+	memset(ifc, 0, sizeof(*ifc));
 
-	if (addr == (char) 255) {
-		assert(zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0) == 0);
-	} else {
-		assert(zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, &addr, 1) == 0);
+	int ret = csp_zmqhub_setup(ifc, name, rxfilter, rxfilter_count, publisher_endpoint, subscriber_endpoint);
+	if (ret != CSP_ERR_NONE) {
+		csp_free(ifc);
+		return ret;
 	}
 
-	/* Start RX thread */
-	static csp_thread_handle_t handle_subscriber;
-	int ret = csp_thread_create(csp_zmqhub_task, "ZMQ", 10000, NULL, 0, &handle_subscriber);
-	csp_log_info("Task start %d\r\n", ret);
-
-	/* Regsiter interface */
-	csp_iflist_add(&csp_if_zmqhub);
+	if (iface)
+		*iface = ifc;
 
 	return CSP_ERR_NONE;
 
@@ -156,4 +340,5 @@ int csp_zmqhub_init_w_endpoints(char _addr, char * publisher_endpoint,
 csp_iface_t csp_if_zmqhub = {
 	.name = "ZMQHUB",
 	.nexthop = csp_zmqhub_tx,
+	.mtu = ZMQHUB_MTU,
 };
@@ -25,6 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_malloc.h>
 #include <csp/interfaces/csp_if_lo.h>
 
+#include "../csp_route.h"
+
 /* Local typedef for routing table */
 typedef struct __attribute__((__packed__)) csp_rtable_s {
 	uint8_t address;
@@ -215,6 +217,8 @@ int csp_rtable_set(uint8_t _address, uint8_t _netmask, csp_iface_t *ifc, uint8_t
 	entry->interface = ifc;
 	entry->mac = mac;
 
+	csp_rtable_changed();
+
 	return CSP_ERR_NONE;
 }
 
@@ -22,6 +22,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp.h>
 #include <stdio.h>
 
+#include "../csp_route.h"
+
 /* Local typedef for routing table */
 typedef struct __attribute__((__packed__)) csp_rtable_s {
 	csp_iface_t * interface;
@@ -67,10 +69,12 @@ uint8_t csp_rtable_find_mac(uint8_t id) {
 
 void csp_rtable_clear(void) {
 	memset(routes, 0, sizeof(routes[0]) * CSP_ROUTE_COUNT);
+	csp_rtable_changed();
 }
 
 void csp_route_table_load(uint8_t route_table_in[CSP_ROUTE_TABLE_SIZE]) {
 	memcpy(routes, route_table_in, sizeof(routes[0]) * CSP_ROUTE_COUNT);
+	csp_rtable_changed();
 }
 
 void csp_route_table_save(uint8_t route_table_out[CSP_ROUTE_TABLE_SIZE]) {
@@ -102,6 +106,8 @@ int csp_rtable_set(uint8_t node, uint8_t mask, csp_iface_t *ifc, uint8_t mac) {
 		return CSP_ERR_INVAL;
 	}
 
+	csp_rtable_changed();
+
 	return CSP_ERR_NONE;
 
 }
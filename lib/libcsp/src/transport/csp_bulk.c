@@ -0,0 +1,482 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * Rate-based bulk transport.
+ *
+ * The sender streams numbered segments at a fixed or probed rate on a plain
+ * connection, without waiting for acknowledgements. The receiver sends a
+ * report every interval with its delivery rate and a bitmap of the segments
+ * missing below the highest one received. The sender retransmits missing
+ * segments before new ones, unless the retransmission is still in flight.
+ * When all segments have been sent once the sender repeats an EOF every
+ * interval, so the receiver also reports the missing tail.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+#include <csp/arch/csp_time.h>
+#include <csp/arch/csp_malloc.h>
+#include "../csp_conn.h"
+
+/* Packet types */
+#define BULK_DATA	1
+#define BULK_EOF	2
+#define BULK_NACK	3
+
+/* Room left below the MTU for CRC32, HMAC and XTEA nonce */
+#define BULK_OPTIONS_MAX	16
+
+/* Report packets per interval, each with a bitmap of the MTU */
+#define BULK_NACK_PACKETS	4
+
+/* Recent retransmissions remembered by the sender */
+#define BULK_HISTORY		256
+
+/* Segments per interval in the first probe */
+#define BULK_PROBE_START	4
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t type;
+	uint32_t seq;			/* Segment number, or segment count in EOF */
+	uint32_t tx;			/* Packet counter of the sender */
+} bulk_data_t;
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t type;
+	uint16_t report;		/* Report number, same in all packets of a report */
+	uint32_t tx;			/* Highest packet counter received */
+	uint32_t rate;			/* Delivery rate in bytes per second */
+	uint16_t received;		/* Packets received since last report */
+	uint16_t lost;			/* Packets lost since last report */
+	uint32_t base;			/* First segment in bitmap */
+	uint16_t bits;			/* Segments in bitmap */
+	uint8_t map[0];			/* Bit set for each missing segment */
+} bulk_nack_t;
+
+typedef struct {
+	uint32_t seq;
+	uint32_t tx;
+} bulk_history_t;
+
+static inline int bulk_after(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) > 0;
+}
+
+static inline int bulk_test(const uint8_t * map, uint32_t seq) {
+	return map[seq / 8] & (1 << (seq % 8));
+}
+
+static inline void bulk_set(uint8_t * map, uint32_t seq) {
+	map[seq / 8] |= (1 << (seq % 8));
+}
+
+static inline void bulk_clear(uint8_t * map, uint32_t seq) {
+	map[seq / 8] &= ~(1 << (seq % 8));
+}
+
+static int bulk_send_header(csp_conn_t * conn, uint8_t type, uint32_t seq, uint32_t tx, csp_packet_t * packet, uint32_t timeout) {
+
+	bulk_data_t * header = (bulk_data_t *) packet->data;
+	header->type = type;
+	header->seq = csp_hton32(seq);
+	header->tx = csp_hton32(tx);
+
+	if (!csp_send(conn, packet, timeout)) {
+		csp_log_protocol("BULK: Send of %"PRIu32" failed", seq);
+		csp_buffer_free(packet);
+		return CSP_ERR_TX;
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
+int csp_bulk_send(csp_conn_t * conn, uint32_t segments, unsigned int size, uint32_t rate, uint32_t interval, uint32_t timeout, csp_bulk_read_t readfcn, void * data) {
+
+	if (conn == NULL || segments == 0 || size == 0 || interval == 0 || readfcn == NULL)
+		return CSP_ERR_INVAL;
+
+	/* Retransmission bitmap and history, padded so the history is aligned */
+	unsigned int map_size = ((segments + 31) / 32) * sizeof(uint32_t);
+	uint8_t * resend = csp_malloc(map_size + BULK_HISTORY * sizeof(bulk_history_t));
+	if (resend == NULL)
+		return CSP_ERR_NOMEM;
+	memset(resend, 0, map_size);
+	bulk_history_t * history = (bulk_history_t *) (resend + map_size);
+	unsigned int i;
+	for (i = 0; i < BULK_HISTORY; i++)
+		history[i].seq = UINT32_MAX;
+
+	/* A rate of zero is probed from a few segments per interval */
+	int probe = (rate == 0);
+	int startup = probe, plateau = 0, round_cut = 0;
+	uint32_t delivered_max = 0, round_delivered = 0, round_tx = 1;
+	uint32_t rate_min = (uint64_t) size * 1000 / interval;
+	if (rate_min == 0)
+		rate_min = 1;
+	if (probe)
+		rate = BULK_PROBE_START * rate_min;
+
+	uint32_t next = 0, rtx = segments, pending = 0, tx = 0;
+	uint32_t time_now = csp_get_ms();
+	uint32_t last_credit = time_now, last_report = time_now, next_eof = time_now;
+	uint16_t report = 0;
+	int have_report = 0;
+	int32_t credit = size;
+	int result = CSP_ERR_TIMEDOUT;
+
+	while (1) {
+
+		time_now = csp_get_ms();
+		if (time_now - last_report >= timeout) {
+			csp_log_warn("BULK: No report from node %u in %"PRIu32" ms", conn->idout.dst, timeout);
+			break;
+		}
+
+		/* Credit for the configured rate, with a burst of at most 20 ms */
+		int32_t burst = rate / 50 > size ? rate / 50 : size;
+		credit += (uint64_t) (time_now - last_credit) * rate / 1000;
+		if (credit > burst)
+			credit = burst;
+		last_credit = time_now;
+
+		uint32_t wait;
+		if (pending == 0 && next >= segments) {
+
+			/* Everything sent, ask for the missing tail */
+			if (!bulk_after(next_eof, time_now)) {
+				csp_packet_t * packet = csp_buffer_get(sizeof(bulk_data_t));
+				if (packet != NULL) {
+					packet->length = sizeof(bulk_data_t);
+					bulk_send_header(conn, BULK_EOF, segments, ++tx, packet, timeout);
+				}
+				next_eof = time_now + interval;
+			}
+			wait = next_eof - time_now;
+
+		} else if (credit > 0) {
+
+			/* Missing segments go before new ones */
+			uint32_t seq;
+			if (pending > 0) {
+				while (!bulk_test(resend, rtx))
+					rtx++;
+				seq = rtx;
+				bulk_clear(resend, seq);
+				pending--;
+				history[seq % BULK_HISTORY].seq = seq;
+				history[seq % BULK_HISTORY].tx = tx + 1;
+			} else {
+				seq = next++;
+			}
+
+			csp_packet_t * packet = csp_buffer_get(sizeof(bulk_data_t) + size);
+			if (packet == NULL) {
+				csp_log_warn("BULK: No buffer for segment %"PRIu32, seq);
+				result = CSP_ERR_NOBUFS;
+				break;
+			}
+
+			int length = readfcn(data, seq, packet->data + sizeof(bulk_data_t), size);
+			if (length < 0 || length > (int) size) {
+				csp_log_error("BULK: Failed to read segment %"PRIu32, seq);
+				csp_buffer_free(packet);
+				result = CSP_ERR_INVAL;
+				break;
+			}
+
+			/* A failed send is a lost segment, so carry on */
+			packet->length = sizeof(bulk_data_t) + length;
+			credit -= packet->length;
+			bulk_send_header(conn, BULK_DATA, seq, ++tx, packet, timeout);
+			wait = 0;
+
+		} else {
+			wait = ((uint64_t) -credit * 1000 + rate - 1) / rate;
+			if (wait == 0)
+				wait = 1;
+		}
+
+		/* Read reports until it is time to send */
+		csp_packet_t * packet = csp_read(conn, wait);
+		if (packet == NULL)
+			continue;
+
+		bulk_nack_t * nack = (bulk_nack_t *) packet->data;
+		if (packet->length < sizeof(bulk_nack_t) || nack->type != BULK_NACK) {
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		uint32_t tx_seen = csp_ntoh32(nack->tx);
+		uint32_t base = csp_ntoh32(nack->base);
+		uint16_t bits = csp_ntoh16(nack->bits);
+		if (bits > (packet->length - sizeof(bulk_nack_t)) * 8) {
+			csp_buffer_free(packet);
+			continue;
+		}
+		last_report = csp_get_ms();
+
+		if (base >= segments && bits == 0) {
+			csp_buffer_free(packet);
+			result = CSP_ERR_NONE;
+			break;
+		}
+
+		/* Queue missing segments, unless a retransmission is still on its way */
+		for (i = 0; i < bits; i++) {
+			if (!bulk_test(nack->map, i))
+				continue;
+			uint32_t seq = base + i;
+			if (seq >= next || bulk_test(resend, seq))
+				continue;
+			bulk_history_t * h = &history[seq % BULK_HISTORY];
+			if (h->seq == seq && bulk_after(h->tx, tx_seen))
+				continue;
+			bulk_set(resend, seq);
+			pending++;
+			if (seq < rtx || pending == 1)
+				rtx = seq;
+		}
+
+		/**
+		 * Probe the rate. A round ends when the receiver has seen the packet
+		 * sent at the start of it. Startup sends at twice the delivery rate
+		 * until it has not grown by a quarter for two rounds. Then the rate
+		 * grows by an eighth per round while there is new data to send. It
+		 * falls back to the delivery rate, once per round, when an eighth of
+		 * the packets in a report are lost.
+		 */
+		uint16_t this_report = csp_ntoh16(nack->report);
+		if (probe && (!have_report || this_report != report)) {
+			uint32_t received = csp_ntoh16(nack->received);
+			uint32_t lost = csp_ntoh16(nack->lost);
+			uint32_t delivered = csp_ntoh32(nack->rate);
+			if (received + lost > 0) {
+				if (delivered > round_delivered)
+					round_delivered = delivered;
+				if (lost * 8 > received + lost) {
+					if (!round_cut) {
+						rate = delivered > rate_min ? delivered : rate_min;
+						startup = 0;
+						round_cut = 1;
+					}
+				} else if (startup && next < segments && delivered < UINT32_MAX / 2 && rate < 2 * delivered) {
+					rate = 2 * delivered;
+				}
+			}
+			if (!bulk_after(round_tx, tx_seen)) {
+				if (next >= segments) {
+					/* Only retransmissions left, which do not fill the link */
+				} else if (startup) {
+					if (round_delivered > delivered_max / 4 * 5) {
+						delivered_max = round_delivered;
+						plateau = 0;
+					} else if (++plateau >= 2) {
+						rate = delivered_max > rate_min ? delivered_max : rate_min;
+						startup = 0;
+					}
+				} else if (!round_cut) {
+					rate = rate < UINT32_MAX - rate / 8 ? rate + rate / 8 : UINT32_MAX;
+				}
+				csp_log_protocol("BULK: Rate %"PRIu32" B/s, delivered %"PRIu32" B/s", rate, round_delivered);
+				round_tx = tx + 1;
+				round_delivered = 0;
+				round_cut = 0;
+			}
+		}
+		report = this_report;
+		have_report = 1;
+
+		csp_buffer_free(packet);
+
+	}
+
+	csp_free(resend);
+	return result;
+
+}
+
+static void bulk_send_report(csp_conn_t * conn, uint32_t segments, const uint8_t * map, uint32_t first, uint32_t limit,
+		uint16_t report, uint32_t tx_seen, uint32_t rate, uint32_t received, uint32_t lost, unsigned int map_max, uint32_t timeout) {
+
+	uint32_t pos = first;
+	int count;
+
+	for (count = 0; count < BULK_NACK_PACKETS; count++) {
+
+		/* Next missing segment below the limit, or the limit itself */
+		while (pos < limit && bulk_test(map, pos))
+			pos++;
+		if (count > 0 && pos >= limit)
+			break;
+
+		csp_packet_t * packet = csp_buffer_get(sizeof(bulk_nack_t) + map_max);
+		if (packet == NULL)
+			return;
+
+		bulk_nack_t * nack = (bulk_nack_t *) packet->data;
+		nack->type = BULK_NACK;
+		nack->report = csp_hton16(report);
+		nack->tx = csp_hton32(tx_seen);
+		nack->rate = csp_hton32(rate);
+		nack->received = csp_hton16(received > UINT16_MAX ? UINT16_MAX : received);
+		nack->lost = csp_hton16(lost > UINT16_MAX ? UINT16_MAX : lost);
+		nack->base = csp_hton32(pos < limit ? pos : (limit >= segments ? segments : limit));
+
+		/* Bitmap up to the last missing segment that fits */
+		unsigned int bits = 0, i;
+		memset(nack->map, 0, map_max);
+		for (i = 0; pos + i < limit && i < map_max * 8; i++) {
+			if (!bulk_test(map, pos + i)) {
+				bulk_set(nack->map, i);
+				bits = i + 1;
+			}
+		}
+		nack->bits = csp_hton16(bits);
+		packet->length = sizeof(bulk_nack_t) + (bits + 7) / 8;
+		pos += bits;
+
+		if (!csp_send(conn, packet, timeout))
+			csp_buffer_free(packet);
+
+	}
+
+}
+
+int csp_bulk_recv(csp_conn_t * conn, uint32_t segments, uint8_t * map, uint32_t interval, uint32_t timeout, csp_bulk_write_t writefcn, void * data) {
+
+	if (conn == NULL || segments == 0 || map == NULL || interval == 0 || writefcn == NULL)
+		return CSP_ERR_INVAL;
+
+	int mtu = csp_rtable_find_mtu(conn->idout.dst) - (int) sizeof(bulk_nack_t) - BULK_OPTIONS_MAX;
+	if (mtu <= 0)
+		return CSP_ERR_INVAL;
+	unsigned int map_max = mtu < UINT16_MAX / 8 ? mtu : UINT16_MAX / 8;
+
+	/* Segments already in the map, from an earlier transfer */
+	uint32_t done = 0, first = segments, seq;
+	for (seq = 0; seq < segments; seq++) {
+		if (bulk_test(map, seq))
+			done++;
+		else if (first == segments)
+			first = seq;
+	}
+
+	uint32_t limit = 0, tx_seen = 0, tx_last = 0, received = 0, bytes = 0;
+	int have_tx = 0;
+	uint16_t report = 0;
+	uint32_t time_now = csp_get_ms();
+	uint32_t last_rx = time_now, last_report = time_now, next_report = time_now + interval;
+	int send_report = (done == segments);
+
+	while (1) {
+
+		if (send_report || !bulk_after(next_report, time_now)) {
+
+			/* Delivery rate and loss since the last report */
+			uint32_t elapsed = time_now - last_report;
+			uint32_t rate = elapsed ? (uint64_t) bytes * 1000 / elapsed : 0;
+			uint32_t span = have_tx ? tx_seen - tx_last : 0;
+			uint32_t lost = span > received ? span - received : 0;
+
+			bulk_send_report(conn, segments, map, first, done == segments ? segments : limit,
+					report++, tx_seen, rate, received, lost, map_max, timeout);
+
+			tx_last = tx_seen;
+			received = 0;
+			bytes = 0;
+			last_report = time_now;
+			next_report = time_now + interval;
+			send_report = 0;
+		}
+
+		/* Once complete, linger until the sender has been quiet for two intervals */
+		if (done == segments) {
+			if (time_now - last_rx >= 2 * interval)
+				return CSP_ERR_NONE;
+		} else if (time_now - last_rx >= timeout) {
+			csp_log_warn("BULK: No data from node %u in %"PRIu32" ms, %"PRIu32" of %"PRIu32" segments", conn->idout.dst, timeout, done, segments);
+			return CSP_ERR_TIMEDOUT;
+		}
+
+		csp_packet_t * packet = csp_read(conn, next_report - time_now);
+		time_now = csp_get_ms();
+		if (packet == NULL)
+			continue;
+
+		bulk_data_t * header = (bulk_data_t *) packet->data;
+		if (packet->length < sizeof(bulk_data_t) || (header->type != BULK_DATA && header->type != BULK_EOF)) {
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		last_rx = time_now;
+		uint32_t tx = csp_ntoh32(header->tx);
+		if (!have_tx || bulk_after(tx, tx_seen)) {
+			if (!have_tx)
+				tx_last = tx - 1;
+			tx_seen = tx;
+			have_tx = 1;
+		}
+		received++;
+
+		if (header->type == BULK_EOF) {
+			/* Everything has been sent, so report the tail now */
+			limit = segments;
+			send_report = 1;
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		seq = csp_ntoh32(header->seq);
+		bytes += packet->length;
+		if (seq >= segments) {
+			csp_buffer_free(packet);
+			continue;
+		}
+		if (seq >= limit)
+			limit = seq + 1;
+
+		if (!bulk_test(map, seq)) {
+			if (writefcn(data, seq, packet->data + sizeof(bulk_data_t), packet->length - sizeof(bulk_data_t)) < 0) {
+				csp_log_error("BULK: Failed to write segment %"PRIu32, seq);
+				csp_buffer_free(packet);
+				return CSP_ERR_INVAL;
+			}
+			bulk_set(map, seq);
+			done++;
+			while (first < segments && bulk_test(map, first))
+				first++;
+			if (done == segments) {
+				csp_log_protocol("BULK: Complete, %"PRIu32" segments", segments);
+				send_report = 1;
+			}
+		}
+
+		csp_buffer_free(packet);
+
+	}
+
+}
@@ -41,6 +41,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "../csp_conn.h"
 #include "../csp_io.h"
 #include "csp_transport.h"
+#include "../crypto/csp_hmac.h"
 
 #ifdef CSP_USE_RDP
 
@@ -49,22 +50,50 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define RDP_EAK 0x04
 #define RDP_RST	0x08
 
+/* Options offered in the SYN and accepted in the SYN/ACK */
+#define RDP_OPT_SACK	0x01	// EACKs carry a bitmap instead of a list
+#define RDP_OPT_RTT	0x02	// Delayed ACKs wait at most a quarter of the RTT
+#define RDP_OPTIONS	(RDP_OPT_SACK | RDP_OPT_RTT)	// Options supported
+
+/* Length of the SYN data, fast open data follows it */
+#define RDP_SYN_LENGTH	(7 * sizeof(uint32_t))
+
+/* Segments EACKed after a missing segment before it is retransmitted */
+#define RDP_DUPTHRESH	3
+
+/* Lower bound for the retransmission timeout in ms, above timer resolution */
+#define RDP_RTO_MIN	20
+
+/* Retransmission timeout in ms until the RTT is measured, as in RFC 6298 */
+#define RDP_RTO_INIT	1000
+
 static uint32_t csp_rdp_window_size = 4;
 static uint32_t csp_rdp_conn_timeout = 10000;
 static uint32_t csp_rdp_packet_timeout = 1000;
 static uint32_t csp_rdp_delayed_acks = 1;
 static uint32_t csp_rdp_ack_timeout = 1000 / 4;
 static uint32_t csp_rdp_ack_delay_count = 4 / 2;
+static uint32_t csp_rdp_suspend_grace = 0;
 
-/* Used for queue calls */
-static CSP_BASE_TYPE pdTrue = 1;
+/* Fast open SYN accepted by this node */
+typedef struct {
+	uint8_t used;		// Entry holds a SYN
+	uint8_t src;		// Source address
+	uint8_t sport;		// Source port
+	uint8_t dport;		// Destination port
+	uint16_t seq_nr;	// Initial sequence number of the peer
+	uint32_t expires;	// Time a duplicate can no longer arrive
+} rdp_syn_entry_t;
+
+static rdp_syn_entry_t csp_rdp_syn_cache[CSP_RDP_SYN_CACHE];
 
 typedef struct __attribute__((__packed__)) {
 	/* The timestamp is placed in the padding bytes */
 	uint8_t padding[CSP_PADDING_BYTES - 2 * sizeof(uint32_t)];
-	uint32_t quarantine;	// EACK quarantine period
+	uint32_t quarantine;	// EACK quarantine period, zero until retransmitted
 	uint32_t timestamp;	// Time the message was sent
-	uint16_t length;	// Length field must be just before CSP ID
+	uint16_t length;	// Length of data
+	uint8_t headroom[CSP_PACKET_HEADROOM];	// Link header room
 	csp_id_t id;		// CSP id must be just before data
 	uint8_t data[];		// This just points to the rest of the buffer, without a size indication.
 } rdp_packet_t;
@@ -100,16 +129,14 @@ typedef struct __attribute__((__packed__)) {
  * information that needs to be appended to all data packets.
  */
 static rdp_header_t * csp_rdp_header_add(csp_packet_t * packet) {
-	rdp_header_t * header = (rdp_header_t *) &packet->data[packet->length];
-	packet->length += sizeof(rdp_header_t);
-	memset(header, 0, sizeof(rdp_header_t));
+	rdp_header_t * header = csp_packet_put(packet, sizeof(rdp_header_t));
+	if (header != NULL)
+		memset(header, 0, sizeof(rdp_header_t));
 	return header;
 }
 
 static rdp_header_t * csp_rdp_header_remove(csp_packet_t * packet) {
-	rdp_header_t * header = (rdp_header_t *) &packet->data[packet->length-sizeof(rdp_header_t)];
-	packet->length -= sizeof(rdp_header_t);
-	return header;
+	return csp_packet_trim(packet, sizeof(rdp_header_t));
 }
 
 static rdp_header_t * csp_rdp_header_ref(csp_packet_t * packet) {
@@ -149,6 +176,144 @@ static inline int csp_rdp_time_after(uint32_t time, uint32_t cmp) {
 	return csp_rdp_time_before(cmp, time);
 }
 
+/* Window slots for a sequence number */
+static inline csp_packet_t ** csp_rdp_tx_slot(csp_conn_t * conn, uint16_t seq) {
+	return &conn->rdp.tx_window[seq & (CSP_RDP_TX_SLOTS - 1)];
+}
+
+static inline csp_packet_t ** csp_rdp_rx_slot(csp_conn_t * conn, uint16_t seq) {
+	return &conn->rdp.rx_window[seq & (CSP_RDP_RX_SLOTS - 1)];
+}
+
+/* Return unacknowledged segment with sequence number, or NULL. TX segments
+ * keep their header in network byte order. */
+static rdp_packet_t * csp_rdp_tx_get(csp_conn_t * conn, uint16_t seq) {
+	csp_packet_t * packet = *csp_rdp_tx_slot(conn, seq);
+	if (packet == NULL || csp_ntoh16(csp_rdp_header_ref(packet)->seq_nr) != seq)
+		return NULL;
+	return (rdp_packet_t *) packet;
+}
+
+/* Add segment to TX window, fails if the slot holds an unacknowledged segment */
+static int csp_rdp_tx_add(csp_conn_t * conn, rdp_packet_t * packet, uint16_t seq) {
+	csp_packet_t ** slot = csp_rdp_tx_slot(conn, seq);
+	if (*slot != NULL)
+		return CSP_ERR_NOBUFS;
+	*slot = (csp_packet_t *) packet;
+	return CSP_ERR_NONE;
+}
+
+static void csp_rdp_tx_free(csp_conn_t * conn, uint16_t seq) {
+	csp_packet_t ** slot = csp_rdp_tx_slot(conn, seq);
+	if (*slot != NULL && csp_ntoh16(csp_rdp_header_ref(*slot)->seq_nr) == seq) {
+		csp_log_protocol("TX Element %u freed", seq);
+		csp_buffer_free(*slot);
+		*slot = NULL;
+	}
+}
+
+/* Return segment received out of order with sequence number, or NULL. RX
+ * segments have their header in host byte order. */
+static csp_packet_t * csp_rdp_rx_get(csp_conn_t * conn, uint16_t seq) {
+	csp_packet_t * packet = *csp_rdp_rx_slot(conn, seq);
+	if (packet == NULL || csp_rdp_header_ref(packet)->seq_nr != seq)
+		return NULL;
+	return packet;
+}
+
+/* Largest window the TX and RX windows and the connection RX queues can hold.
+ * ACKs are only sent while a queue has room for twice the window. */
+static inline uint32_t csp_rdp_window_limit(uint32_t window_size) {
+	uint32_t max = CSP_RDP_MAX_WINDOW;
+	if (max > (CSP_RX_QUEUE_LENGTH - 1) / 2)
+		max = (CSP_RX_QUEUE_LENGTH - 1) / 2;
+	return window_size < max ? window_size : max;
+}
+
+/**
+ * ROUND-TRIP TIME
+ * The RTT is estimated from acknowledged segments as in RFC 6298, and
+ * segments that were retransmitted are not sampled (Karn's algorithm).
+ * srtt and rttvar are kept in 1/8 ms. The retransmission timeout adapts
+ * between RDP_RTO_MIN and the negotiated packet timeout, and the delayed
+ * ACK timeout and count adapt to the RTT and window within their
+ * negotiated values. The RTO only relies on the adapted ACK timeout of the
+ * other end if it advertised RDP_OPT_RTT, otherwise it waits at least the
+ * negotiated ACK timeout.
+ */
+
+/* Delayed ACKs wait at most a quarter of the RTT */
+static inline uint32_t csp_rdp_ack_delay(csp_conn_t * conn) {
+	uint32_t timeout = conn->rdp.srtt / 8 / 4;
+	if (conn->rdp.srtt == 0 || timeout > conn->rdp.ack_timeout)
+		return conn->rdp.ack_timeout;
+	return timeout;
+}
+
+/* Delayed ACKs cover at most a quarter window, so the sender keeps sending */
+static inline uint32_t csp_rdp_ack_count(csp_conn_t * conn) {
+	uint32_t count = conn->rdp.window_size / 4;
+	return count < conn->rdp.ack_delay_count ? count : conn->rdp.ack_delay_count;
+}
+
+/* Set the retransmission timeout from the RTT estimate, without back-off */
+static void csp_rdp_rto_update(csp_conn_t * conn) {
+
+	if (conn->rdp.srtt == 0) {
+		conn->rdp.rto = conn->rdp.packet_timeout < RDP_RTO_INIT ? conn->rdp.packet_timeout : RDP_RTO_INIT;
+		return;
+	}
+
+	/* The variance term also covers the delayed ACK of the other end */
+	uint32_t var = 4 * conn->rdp.rttvar;
+	int adaptive = conn->rdp.options & RDP_OPT_RTT;
+	if (conn->rdp.delayed_acks && adaptive && var < csp_rdp_ack_delay(conn) * 8)
+		var = csp_rdp_ack_delay(conn) * 8;
+	uint32_t rto = (conn->rdp.srtt + var) / 8;
+	if (rto < RDP_RTO_MIN)
+		rto = RDP_RTO_MIN;
+	if (conn->rdp.delayed_acks && !adaptive && rto < conn->rdp.ack_timeout)
+		rto = conn->rdp.ack_timeout;
+	conn->rdp.rto = rto < conn->rdp.packet_timeout ? rto : conn->rdp.packet_timeout;
+
+}
+
+static void csp_rdp_rtt_init(csp_conn_t * conn) {
+	conn->rdp.srtt = 0;
+	conn->rdp.rttvar = 0;
+	conn->rdp.retransmits = 0;
+	conn->rdp.fast_retransmits = 0;
+	conn->rdp.suspends = 0;
+	csp_rdp_rto_update(conn);
+}
+
+/* Sample the RTT of a segment sent at time sent, and never retransmitted */
+static void csp_rdp_rtt_sample(csp_conn_t * conn, uint32_t sent) {
+
+	int32_t rtt = (csp_get_ms() - sent) * 8;
+
+	if (conn->rdp.srtt == 0) {
+		conn->rdp.srtt = rtt > 0 ? rtt : 1;
+		conn->rdp.rttvar = rtt / 2;
+	} else {
+		int32_t delta = rtt - (int32_t) conn->rdp.srtt;
+		conn->rdp.rttvar += ((delta < 0 ? -delta : delta) - (int32_t) conn->rdp.rttvar) / 4;
+		conn->rdp.srtt += delta / 8;
+		if (conn->rdp.srtt == 0)
+			conn->rdp.srtt = 1;
+	}
+
+	csp_rdp_rto_update(conn);
+
+}
+
+/* Back off the retransmission timeout after a timeout */
+static void csp_rdp_rto_backoff(csp_conn_t * conn) {
+	conn->rdp.rto *= 2;
+	if (conn->rdp.rto > conn->rdp.packet_timeout)
+		conn->rdp.rto = conn->rdp.packet_timeout;
+}
+
 /**
  * CONTROL MESSAGES
  * The following function is used to send empty messages,
@@ -168,6 +333,11 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 
 	/* Add RDP header */
 	rdp_header_t * header = csp_rdp_header_add(packet);
+	if (header == NULL) {
+		csp_log_error("No room for RDP header");
+		csp_buffer_free(packet);
+		return CSP_ERR_NOBUFS;
+	}
 	header->seq_nr = csp_hton16(seq_nr);
 	header->ack_nr = csp_hton16(ack_nr);
 	header->ack = (flags & RDP_ACK) ? 1 : 0;
@@ -175,13 +345,16 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 	header->syn = (flags & RDP_SYN) ? 1 : 0;
 	header->rst = (flags & RDP_RST) ? 1 : 0;
 
-	/* Send copy to tx_queue, before sending packet to IF */
+	/* Send copy to TX window, before sending packet to IF */
 	if (flags & RDP_SYN) {
 		rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
 		rdp_packet->timestamp = csp_get_ms();
-		if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK)
+		rdp_packet->quarantine = 0;
+		if (csp_rdp_tx_add(conn, rdp_packet, seq_nr) != CSP_ERR_NONE)
 			csp_buffer_free(rdp_packet);
+		else
+			csp_conn_timer_set(conn, rdp_packet->timestamp + conn->rdp.rto);
 	}
 
 	/* Send control messages with high priority */
@@ -208,35 +381,42 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 
 /**
  * EXTENDED ACKNOWLEDGEMENTS
- * The following function sends an extended ACK packet
+ * The following function sends an extended ACK packet. With the SACK option
+ * the data is a bitmap, where bit i (LSB first) is set if segment
+ * ack_nr + 2 + i was received out of order. Otherwise it is a list of
+ * sequence numbers.
  */
 static int csp_rdp_send_eack(csp_conn_t * conn) {
 
-	/* Allocate message */
-	csp_packet_t * packet_eack = csp_buffer_get(100);
+	/* Allocate message, smaller if the buffers cannot hold a list for the whole window */
+	int size = (conn->rdp.options & RDP_OPT_SACK) ? CSP_RDP_RX_SLOTS / 8 : CSP_RDP_RX_SLOTS * sizeof(uint16_t);
+	int max = csp_buffer_size() - (int) CSP_BUFFER_PACKET_OVERHEAD - (int) sizeof(rdp_header_t);
+	csp_packet_t * packet_eack = csp_buffer_get(size < max ? size : max);
 	if (packet_eack == NULL) return CSP_ERR_NOMEM;
 	packet_eack->length = 0;
 
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
+	/* Room for EACK data, leaving space for the RDP header */
+	max = csp_packet_tailroom(packet_eack) - (int) sizeof(rdp_header_t);
 
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue deliver");
-			break;
+	/* Add the segments received out of order, in sequence */
+	uint16_t base = conn->rdp.rcv_cur + 2;
+	unsigned int i;
+	for (i = 0; i < CSP_RDP_RX_SLOTS - 1; i++) {
+		if (csp_rdp_rx_get(conn, base + i) == NULL)
+			continue;
+		if (conn->rdp.options & RDP_OPT_SACK) {
+			if ((int) i / 8 >= max)
+				break;
+			while (packet_eack->length <= i / 8)
+				packet_eack->data[packet_eack->length++] = 0;
+			packet_eack->data[i / 8] |= 1 << (i % 8);
+		} else {
+			if (packet_eack->length + (int) sizeof(uint16_t) > max)
+				break;
+			packet_eack->data16[packet_eack->length/sizeof(uint16_t)] = csp_hton16(base + i);
+			packet_eack->length += sizeof(uint16_t);
 		}
-
-		/* Add seq nr to EACK packet */
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		packet_eack->data16[packet_eack->length/sizeof(uint16_t)] = csp_hton16(header->seq_nr);
-		packet_eack->length += sizeof(uint16_t);
-		csp_log_protocol("Added EACK nr %u", header->seq_nr);
-
-		/* Requeue */
-		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-
+		csp_log_protocol("Added EACK nr %u", (uint16_t)(base + i));
 	}
 
 	return csp_rdp_send_cmp(conn, packet_eack, RDP_ACK | RDP_EAK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
@@ -246,24 +426,134 @@ static int csp_rdp_send_eack(csp_conn_t * conn) {
 
 /**
  * SYN Packet
- * The following function sends a SYN packet
+ * The following function sends a SYN packet with the connection options.
+ * The SYN/ACK carries the options accepted by the receiver. Peers without
+ * options ignore the last word, and send a SYN/ACK without data.
  */
-static int csp_rdp_send_syn(csp_conn_t * conn) {
+static void csp_rdp_syn_options(csp_conn_t * conn, csp_packet_t * packet) {
+	packet->data32[0] = csp_hton32(conn->rdp.window_size);
+	packet->data32[1] = csp_hton32(conn->rdp.conn_timeout);
+	packet->data32[2] = csp_hton32(conn->rdp.packet_timeout);
+	packet->data32[3] = csp_hton32(conn->rdp.delayed_acks);
+	packet->data32[4] = csp_hton32(conn->rdp.ack_timeout);
+	packet->data32[5] = csp_hton32(conn->rdp.ack_delay_count);
+	packet->data32[6] = csp_hton32(conn->rdp.options);
+}
+
+static int csp_rdp_send_syn(csp_conn_t * conn, int flags, int seq_nr, int ack_nr) {
 
 	/* Allocate message */
 	csp_packet_t * packet = csp_buffer_get(100);
 	if (packet == NULL) return CSP_ERR_NOMEM;
 
 	/* Generate contents */
-	packet->data32[0] = csp_hton32(csp_rdp_window_size);
-	packet->data32[1] = csp_hton32(csp_rdp_conn_timeout);
-	packet->data32[2] = csp_hton32(csp_rdp_packet_timeout);
-	packet->data32[3] = csp_hton32(csp_rdp_delayed_acks);
-	packet->data32[4] = csp_hton32(csp_rdp_ack_timeout);
-	packet->data32[5] = csp_hton32(csp_rdp_ack_delay_count);
-	packet->length = 6 * sizeof(uint32_t);
+	csp_rdp_syn_options(conn, packet);
+	packet->length = RDP_SYN_LENGTH;
+
+	return csp_rdp_send_cmp(conn, packet, flags, seq_nr, ack_nr);
 
-	return csp_rdp_send_cmp(conn, packet, RDP_SYN, conn->rdp.snd_iss, 0);
+}
+
+/* Bytes csp_send_direct appends to every packet of the connection */
+static unsigned int csp_rdp_trailer_length(csp_conn_t * conn) {
+	unsigned int length = 0;
+	if (conn->idout.flags & CSP_FHMAC)
+		length += CSP_HMAC_LENGTH;
+	if (conn->idout.flags & CSP_FCRC32)
+		length += sizeof(uint32_t);
+	if (conn->idout.flags & CSP_FXTEA)
+		length += sizeof(uint32_t);
+	return length;
+}
+
+/**
+ * FAST OPEN
+ * The first segment of a fast open connection is sent in the SYN, after the
+ * options, and takes the sequence number after the SYN. A copy is kept in
+ * the TX window, but only the SYN is retransmitted until the connection is
+ * open. If the other end does not accept the data, the SYN/ACK only
+ * acknowledges the SYN, and the segment is sent again at once.
+ * The receiver delivers the data of a SYN only once, even if the SYN is
+ * duplicated after the connection is closed, by remembering the SYN for
+ * twice the connection timeout. The data of other SYNs is refused while
+ * the cache is full.
+ */
+static int csp_rdp_send_fast_open(csp_conn_t * conn, csp_packet_t * packet) {
+
+	uint16_t seq_nr = conn->rdp.snd_iss + 1;
+	uint16_t length = packet->length;
+
+	/* Keep the segment in the TX window, as if sent after the SYN */
+	rdp_header_t * header = csp_rdp_header_add(packet);
+	header->seq_nr = csp_hton16(seq_nr);
+	header->ack = 1;
+	rdp_packet_t * segment = csp_buffer_clone(packet);
+	csp_rdp_header_remove(packet);
+	if (segment == NULL) {
+		csp_log_error("Failed to allocate packet buffer");
+		return CSP_ERR_NOMEM;
+	}
+
+	/* The packet becomes the SYN, with the options in front of the data */
+	memmove(&packet->data[RDP_SYN_LENGTH], packet->data, length);
+	csp_rdp_syn_options(conn, packet);
+	packet->length = RDP_SYN_LENGTH + length;
+	header = csp_rdp_header_add(packet);
+	header->seq_nr = csp_hton16(conn->rdp.snd_iss);
+	header->syn = 1;
+	rdp_packet_t * syn = csp_buffer_clone(packet);
+	if (syn == NULL) {
+		csp_log_error("Failed to allocate packet buffer");
+		csp_buffer_free(segment);
+		return CSP_ERR_NOMEM;
+	}
+
+	syn->timestamp = segment->timestamp = csp_get_ms();
+	syn->quarantine = segment->quarantine = 0;
+	csp_rdp_tx_add(conn, syn, conn->rdp.snd_iss);
+	csp_rdp_tx_add(conn, segment, seq_nr);
+	csp_conn_timer_set(conn, syn->timestamp + conn->rdp.rto);
+	conn->rdp.snd_nxt = seq_nr + 1;
+
+	csp_log_protocol("RDP: AC: Sending SYN with %u bytes of data", length);
+	return CSP_ERR_NONE;
+
+}
+
+/* Remember a fast open SYN, fails if it was seen before or the cache is full */
+static int csp_rdp_syn_cache_add(csp_packet_t * packet, uint16_t seq_nr, uint32_t conn_timeout) {
+
+	uint32_t time_now = csp_get_ms();
+	rdp_syn_entry_t * unused = NULL;
+	int i;
+
+	for (i = 0; i < CSP_RDP_SYN_CACHE; i++) {
+		rdp_syn_entry_t * entry = &csp_rdp_syn_cache[i];
+
+		/* Release expired entries, so they are not taken as live once the clock wraps */
+		if (entry->used && !csp_rdp_time_before(time_now, entry->expires))
+			entry->used = 0;
+
+		if (!entry->used) {
+			if (unused == NULL)
+				unused = entry;
+			continue;
+		}
+		if (entry->src == packet->id.src && entry->sport == packet->id.sport &&
+				entry->dport == packet->id.dport && entry->seq_nr == seq_nr)
+			return CSP_ERR_ALREADY;
+	}
+
+	if (unused == NULL)
+		return CSP_ERR_NOBUFS;
+
+	unused->used = 1;
+	unused->src = packet->id.src;
+	unused->sport = packet->id.sport;
+	unused->dport = packet->id.dport;
+	unused->seq_nr = seq_nr;
+	unused->expires = time_now + 2 * conn_timeout;
+	return CSP_ERR_NONE;
 
 }
 
@@ -298,120 +588,114 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 
 }
 
-static inline void csp_rdp_rx_queue_flush(csp_conn_t * conn) {
+/* Deliver segments received out of order that are now in sequence */
+static inline void csp_rdp_rx_window_flush(csp_conn_t * conn) {
 
-	/* Loop through RX queue */
-	int i, count;
 	csp_packet_t * packet;
 
-front:
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
-
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue deliver");
-			break;
-		}
-
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		csp_log_protocol("RX Queue deliver matching Element, seq %u", header->seq_nr);
-
-		/* If the matching packet was found: */
-		if (header->seq_nr == (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			csp_log_protocol("Deliver seq %u", header->seq_nr);
-			csp_rdp_receive_data(conn, packet);
-			conn->rdp.rcv_cur++;
-			/* Loop from first element again */
-			goto front;
-
-		/* Otherwise, requeue */
-		} else {
-			csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-		}
-
+	while ((packet = csp_rdp_rx_get(conn, conn->rdp.rcv_cur + 1)) != NULL) {
+		*csp_rdp_rx_slot(conn, conn->rdp.rcv_cur + 1) = NULL;
+		csp_log_protocol("Deliver seq %u", conn->rdp.rcv_cur + 1);
+		if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE)
+			csp_buffer_free(packet);
+		conn->rdp.rcv_cur++;
 	}
 
 }
 
-static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
+static inline int csp_rdp_rx_window_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
 
-	/* Loop through RX queue */
-	int i, count;
-	rdp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
+	/* Duplicate, or the slot is taken by a segment beyond our window */
+	csp_packet_t ** slot = csp_rdp_rx_slot(conn, seq_nr);
+	if (*slot != NULL)
+		return CSP_ERR_NOBUFS;
+	*slot = packet;
+	return CSP_ERR_NONE;
 
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue exists");
-			break;
-		}
+}
 
-		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
+/* Send a copy of a segment again, with the latest outgoing ACK */
+static void csp_rdp_retransmit(csp_conn_t * conn, rdp_packet_t * packet) {
 
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("RX Queue exists matching Element, seq %u", header->seq_nr);
+	rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
+	header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
 
-		/* If the matching packet was found, deliver */
-		if (header->seq_nr == seq_nr) {
-			csp_log_protocol("We have a match");
-			return true;
-		}
+	/* Quarantine the segment for an RTO, which also marks it as retransmitted */
+	packet->timestamp = csp_get_ms();
+	packet->quarantine = (packet->timestamp + conn->rdp.rto) | 1;
 
+	csp_packet_t * new_packet = csp_buffer_clone(packet);
+	if (new_packet == NULL) {
+		csp_log_warn("Retransmission failed, no buffer");
+		return;
+	}
+	csp_iface_t * ifout = csp_rtable_find_iface(conn->idout.dst);
+	if (csp_send_direct(conn->idout, new_packet, ifout, 0) != CSP_ERR_NONE) {
+		csp_log_warn("Retransmission failed");
+		csp_buffer_free(new_packet);
 	}
-
-	return false;
 
 }
 
-static inline int csp_rdp_rx_queue_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
-
-	if (csp_rdp_seq_in_rx_queue(conn, seq_nr))
-		return CSP_QUEUE_ERROR;
-	return csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-
+/* Free a segment received by the other end. If it was never retransmitted,
+ * its send time is stored for an RTT sample, otherwise any earlier one is
+ * cleared, so the newest segment is sampled. */
+static inline void csp_rdp_tx_eack(csp_conn_t * conn, uint16_t seq_nr, int * sampled, uint32_t * sent) {
+	rdp_packet_t * packet;
+	if (!csp_rdp_seq_between(seq_nr, conn->rdp.snd_una, conn->rdp.snd_nxt - 1))
+		return;
+	if ((packet = csp_rdp_tx_get(conn, seq_nr)) == NULL)
+		return;
+	*sampled = (packet->quarantine == 0);
+	*sent = packet->timestamp;
+	csp_rdp_tx_free(conn, seq_nr);
 }
 
 static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 
-	/* Loop through TX queue */
-	int i, j, count;
-	rdp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.tx_queue);
-	for (i = 0; i < count; i++) {
+	unsigned int j, count = eack_packet->length - sizeof(rdp_header_t);
+	uint16_t seq_nr;
+	uint32_t sent = 0;
+	int sampled = 0;
+
+	/* Free the segments received by the other end, in sequence */
+	if (conn->rdp.options & RDP_OPT_SACK) {
+		uint16_t base = csp_rdp_header_ref(eack_packet)->ack_nr + 2;
+		for (j = 0; j < count * 8; j++)
+			if (eack_packet->data[j / 8] & (1 << (j % 8)))
+				csp_rdp_tx_eack(conn, base + j, &sampled, &sent);
+	} else {
+		for (j = 0; j < count / sizeof(uint16_t); j++)
+			csp_rdp_tx_eack(conn, csp_ntoh16(eack_packet->data16[j]), &sampled, &sent);
+	}
 
-		if (csp_queue_dequeue(conn->rdp.tx_queue, &packet, 0) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from tx_queue in flush EACK");
-			break;
-		}
+	/* Sample the RTT of the newest segment */
+	if (sampled)
+		csp_rdp_rtt_sample(conn, sent);
 
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("EACK compare element, time %u, seq %u", packet->timestamp, csp_ntoh16(header->seq_nr));
-
-		/* Look for this element in EACKs */
-		int match = 0;
-		for (j = 0; j < (int)((eack_packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t)); j++) {
-			if (csp_ntoh16(eack_packet->data16[j]) == csp_ntoh16(header->seq_nr))
-				match = 1;
-
-			/* Enable this if you want EACK's to trigger retransmission */
-			if (csp_ntoh16(eack_packet->data16[j]) > csp_ntoh16(header->seq_nr)) {
-				uint32_t time_now = csp_get_ms();
-				if (csp_rdp_time_after(time_now, packet->quarantine)) {
-					packet->timestamp = time_now - conn->rdp.packet_timeout - 1;
-					packet->quarantine = time_now +	conn->rdp.packet_timeout / 2;
-				}
-			}
+	/* Fast retransmit: a segment is lost when RDP_DUPTHRESH later segments
+	 * are EACKed, or when all later segments are EACKed, so no further EACK
+	 * will report it. Each segment is retransmitted at most once per
+	 * quarantine period. */
+	uint32_t time_now = csp_get_ms();
+	unsigned int eacked = 0;
+	int pending = 0;
+	for (seq_nr = conn->rdp.snd_nxt; seq_nr != conn->rdp.snd_una; ) {
+		rdp_packet_t * packet = csp_rdp_tx_get(conn, --seq_nr);
+		if (packet == NULL) {
+			eacked++;
+			continue;
 		}
-
-		if (match == 0) {
-			/* If not found, put back on tx queue */
-			csp_queue_enqueue(conn->rdp.tx_queue, &packet, 0);
-		} else {
-			/* Found, free */
-			csp_log_protocol("TX Element %u freed", csp_ntoh16(header->seq_nr));
-			csp_buffer_free(packet);
+		if (eacked == 0 || (eacked < RDP_DUPTHRESH && pending)) {
+			pending = 1;
+			continue;
+		}
+		if (packet->quarantine == 0 || csp_rdp_time_after(time_now, packet->quarantine)) {
+			csp_log_protocol("Fast retransmit seq %u", seq_nr);
+			csp_rdp_retransmit(conn, packet);
+			conn->rdp.fast_retransmits++;
+			csp_conn_timer_set(conn, packet->timestamp + conn->rdp.rto);
 		}
-
 	}
 
 }
@@ -429,11 +713,11 @@ static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
 
 	/* ACK if time since last ACK is greater than ACK timeout */
 	uint32_t time_now = csp_get_ms();
-	if (csp_rdp_time_after(time_now, conn->rdp.ack_timestamp + conn->rdp.ack_timeout))
+	if (csp_rdp_time_after(time_now, conn->rdp.ack_timestamp + csp_rdp_ack_delay(conn)))
 		return true;
 
 	/* ACK if number of unacknowledged packets is greater than delay count */
-	if (csp_rdp_seq_after(conn->rdp.rcv_cur, conn->rdp.rcv_lsa + conn->rdp.ack_delay_count))
+	if (csp_rdp_seq_after(conn->rdp.rcv_cur, conn->rdp.rcv_lsa + csp_rdp_ack_count(conn)))
 		return true;
 
 	return false;
@@ -442,29 +726,67 @@ static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
 
 void csp_rdp_flush_all(csp_conn_t * conn) {
 
-	if ((conn == NULL) || conn->rdp.tx_queue == NULL) {
+	if (conn == NULL) {
 		csp_log_error("Null pointer passed to rdp flush all");
 		return;
 	}
 
-	rdp_packet_t * packet;
+	int i;
 
-	/* Empty TX queue */
-	while (csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+
+	/* Empty TX window */
+	for (i = 0; i < CSP_RDP_TX_SLOTS; i++) {
+		csp_packet_t * packet = conn->rdp.tx_window[i];
 		if (packet != NULL) {
-			csp_log_protocol("Flush TX Element, time %u, seq %u", packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
+			csp_log_protocol("Flush TX Element, time %u, seq %u", ((rdp_packet_t *) packet)->timestamp, csp_ntoh16(csp_rdp_header_ref(packet)->seq_nr));
 			csp_buffer_free(packet);
+			conn->rdp.tx_window[i] = NULL;
 		}
 	}
 
-	/* Empty RX queue */
-	while (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
+	/* Empty RX window */
+	for (i = 0; i < CSP_RDP_RX_SLOTS; i++) {
+		csp_packet_t * packet = conn->rdp.rx_window[i];
 		if (packet != NULL) {
-			csp_log_protocol("Flush RX Element, time %u, seq %u", packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
+			csp_log_protocol("Flush RX Element, seq %u", csp_rdp_header_ref(packet)->seq_nr);
 			csp_buffer_free(packet);
+			conn->rdp.rx_window[i] = NULL;
 		}
 	}
 
+	csp_conn_unlock(conn);
+
+}
+
+/* Wake user task if TX window is ready for more data */
+static void csp_rdp_tx_wake(csp_conn_t * conn) {
+
+	if (conn->rdp.state == RDP_OPEN)
+		if (!csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + (uint16_t)conn->rdp.window_size))
+			csp_bin_sem_post(&conn->rdp.tx_wait);
+
+}
+
+/* Acknowledge segments up to ack_nr, freeing them from the TX window */
+static void csp_rdp_tx_ack(csp_conn_t * conn, uint16_t ack_nr) {
+
+	uint16_t una = ack_nr + 1;
+
+	/* Ignore old acknowledgements */
+	if (!csp_rdp_seq_between(una, conn->rdp.snd_una, conn->rdp.snd_nxt))
+		return;
+
+	/* Sample the RTT of the newest segment */
+	rdp_packet_t * packet = csp_rdp_tx_get(conn, ack_nr);
+	if (packet != NULL && packet->quarantine == 0)
+		csp_rdp_rtt_sample(conn, packet->timestamp);
+
+	while (conn->rdp.snd_una != una)
+		csp_rdp_tx_free(conn, conn->rdp.snd_una++);
+
+	csp_rdp_tx_wake(conn);
+
 }
 
 int csp_rdp_check_ack(csp_conn_t * conn) {
@@ -482,19 +804,81 @@ int csp_rdp_check_ack(csp_conn_t * conn) {
 	if (avail && csp_rdp_should_ack(conn))
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 
+	/* Check again at the ACK timeout while segments are unacknowledged */
+	if (conn->rdp.rcv_lsa != conn->rdp.rcv_cur) {
+		uint32_t time_now = csp_get_ms();
+		uint32_t ack_timeout = csp_rdp_ack_delay(conn);
+		uint32_t deadline = conn->rdp.ack_timestamp + ack_timeout;
+		csp_conn_timer_set(conn, csp_rdp_time_after(time_now, deadline) ? time_now + ack_timeout : deadline);
+	}
+
 	return CSP_ERR_NONE;
 
 }
 
 /**
- * This function must be called with regular intervals for the
- * RDP protocol to work as expected. This takes care of closing
- * stale connections and retransmitting traffic. A good place to
- * call this function is from the CSP router task.
+ * SUSPEND AND RESUME
+ * With a grace period, a connection that has not heard from the other end
+ * for the connection timeout while segments are unacknowledged is
+ * suspended instead of timing out. It keeps its windows, and probes the
+ * link by sending the oldest segment once per RTO, without back-off. The
+ * other end answers a probe with an ACK, or an EACK if it was received
+ * before, which brings the connection up to date, and the remaining
+ * segments are then sent at once. If the other end is not heard from
+ * within the grace period, the connection is closed.
  */
-void csp_rdp_check_timeouts(csp_conn_t * conn) {
+static void csp_rdp_suspend(csp_conn_t * conn) {
 
-	rdp_packet_t * packet;
+	csp_log_warn("RDP: No reply for %"PRIu32" ms, suspending conn %p for up to %"PRIu32" ms",
+			conn->rdp.conn_timeout, conn, conn->rdp.suspend_grace);
+
+	conn->rdp.state = RDP_SUSPENDED;
+	conn->rdp.suspend_timestamp = csp_get_ms();
+	conn->rdp.suspends++;
+	csp_rdp_rto_update(conn);
+
+}
+
+static void csp_rdp_resume(csp_conn_t * conn) {
+
+	csp_log_info("RDP: Resuming conn %p after %"PRIu32" ms", conn, conn->rdp.rx_timestamp - conn->rdp.suspend_timestamp);
+
+	conn->rdp.state = RDP_OPEN;
+
+	/* Send segments not acknowledged by the reply */
+	uint16_t seq_nr;
+	for (seq_nr = conn->rdp.snd_una; seq_nr != conn->rdp.snd_nxt; seq_nr++) {
+		rdp_packet_t * packet = csp_rdp_tx_get(conn, seq_nr);
+		if (packet != NULL && csp_rdp_time_before(packet->timestamp, conn->rdp.rx_timestamp))
+			csp_rdp_retransmit(conn, packet);
+	}
+
+	csp_rdp_tx_wake(conn);
+
+}
+
+/* Reset a connection from the router task, and wake the user task sending or reading */
+static void csp_rdp_abort(csp_conn_t * conn) {
+
+	conn->rdp.state = RDP_CLOSE_WAIT;
+	conn->timestamp = csp_get_ms();
+	csp_conn_timer_set(conn, conn->timestamp + conn->rdp.conn_timeout);
+	csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+
+	csp_bin_sem_post(&conn->rdp.tx_wait);
+	csp_conn_enqueue_packet(conn, NULL);
+
+}
+
+static void csp_rdp_suspend_expire(csp_conn_t * conn) {
+
+	csp_log_warn("RDP: Conn %p not resumed within %"PRIu32" ms, closing", conn, conn->rdp.suspend_grace);
+	csp_rdp_abort(conn);
+
+}
+
+/* Handle due timers with the connection locked, returns 1 if the connection must be closed */
+static int csp_rdp_timeouts(csp_conn_t * conn) {
 
 	/**
 	 * CONNECTION TIMEOUT:
@@ -504,9 +888,9 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	if (conn->socket != NULL) {
 		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
 			csp_log_warn("Found a lost connection, closing now");
-			csp_close(conn);
-			return;
+			return 1;
 		}
+		csp_conn_timer_set(conn, conn->timestamp + conn->rdp.conn_timeout);
 	}
 
 	/**
@@ -516,57 +900,96 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	if (conn->rdp.state == RDP_CLOSE_WAIT) {
 		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
 			csp_log_protocol("CLOSE_WAIT timeout");
-			csp_close(conn);
+			return 1;
 		}
-		return;
+		csp_conn_timer_set(conn, conn->timestamp + conn->rdp.conn_timeout);
+		return 0;
 	}
 
 	/**
-	 * MESSAGE TIMEOUT:
-	 * Check each outgoing message for TX timeout
+	 * FAST OPEN TIMEOUT:
+	 * No task waits in csp_rdp_connect, so reset a connection that was not accepted
+	 */
+	if (conn->rdp.state == RDP_SYN_SENT && (conn->opts & CSP_O_RDPFASTOPEN)) {
+		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
+			csp_log_warn("RDP: Fast open of conn %p not accepted within %"PRIu32" ms", conn, conn->rdp.conn_timeout);
+			csp_rdp_abort(conn);
+			return 0;
+		}
+		csp_conn_timer_set(conn, conn->timestamp + conn->rdp.conn_timeout);
+	}
+
+	/**
+	 * SUSPENDED:
+	 * Resume if the other end was heard from, otherwise probe the link
 	 */
-	int i, count;
-	count = csp_queue_size(conn->rdp.tx_queue);
-	for (i = 0; i < count; i++) {
+	if (conn->rdp.state == RDP_SUSPENDED) {
+		if (csp_rdp_time_after(conn->rdp.rx_timestamp, conn->rdp.suspend_timestamp)) {
+			csp_rdp_resume(conn);
+		} else if (csp_rdp_time_after(time_now, conn->rdp.suspend_timestamp + conn->rdp.suspend_grace)) {
+			csp_rdp_suspend_expire(conn);
+			return 0;
+		} else {
+			uint32_t deadline = conn->rdp.suspend_timestamp + conn->rdp.suspend_grace;
+			rdp_packet_t * packet = csp_rdp_tx_get(conn, conn->rdp.snd_una);
+			if (packet != NULL) {
+				if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.rto)) {
+					csp_log_protocol("RDP: Probing with seq %u", conn->rdp.snd_una);
+					csp_rdp_retransmit(conn, packet);
+				}
+				if (csp_rdp_time_before(packet->timestamp + conn->rdp.rto, deadline))
+					deadline = packet->timestamp + conn->rdp.rto;
+			}
+			csp_conn_timer_set(conn, deadline);
+			csp_rdp_check_ack(conn);
+			return 0;
+		}
+	}
 
-		if ((csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) || packet == NULL) {
-			csp_log_warn("Cannot dequeue from tx_queue in check timeout");
-			break;
+	/**
+	 * SUSPEND:
+	 * Suspend if the other end has not been heard from while segments are unacknowledged
+	 */
+	if (conn->rdp.state == RDP_OPEN && conn->rdp.suspend_grace > 0 && conn->rdp.snd_una != conn->rdp.snd_nxt) {
+		if (csp_rdp_time_after(time_now, conn->rdp.rx_timestamp + conn->rdp.conn_timeout)) {
+			csp_rdp_suspend(conn);
+			csp_conn_timer_set(conn, time_now);
+			return 0;
 		}
+		csp_conn_timer_set(conn, conn->rdp.rx_timestamp + conn->rdp.conn_timeout);
+	}
 
-		/* Get header */
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
+	/**
+	 * MESSAGE TIMEOUT:
+	 * Check each outgoing message for TX timeout
+	 */
+	uint16_t seq_nr;
+	int timed_out = 0;
+	for (seq_nr = conn->rdp.snd_una; seq_nr != conn->rdp.snd_nxt; seq_nr++) {
 
-		/* If acked, do not retransmit */
-		if (csp_rdp_seq_before(csp_ntoh16(header->seq_nr), conn->rdp.snd_una)) {
-			csp_log_protocol("TX Element Free, time %u, seq %u, una %u", packet->timestamp, csp_ntoh16(header->seq_nr), conn->rdp.snd_una);
-			csp_buffer_free(packet);
+		rdp_packet_t * packet = csp_rdp_tx_get(conn, seq_nr);
+		if (packet == NULL)
 			continue;
-		}
 
-		/* Check timestamp and retransmit if needed */
-		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.packet_timeout)) {
-			csp_log_protocol("TX Element timed out, retransmitting seq %u", csp_ntoh16(header->seq_nr));
-
-			/* Update to latest outgoing ACK */
-			header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
-
-			/* Send copy to tx_queue */
-			packet->timestamp = csp_get_ms();
-			csp_packet_t * new_packet = csp_buffer_clone(packet);
-			csp_iface_t * ifout = csp_rtable_find_iface(conn->idout.dst);
-			if (csp_send_direct(conn->idout, new_packet, ifout, 0) != CSP_ERR_NONE) {
-				csp_log_warn("Retransmission failed");
-				csp_buffer_free(new_packet);
-			}
+		/* Fast open data is sent in the SYN until the connection is open */
+		if (conn->rdp.state == RDP_SYN_SENT && seq_nr != conn->rdp.snd_iss)
+			continue;
 
+		/* Check timestamp and retransmit if needed */
+		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.rto)) {
+			csp_log_protocol("TX Element timed out, retransmitting seq %u", seq_nr);
+			csp_rdp_retransmit(conn, packet);
+			conn->rdp.retransmits++;
+			timed_out = 1;
 		}
 
-		/* Requeue the TX element */
-		csp_queue_enqueue_isr(conn->rdp.tx_queue, &packet, &pdTrue);
+		csp_conn_timer_set(conn, packet->timestamp + conn->rdp.rto);
 
 	}
 
+	if (timed_out)
+		csp_rdp_rto_backoff(conn);
+
 	/**
 	 * ACK TIMEOUT:
 	 * Check ACK timeouts, if we have unacknowledged segments
@@ -574,20 +997,49 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	csp_rdp_check_ack(conn);
 
 	/* Wake user task if TX queue is ready for more data */
-	if (conn->rdp.state == RDP_OPEN)
-		if (csp_queue_size(conn->rdp.tx_queue) < (int)conn->rdp.window_size)
-			if (csp_rdp_seq_before(conn->rdp.snd_nxt - conn->rdp.snd_una, conn->rdp.window_size * 2))
-				csp_bin_sem_post(&conn->rdp.tx_wait);
+	csp_rdp_tx_wake(conn);
+
+	return 0;
 
 }
 
-void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
+/**
+ * This function is called by the CSP router task when the connection
+ * timer is due. This takes care of closing stale connections and
+ * retransmitting traffic, and sets the timer again for the next event.
+ */
+void csp_rdp_check_timeouts(csp_conn_t * conn) {
+
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	int close = csp_rdp_timeouts(conn);
+	csp_conn_unlock(conn);
+
+	/* Closing takes the lock again */
+	if (close)
+		csp_close(conn);
+
+}
+
+/* Handle a received segment with the connection locked, returns 1 if the connection must be closed */
+static int csp_rdp_rx(csp_conn_t * conn, csp_packet_t * packet) {
+
+	int close = 0;
+
+	if (packet->length < sizeof(rdp_header_t)) {
+		csp_log_warn("RDP: Packet too short for header, length %u", packet->length);
+		goto discard_open;
+	}
 
 	/* Get RX header and convert to host byte-order */
 	rdp_header_t * rx_header = csp_rdp_header_ref(packet);
 	rx_header->ack_nr = csp_ntoh16(rx_header->ack_nr);
 	rx_header->seq_nr = csp_ntoh16(rx_header->seq_nr);
 
+	/* A suspended connection resumes from the router task */
+	conn->rdp.rx_timestamp = csp_get_ms();
+	if (conn->rdp.state == RDP_SUSPENDED)
+		csp_conn_timer_set(conn, conn->rdp.rx_timestamp);
+
 	csp_log_protocol("RDP: Received in S %u: syn %u, ack %u, eack %u, "
 			"rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)",
 			conn->rdp.state, rx_header->syn, rx_header->ack, rx_header->eak,
@@ -605,8 +1057,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		if (conn->rdp.state == RDP_CLOSE_WAIT || conn->rdp.state == RDP_CLOSED) {
 			csp_log_protocol("RST received in CLOSE_WAIT or CLOSED. Now closing connection");
 			csp_buffer_free(packet);
-			csp_close(conn);
-			return;
+			return 1;
 		} else {
 			csp_log_protocol("Got RESET in state %u", conn->rdp.state);
 
@@ -614,6 +1065,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				csp_log_protocol("RESET in sequence, no more data incoming, reply with RESET");
 				conn->rdp.state = RDP_CLOSE_WAIT;
 				conn->timestamp = csp_get_ms();
+				csp_conn_timer_set(conn, conn->timestamp + conn->rdp.conn_timeout);
 				csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 				goto discard_close;
 			} else {
@@ -638,6 +1090,12 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			goto discard_close;
 		}
 
+		/* Peers without options send six words */
+		if (packet->length < sizeof(rdp_header_t) + 6 * sizeof(uint32_t)) {
+			csp_log_warn("RDP: SYN too short, length %u", packet->length);
+			goto discard_close;
+		}
+
 		csp_log_protocol("RDP: SYN-Received");
 
 		/* Setup TX seq. */
@@ -658,16 +1116,43 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		conn->rdp.delayed_acks 		= csp_ntoh32(packet->data32[3]);
 		conn->rdp.ack_timeout 		= csp_ntoh32(packet->data32[4]);
 		conn->rdp.ack_delay_count 	= csp_ntoh32(packet->data32[5]);
-		csp_log_protocol("RDP: Window Size %u, conn timeout %u, packet timeout %u",
-				conn->rdp.window_size, conn->rdp.conn_timeout, conn->rdp.packet_timeout);
+		conn->rdp.options		= 0;
+		if (packet->length >= sizeof(rdp_header_t) + RDP_SYN_LENGTH)
+			conn->rdp.options	= csp_ntoh32(packet->data32[6]) & RDP_OPTIONS;
+
+		/* Limit window to what we can hold, the SYN/ACK tells the peer */
+		conn->rdp.window_size = csp_rdp_window_limit(conn->rdp.window_size);
+		conn->rdp.suspend_grace = csp_rdp_suspend_grace;
+		csp_rdp_rtt_init(conn);
+
+		csp_log_protocol("RDP: Window Size %u, conn timeout %u, packet timeout %u, options 0x%x",
+				conn->rdp.window_size, conn->rdp.conn_timeout, conn->rdp.packet_timeout, conn->rdp.options);
 		csp_log_protocol("RDP: Delayed acks: %u, ack timeout %u, ack each %u packet",
 				conn->rdp.delayed_acks, conn->rdp.ack_timeout, conn->rdp.ack_delay_count);
 
 		/* Connection accepted */
 		conn->rdp.state = RDP_SYN_RCVD;
 
+		/* Deliver fast open data, unless the socket does not accept it or the SYN is a duplicate */
+		if (packet->length > sizeof(rdp_header_t) + RDP_SYN_LENGTH) {
+			if (!(conn->opts & CSP_SO_RDPFASTOPEN)) {
+				csp_log_protocol("RDP: Socket does not accept fast open, ignoring SYN data");
+			} else if (csp_rdp_syn_cache_add(packet, rx_header->seq_nr, conn->rdp.conn_timeout) != CSP_ERR_NONE) {
+				csp_log_warn("RDP: Duplicate fast open SYN or SYN cache full, ignoring SYN data");
+			} else {
+				packet->length -= RDP_SYN_LENGTH;
+				memmove(packet->data, &packet->data[RDP_SYN_LENGTH], packet->length);
+				conn->rdp.rcv_cur = conn->rdp.rcv_irs + 1;
+				if (csp_rdp_receive_data(conn, packet) == CSP_ERR_NONE) {
+					csp_rdp_send_syn(conn, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_cur);
+					goto accepted_open;
+				}
+				conn->rdp.rcv_cur = conn->rdp.rcv_irs;
+			}
+		}
+
 		/* Send SYN/ACK */
-		csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_irs);
+		csp_rdp_send_syn(conn, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_cur);
 
 		goto discard_open;
 
@@ -685,15 +1170,46 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			conn->rdp.rcv_cur = rx_header->seq_nr;
 			conn->rdp.rcv_irs = rx_header->seq_nr;
 			conn->rdp.rcv_lsa = rx_header->seq_nr - 1;
-			conn->rdp.snd_una = rx_header->ack_nr + 1;
 			conn->rdp.ack_timestamp = csp_get_ms();
 			conn->rdp.state = RDP_OPEN;
 
-			csp_log_protocol("RDP: NP: Connection OPEN");
+			/* Use the window and options accepted by the peer, if it sent them */
+			if (packet->length >= sizeof(rdp_header_t) + RDP_SYN_LENGTH) {
+				uint32_t window_size = csp_ntoh32(packet->data32[0]);
+				if (window_size > 0 && window_size < conn->rdp.window_size)
+					conn->rdp.window_size = window_size;
+				conn->rdp.options &= csp_ntoh32(packet->data32[6]);
+			} else {
+				conn->rdp.options = 0;
+			}
+
+			csp_log_protocol("RDP: NP: Connection OPEN, window %u, options 0x%x", conn->rdp.window_size, conn->rdp.options);
+
+			/* Fast open data was sent with the SYN, so is only sampled if the SYN was not retransmitted */
+			rdp_packet_t * syn = csp_rdp_tx_get(conn, conn->rdp.snd_iss);
+			rdp_packet_t * segment = csp_rdp_tx_get(conn, conn->rdp.snd_iss + 1);
+			if (syn != NULL && segment != NULL)
+				segment->quarantine = syn->quarantine;
+
+			/* Acknowledge the SYN, and fast open data if it was accepted, otherwise send it again */
+			csp_rdp_tx_ack(conn, rx_header->ack_nr);
+			if (conn->rdp.snd_una != conn->rdp.snd_nxt) {
+				segment = csp_rdp_tx_get(conn, conn->rdp.snd_una);
+				if (segment != NULL) {
+					csp_log_protocol("RDP: Fast open data not accepted, sending seq %u", conn->rdp.snd_una);
+					csp_rdp_retransmit(conn, segment);
+				}
+			}
 
-			/* Send ACK */
+			/* Deliver replies that arrived before the SYN/ACK */
+			if (conn->opts & CSP_O_RDPFASTOPEN)
+				csp_rdp_rx_window_flush(conn);
+
+			/* Send ACK, a fast open connection may have nothing more to send */
 			if (conn->rdp.delayed_acks == 0)
 				csp_rdp_send_cmp(conn, NULL, RDP_ACK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+			else if (conn->opts & CSP_O_RDPFASTOPEN)
+				csp_rdp_check_ack(conn);
 
 			/* Wake TX task */
 			csp_bin_sem_post(&conn->rdp.tx_wait);
@@ -701,6 +1217,18 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			goto discard_open;
 		}
 
+		/* With fast open, a reply to the data may overtake the SYN/ACK.
+		 * Keep it in the RX window until the SYN/ACK tells where it belongs. */
+		if (rx_header->ack && (conn->opts & CSP_O_RDPFASTOPEN) &&
+				csp_rdp_seq_between(rx_header->ack_nr, conn->rdp.snd_iss, conn->rdp.snd_nxt - 1)) {
+			if (!rx_header->eak && packet->length > sizeof(rdp_header_t) &&
+					csp_rdp_rx_window_add(conn, packet, rx_header->seq_nr) == CSP_ERR_NONE) {
+				csp_log_protocol("RDP: Segment %u before SYN/ACK, stored", rx_header->seq_nr);
+				goto accepted_open;
+			}
+			goto discard_open;
+		}
+
 		/* If there was no SYN in the reply, our SYN message hit an already open connection
 		 * This is handled by sending a RST.
 		 * Normally this would be followed up by a new connection attempt, however
@@ -729,6 +1257,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 	 */
 	case RDP_SYN_RCVD:
 	case RDP_OPEN:
+	case RDP_SUSPENDED:
 	{
 
 		/* SYN or !ACK is invalid */
@@ -748,9 +1277,9 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 					rx_header->seq_nr, conn->rdp.rcv_cur + 1, conn->rdp.rcv_cur + 1 + conn->rdp.window_size * 2);
 			/* If duplicate SYN received, send another SYN/ACK */
 			if (conn->rdp.state == RDP_SYN_RCVD)
-				csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_irs);
+				csp_rdp_send_syn(conn, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_cur);
 			/* If duplicate data packet received, send EACK back */
-			if (conn->rdp.state == RDP_OPEN)
+			else
 				csp_rdp_send_eack(conn);
 
 			goto discard_open;
@@ -763,9 +1292,9 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			goto discard_open;
 		}
 
-		/* Check SYN_RCVD ACK */
+		/* Check SYN_RCVD ACK, which also covers segments sent after accepting fast open data */
 		if (conn->rdp.state == RDP_SYN_RCVD) {
-			if (rx_header->ack_nr != conn->rdp.snd_iss) {
+			if (!csp_rdp_seq_between(rx_header->ack_nr, conn->rdp.snd_iss, conn->rdp.snd_nxt - 1)) {
 				csp_log_error("SYN-RCVD: Wrong ACK number");
 				goto discard_close;
 			}
@@ -774,7 +1303,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		}
 
 		/* Store current ack'ed sequence number */
-		conn->rdp.snd_una = rx_header->ack_nr + 1;
+		csp_rdp_tx_ack(conn, rx_header->ack_nr);
 
 		/* We have an EACK */
 		if (rx_header->eak) {
@@ -789,7 +1318,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 		/* If message is not in sequence, send EACK and store packet */
 		if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != CSP_QUEUE_OK) {
+			if (csp_rdp_rx_window_add(conn, packet, rx_header->seq_nr) != CSP_ERR_NONE) {
 				csp_log_protocol("Duplicate sequence number");
 				goto discard_open;
 			}
@@ -812,8 +1341,8 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		 * no longer full. */
 		csp_rdp_check_ack(conn);
 
-		/* Flush RX queue */
-		csp_rdp_rx_queue_flush(conn);
+		/* Deliver RX window */
+		csp_rdp_rx_window_flush(conn);
 
 		goto accepted_open;
 
@@ -855,13 +1384,25 @@ discard_close:
 		csp_log_protocol("Waiting for userspace to close");
 		csp_conn_enqueue_packet(conn, NULL);
 	} else {
-		csp_close(conn);
+		close = 1;
 	}
 
 discard_open:
 	csp_buffer_free(packet);
 accepted_open:
-	return;
+	return close;
+
+}
+
+void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
+
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	int close = csp_rdp_rx(conn, packet);
+	csp_conn_unlock(conn);
+
+	/* Closing takes the lock again */
+	if (close)
+		csp_close(conn);
 
 }
 
@@ -869,13 +1410,17 @@ int csp_rdp_connect(csp_conn_t * conn, uint32_t timeout) {
 
 	int retry = 1;
 
-	conn->rdp.window_size	 = csp_rdp_window_size;
+	conn->rdp.window_size	 = csp_rdp_window_limit(csp_rdp_window_size);
 	conn->rdp.conn_timeout	= csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout  = csp_rdp_packet_timeout;
 	conn->rdp.delayed_acks	= csp_rdp_delayed_acks;
 	conn->rdp.ack_timeout 	  = csp_rdp_ack_timeout;
 	conn->rdp.ack_delay_count = csp_rdp_ack_delay_count;
+	conn->rdp.options	  = RDP_OPTIONS;
 	conn->rdp.ack_timestamp   = csp_get_ms();
+	conn->rdp.rx_timestamp	  = conn->rdp.ack_timestamp;
+	conn->rdp.suspend_grace   = csp_rdp_suspend_grace;
+	csp_rdp_rtt_init(conn);
 
 retry:
 	csp_log_protocol("RDP: Active connect, conn state %u", conn->rdp.state);
@@ -885,6 +1430,8 @@ retry:
 		return CSP_ERR_ALREADY;
 	}
 
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+
 	/* Randomize ISS */
 	srand(csp_get_ms());
 	conn->rdp.snd_iss = (uint16_t)rand();
@@ -892,14 +1439,25 @@ retry:
 	conn->rdp.snd_nxt = conn->rdp.snd_iss + 1;
 	conn->rdp.snd_una = conn->rdp.snd_iss;
 
-	csp_log_protocol("RDP: AC: Sending SYN");
-
 	/* Ensure semaphore is busy, so router task can release it */
 	csp_bin_sem_wait(&conn->rdp.tx_wait, 0);
 
+	/* With fast open, csp_rdp_send sends the SYN with the first segment */
+	if (conn->opts & CSP_O_RDPFASTOPEN) {
+		csp_log_protocol("RDP: AC: Fast open, SYN sent with first segment");
+		conn->rdp.snd_nxt = conn->rdp.snd_iss;
+		conn->rdp.state = RDP_SYN_SENT;
+		csp_conn_unlock(conn);
+		return CSP_ERR_NONE;
+	}
+
+	csp_log_protocol("RDP: AC: Sending SYN");
+
 	/* Send SYN message */
 	conn->rdp.state = RDP_SYN_SENT;
-	if (csp_rdp_send_syn(conn) != CSP_ERR_NONE)
+	int ret = csp_rdp_send_syn(conn, RDP_SYN, conn->rdp.snd_iss, 0);
+	csp_conn_unlock(conn);
+	if (ret != CSP_ERR_NONE)
 		goto error;
 
 	/* Wait for router task to release semaphore */
@@ -934,46 +1492,102 @@ error:
 
 int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 
-	if (conn->rdp.state != RDP_OPEN) {
+	int ret = CSP_ERR_NONE;
+
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+
+	/* The first segment of a fast open connection is sent with the SYN, if there is room */
+	if (conn->rdp.state == RDP_SYN_SENT && conn->rdp.snd_nxt == conn->rdp.snd_iss) {
+		conn->timestamp = csp_get_ms();
+		int mtu = csp_rtable_find_mtu(conn->idout.dst);
+		unsigned int extra = RDP_SYN_LENGTH + sizeof(rdp_header_t) + csp_rdp_trailer_length(conn);
+		if (csp_packet_tailroom(packet) >= (int) extra && packet->length + extra <= (unsigned int) mtu) {
+			ret = csp_rdp_send_fast_open(conn, packet);
+			goto out;
+		}
+
+		csp_log_protocol("RDP: AC: No room for fast open, sending SYN");
+		conn->rdp.snd_nxt++;
+		ret = csp_rdp_send_syn(conn, RDP_SYN, conn->rdp.snd_iss, 0);
+		if (ret != CSP_ERR_NONE) {
+			conn->rdp.snd_nxt--;
+			goto out;
+		}
+	}
+
+	/* Later segments wait for the SYN/ACK, the router task posts tx_wait with the lock held */
+	while (conn->rdp.state == RDP_SYN_SENT) {
+		csp_conn_unlock(conn);
+		int wait = csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout);
+		csp_conn_lock(conn, CSP_MAX_DELAY);
+		if (wait != CSP_SEMAPHORE_OK) {
+			csp_log_error("RDP: Timeout waiting for SYN/ACK");
+			ret = CSP_ERR_TIMEDOUT;
+			goto out;
+		}
+	}
+
+	/* A fast open connection is used before the ACK of the SYN/ACK arrives */
+	if (conn->rdp.state != RDP_OPEN && conn->rdp.state != RDP_SUSPENDED && conn->rdp.state != RDP_SYN_RCVD) {
 		csp_log_error("RDP: ERROR cannot send, connection reset");
-		return CSP_ERR_RESET;
+		ret = CSP_ERR_RESET;
+		goto out;
 	}
 
 	/* If TX window is full, wait here */
 	while (csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + (uint16_t)conn->rdp.window_size)) {
 		csp_log_protocol("RDP: Waiting for window update before sending seq %u", conn->rdp.snd_nxt);
 		csp_bin_sem_wait(&conn->rdp.tx_wait, 0);
-		if ((csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout)) != CSP_SEMAPHORE_OK) {
+		csp_conn_unlock(conn);
+		int wait = csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout);
+		csp_conn_lock(conn, CSP_MAX_DELAY);
+		if (wait != CSP_SEMAPHORE_OK) {
+			/* Keep waiting while the connection is, or is about to be, suspended */
+			if (conn->rdp.state == RDP_SUSPENDED || (conn->rdp.suspend_grace > 0 &&
+					!csp_rdp_time_before(csp_get_ms(), conn->rdp.rx_timestamp + conn->rdp.conn_timeout)))
+				continue;
 			csp_log_error("Timeout during send");
-			return CSP_ERR_TIMEDOUT;
+			ret = CSP_ERR_TIMEDOUT;
+			goto out;
 		}
+		if (conn->rdp.state != RDP_OPEN && conn->rdp.state != RDP_SUSPENDED && conn->rdp.state != RDP_SYN_RCVD)
+			break;
 	}
 
-	if (conn->rdp.state != RDP_OPEN) {
+	if (conn->rdp.state != RDP_OPEN && conn->rdp.state != RDP_SUSPENDED && conn->rdp.state != RDP_SYN_RCVD) {
 		csp_log_error("RDP: ERROR cannot send, connection reset");
-		return CSP_ERR_RESET;
+		ret = CSP_ERR_RESET;
+		goto out;
 	}
 
 	/* Add RDP header */
 	rdp_header_t * tx_header = csp_rdp_header_add(packet);
+	if (tx_header == NULL) {
+		csp_log_error("No room for RDP header");
+		ret = CSP_ERR_NOBUFS;
+		goto out;
+	}
 	tx_header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
 	tx_header->seq_nr = csp_hton16(conn->rdp.snd_nxt);
 	tx_header->ack = 1;
 
-	/* Send copy to tx_queue */
+	/* Send copy to TX window */
 	rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
 	if (rdp_packet == NULL) {
 		csp_log_error("Failed to allocate packet buffer");
-		return CSP_ERR_NOMEM;
+		ret = CSP_ERR_NOMEM;
+		goto out;
 	}
 
 	rdp_packet->timestamp = csp_get_ms();
 	rdp_packet->quarantine = 0;
-	if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK) {
+	if (csp_rdp_tx_add(conn, rdp_packet, conn->rdp.snd_nxt) != CSP_ERR_NONE) {
 		csp_log_error("No more space in RDP retransmit queue");
 		csp_buffer_free(rdp_packet);
-		return CSP_ERR_NOBUFS;
+		ret = CSP_ERR_NOBUFS;
+		goto out;
 	}
+	csp_conn_timer_set(conn, rdp_packet->timestamp + conn->rdp.rto);
 
 	csp_log_protocol("RDP: Sending  in S %u: syn %u, ack %u, eack %u, "
 				"rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)",
@@ -982,18 +1596,22 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 				packet->length, packet->length - sizeof(rdp_header_t));
 
 	conn->rdp.snd_nxt++;
-	return CSP_ERR_NONE;
+
+out:
+	csp_conn_unlock(conn);
+	return ret;
 
 }
 
 int csp_rdp_allocate(csp_conn_t * conn) {
 
-	csp_log_buffer("RDP: Creating RDP queues for conn %p", conn);
+	csp_log_buffer("RDP: Creating RDP state for conn %p", conn);
 
 	/* Set initial state */
 	conn->rdp.state = RDP_CLOSED;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
+	csp_rdp_rtt_init(conn);
 
 	/* Create a binary semaphore to wait on for tasks */
 	if (csp_bin_sem_create(&conn->rdp.tx_wait) != CSP_SEMAPHORE_OK) {
@@ -1001,22 +1619,9 @@ int csp_rdp_allocate(csp_conn_t * conn) {
 		return CSP_ERR_NOMEM;
 	}
 
-	/* Create TX queue */
-	conn->rdp.tx_queue = csp_queue_create(CSP_RDP_MAX_WINDOW, sizeof(csp_packet_t *));
-	if (conn->rdp.tx_queue == NULL) {
-		csp_log_error("Failed to create TX queue for conn");
-		csp_bin_sem_remove(&conn->rdp.tx_wait);
-		return CSP_ERR_NOMEM;
-	}
-
-	/* Create RX queue */
-	conn->rdp.rx_queue = csp_queue_create(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *));
-	if (conn->rdp.rx_queue == NULL) {
-		csp_log_error("Failed to create RX queue for conn");
-		csp_bin_sem_remove(&conn->rdp.tx_wait);
-		csp_queue_remove(conn->rdp.tx_queue);
-		return CSP_ERR_NOMEM;
-	}
+	/* The TX and RX windows are empty */
+	memset(conn->rdp.tx_window, 0, sizeof(conn->rdp.tx_window));
+	memset(conn->rdp.rx_window, 0, sizeof(conn->rdp.rx_window));
 
 	return CSP_ERR_NONE;
 
@@ -1028,21 +1633,27 @@ int csp_rdp_allocate(csp_conn_t * conn) {
  */
 int csp_rdp_close(csp_conn_t * conn) {
 
-	if (conn->rdp.state == RDP_CLOSED)
-		return CSP_ERR_NONE;
+	int ret = CSP_ERR_NONE;
+
+	csp_conn_lock(conn, CSP_MAX_DELAY);
 
-	/* If message is open, send reset */
-	if (conn->rdp.state != RDP_CLOSE_WAIT) {
+	if (conn->rdp.state == RDP_CLOSED) {
+		/* Nothing to do */
+	} else if (conn->rdp.state != RDP_CLOSE_WAIT) {
+		/* If message is open, send reset */
 		conn->rdp.state = RDP_CLOSE_WAIT;
 		conn->timestamp = csp_get_ms();
+		csp_conn_timer_set(conn, conn->timestamp + conn->rdp.conn_timeout);
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 		csp_log_protocol("RDP Close, sent RST on conn %p", conn);
-		return CSP_ERR_AGAIN;
+		ret = CSP_ERR_AGAIN;
+	} else {
+		csp_log_protocol("RDP Close in CLOSE_WAIT, now closing");
+		conn->rdp.state = RDP_CLOSED;
 	}
 
-	csp_log_protocol("RDP Close in CLOSE_WAIT, now closing");
-	conn->rdp.state = RDP_CLOSED;
-	return CSP_ERR_NONE;
+	csp_conn_unlock(conn);
+	return ret;
 
 }
 
@@ -1063,6 +1674,14 @@ void csp_rdp_set_opt(unsigned int window_size, unsigned int conn_timeout_ms,
 	csp_rdp_ack_delay_count = ack_delay_count;
 }
 
+void csp_rdp_set_suspend(unsigned int grace_ms) {
+	csp_rdp_suspend_grace = grace_ms;
+}
+
+unsigned int csp_rdp_get_suspend(void) {
+	return csp_rdp_suspend_grace;
+}
+
 void csp_rdp_get_opt(unsigned int * window_size, unsigned int * conn_timeout_ms,
 		unsigned int * packet_timeout_ms, unsigned int * delayed_acks,
 		unsigned int * ack_timeout, unsigned int * ack_delay_count) {
@@ -1081,6 +1700,23 @@ void csp_rdp_get_opt(unsigned int * window_size, unsigned int * conn_timeout_ms,
 		*ack_delay_count = csp_rdp_ack_delay_count;
 }
 
+int csp_rdp_get_stats(csp_conn_t * conn, csp_rdp_stats_t * stats) {
+
+	if (conn == NULL || stats == NULL || !(conn->idin.flags & CSP_FRDP))
+		return CSP_ERR_INVAL;
+
+	stats->srtt = conn->rdp.srtt / 8;
+	stats->rttvar = conn->rdp.rttvar / 8;
+	stats->rto = conn->rdp.rto;
+	stats->window_size = conn->rdp.window_size;
+	stats->retransmits = conn->rdp.retransmits;
+	stats->fast_retransmits = conn->rdp.fast_retransmits;
+	stats->suspends = conn->rdp.suspends;
+
+	return CSP_ERR_NONE;
+
+}
+
 #ifdef CSP_DEBUG
 void csp_rdp_conn_print(csp_conn_t * conn) {
 
@@ -1089,6 +1725,9 @@ void csp_rdp_conn_print(csp_conn_t * conn) {
 
 	printf("\tRDP: State %"PRIu16", rcv %"PRIu16", snd %"PRIu16", win %"PRIu32"\r\n",
 			conn->rdp.state, conn->rdp.rcv_cur, conn->rdp.snd_una, conn->rdp.window_size);
+	printf("\tRDP: srtt %"PRIu32", rttvar %"PRIu32", rto %"PRIu32", retransmits %"PRIu32", fast %"PRIu32", suspends %"PRIu32"\r\n",
+			conn->rdp.srtt / 8, conn->rdp.rttvar / 8, conn->rdp.rto,
+			conn->rdp.retransmits, conn->rdp.fast_retransmits, conn->rdp.suspends);
 
 }
 #endif
@@ -24,6 +24,7 @@ int ftp_upload(uint8_t host, uint8_t port, const char * path, uint8_t type, int
 int ftp_download(uint8_t host, uint8_t port, const char * path, uint8_t backend, int chunk_size, uint32_t memaddr, uint32_t memsize, const char * remote_path, uint32_t * size);
 int ftp_status_request(void);
 int ftp_status_reply(void);
+int ftp_bulk_reply(uint8_t port, uint32_t rate, uint32_t interval);
 int ftp_data(int count);
 int ftp_crc(void);
 int ftp_done(unsigned int remove_map);
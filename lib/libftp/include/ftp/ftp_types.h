@@ -57,6 +57,8 @@ typedef enum __attribute__ ((__packed__)) {
 	FTP_ZIP_REPLY			= 22,
 	FTP_COPY_REQUEST		= 23,	/**< Copy request */
 	FTP_COPY_REPLY			= 24,	/**< Copy reply */
+	FTP_BULK_REQUEST		= 25,	/**< Bulk download request */
+	FTP_BULK_REPLY			= 26,	/**< Bulk download reply */
 } ftp_type_t;
 
 /** FTP return codes */
@@ -166,6 +168,20 @@ typedef struct {
 	ftp_status_element_t entry[FTP_STATUS_CHUNKS];
 } __attribute__ ((__packed__)) ftp_status_reply_t;
 
+/** Bulk download request.
+ * The server opens a connection without RDP to port on the client, and
+ * sends the chunks of the current download with csp_bulk_send(). */
+typedef struct {
+	uint8_t port;
+	uint32_t rate;
+	uint32_t interval;
+} __attribute__ ((__packed__)) ftp_bulk_request_t;
+
+/** Bulk download reply */
+typedef struct {
+	uint8_t ret;
+} __attribute__ ((__packed__)) ftp_bulk_reply_t;
+
 /** List files request */
 typedef struct {
 	uint8_t backend;
@@ -243,6 +259,10 @@ typedef struct {
 		/* Status reply */
 		ftp_status_reply_t statusrep;
 
+		/* Bulk download */
+		ftp_bulk_request_t bulk;
+		ftp_bulk_reply_t bulkrep;
+
 		/* Listing */
 		ftp_list_request_t list;
 		ftp_list_reply_t listrep;
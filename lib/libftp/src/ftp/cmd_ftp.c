@@ -31,6 +31,9 @@ static unsigned int ftp_host = 1;
 static unsigned int ftp_port = 9;
 static unsigned int ftp_chunk_size = 185;
 static unsigned int ftp_backend = 3; // Use file backend as standard
+static unsigned int ftp_bulk_port = 0; // Download with RDP
+static unsigned int ftp_bulk_rate = 0;
+static unsigned int ftp_bulk_interval = 1000;
 
 /* State variables */
 static uint32_t ftp_size;
@@ -62,6 +65,33 @@ int cmd_ftp_set_host_port(struct command_context *ctx) {
 
 }
 
+int cmd_ftp_set_bulk(struct command_context *ctx) {
+
+	if (ctx->argc < 2)
+		return CMD_ERROR_SYNTAX;
+
+	ftp_bulk_port = atoi(ctx->argv[1]);
+
+	if (ctx->argc > 2)
+		ftp_bulk_rate = atoi(ctx->argv[2]);
+
+	if (ctx->argc > 3)
+		ftp_bulk_interval = atoi(ctx->argv[3]);
+
+	if (ftp_bulk_interval == 0)
+		return CMD_ERROR_SYNTAX;
+
+	return CMD_ERROR_NONE;
+
+}
+
+/* Receive the download with RDP, or with the bulk transport if enabled */
+static int ftp_download_run(void) {
+	if (ftp_bulk_port)
+		return ftp_bulk_reply(ftp_bulk_port, ftp_bulk_rate, ftp_bulk_interval);
+	return ftp_status_reply();
+}
+
 /* Some versions of newlib do not have basename
  * (looking at you, Atmel)
  */
@@ -94,7 +124,7 @@ int cmd_ftp_download_file(struct command_context *ctx) {
 		return CMD_ERROR_FAIL;
 	}
 
-	if (ftp_status_reply() != 0) {
+	if (ftp_download_run() != 0) {
 		ftp_done(0);
 		return CMD_ERROR_FAIL;
 	}
@@ -175,7 +205,7 @@ int cmd_ftp_download_mem(struct command_context *ctx) {
 		return CMD_ERROR_FAIL;
 	}
 
-	if (ftp_status_reply() != 0) {
+	if (ftp_download_run() != 0) {
 		ftp_done(0);
 		return CMD_ERROR_FAIL;
 	}
@@ -231,7 +261,7 @@ int cmd_ftp_upload_mem(struct command_context *ctx) {
 }
 
 int cmd_ftp_download_run(struct command_context *ctx) {
-	if (ftp_status_reply() != 0)
+	if (ftp_download_run() != 0)
 		return CMD_ERROR_FAIL;
 	return CMD_ERROR_NONE;
 }
@@ -429,8 +459,13 @@ command_t __sub_command ftp_subcommands[] = {
 	},{
 		.name = "server",
 		.help = "set host and port",
-		.usage = "<server> [port] [chunk size]",
+		.usage = "<server> [port] [chunk size, 0 for path MTU]",
 		.handler = cmd_ftp_set_host_port,
+	},{
+		.name = "bulk",
+		.help = "download with the bulk transport",
+		.usage = "<local port, 0 for RDP> [rate B/s, 0 to probe] [report interval ms]",
+		.handler = cmd_ftp_set_bulk,
 	},{
 		.name = "backend",
 		.help = "Set filesystem backend",
@@ -7,6 +7,7 @@
  */
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -16,6 +17,7 @@
 
 #include <csp/csp.h>
 #include <csp/csp_endian.h>
+#include <csp/csp_rtable.h>
 
 #include <ftp/ftp_types.h>
 
@@ -29,6 +31,9 @@
 
 static int ftp_timeout = 30000;
 
+/* Room left below the MTU for the RDP header and CRC32 */
+#define FTP_OPTIONS_MAX	16
+
 /* Chunk status markers */
 static const char const * packet_missing = "-";
 static const char const * packet_ok = "+";
@@ -147,6 +152,11 @@ void ftp_set_progress_handler(ftp_progress_handler handler, void *data)
 	progress_handler_data = data;
 }
 
+/* Largest chunk that fits the first hop to host */
+static int ftp_path_chunk_size(uint8_t host) {
+	return csp_rtable_find_mtu(host) - sizeof(ftp_type_t) - sizeof(uint32_t) - FTP_OPTIONS_MAX;
+}
+
 int ftp_upload(uint8_t host, uint8_t port, const char * path, uint8_t backend, int chunk_size, uint32_t addr, const char * remote_path, uint32_t * size, uint32_t * checksum) {
 
 	int req_length, rep_length;
@@ -172,6 +182,14 @@ int ftp_upload(uint8_t host, uint8_t port, const char * path, uint8_t backend, i
 	if (size != NULL)
 		*size = statbuf.st_size;
 
+	if (chunk_size <= 0)
+		chunk_size = ftp_path_chunk_size(host);
+	if (chunk_size <= 0) {
+		color_printf(COLOR_RED, "No route to host %u\r\n", host);
+		return -1;
+	}
+	color_printf(COLOR_GREEN, "Chunk size is %d\r\n", chunk_size);
+
 	ftp_chunk_size = chunk_size;
 	ftp_file_size = (uint32_t) statbuf.st_size;
 	ftp_chunks = (ftp_file_size + ftp_chunk_size - 1) / ftp_chunk_size;
@@ -189,7 +207,7 @@ int ftp_upload(uint8_t host, uint8_t port, const char * path, uint8_t backend, i
 	req_length = sizeof(ftp_type_t) + sizeof(ftp_upload_request_t);
 	rep_length = sizeof(ftp_type_t) + sizeof(ftp_upload_reply_t);
 
-	conn = csp_connect(CSP_PRIO_NORM, host, port, ftp_timeout, CSP_O_RDP | CSP_O_CRC32);
+	conn = csp_connect(CSP_PRIO_NORM, host, port, ftp_timeout, CSP_O_RDP | CSP_O_RDPFASTOPEN | CSP_O_CRC32);
 	if (conn == NULL)
 		return -1;
 
@@ -213,6 +231,13 @@ int ftp_download(uint8_t host, uint8_t port, const char * path, uint8_t backend,
 	ftp_packet_t req, rep;
 	bool new_file = false;
 
+	if (chunk_size <= 0)
+		chunk_size = ftp_path_chunk_size(host);
+	if (chunk_size <= 0) {
+		color_printf(COLOR_RED, "No route to host %u\r\n", host);
+		return -1;
+	}
+
 	ftp_chunk_size = chunk_size;
 
 	req.type = FTP_DOWNLOAD_REQUEST;
@@ -233,7 +258,7 @@ int ftp_download(uint8_t host, uint8_t port, const char * path, uint8_t backend,
 	req_length = sizeof(ftp_type_t) + sizeof(ftp_download_request_t);
 	rep_length = sizeof(ftp_type_t) + sizeof(ftp_download_reply_t);
 
-	conn = csp_connect(CSP_PRIO_NORM, host, port, 5000, CSP_O_RDP | CSP_O_CRC32);
+	conn = csp_connect(CSP_PRIO_NORM, host, port, 5000, CSP_O_RDP | CSP_O_RDPFASTOPEN | CSP_O_CRC32);
 	if (conn == NULL)
 		return -1;
 
@@ -597,6 +622,116 @@ int ftp_status_reply(void) {
 	return 0;
 }
 
+/* Write a chunk received with the bulk transport, and mark it in the map */
+static int ftp_bulk_write(void * data, uint32_t chunk, const uint8_t * buf, unsigned int len) {
+
+	unsigned int size = ftp_chunk_size;
+	if (chunk == ftp_chunks - 1 && ftp_file_size % ftp_chunk_size)
+		size = ftp_file_size % ftp_chunk_size;
+	if (len < size) {
+		color_printf(COLOR_RED, "Short chunk %"PRIu32" of %u bytes\r\n", chunk, len);
+		return -1;
+	}
+
+	if (fseek(fp, chunk * ftp_chunk_size, SEEK_SET) != 0 || fwrite(buf, 1, size, fp) != size) {
+		color_printf(COLOR_RED, "Write error\r\n");
+		return -1;
+	}
+
+	if (fseek(fp_map, chunk, SEEK_SET) != 0 || fwrite(packet_ok, 1, 1, fp_map) != 1) {
+		color_printf(COLOR_RED, "Map write error\r\n");
+		return -1;
+	}
+
+	progress_bar(chunk, true);
+
+	return 0;
+
+}
+
+int ftp_bulk_reply(uint8_t port, uint32_t rate, uint32_t interval) {
+
+	static csp_socket_t * bulk_socket = NULL;
+	static uint8_t bulk_port;
+	ftp_packet_t req, rep;
+	int ret = -1;
+
+	/* The data connection is accepted on a port of our own */
+	if (bulk_socket == NULL) {
+		bulk_socket = csp_socket(CSP_SO_NONE);
+		if (bulk_socket == NULL || csp_bind(bulk_socket, port) != CSP_ERR_NONE || csp_listen(bulk_socket, 1) != CSP_ERR_NONE) {
+			color_printf(COLOR_RED, "Failed to listen on port %u\r\n", port);
+			return -1;
+		}
+		bulk_port = port;
+	} else if (bulk_port != port) {
+		color_printf(COLOR_RED, "Bulk port is %u\r\n", bulk_port);
+		return -1;
+	}
+
+	/* Chunks received so far */
+	uint8_t * map = calloc((ftp_chunks + 7) / 8, 1);
+	if (map == NULL)
+		return -1;
+	unsigned int i;
+	char cstat;
+	fseek(fp_map, 0, SEEK_SET);
+	for (i = 0; i < ftp_chunks; i++) {
+		if (fread(&cstat, 1, 1, fp_map) != 1) {
+			color_printf(COLOR_RED, "fread byte %u failed\r\n", i);
+			goto out;
+		}
+		if (cstat == *packet_ok)
+			map[i / 8] |= 1 << (i % 8);
+	}
+
+	req.type = FTP_BULK_REQUEST;
+	req.bulk.port = port;
+	req.bulk.rate = csp_hton32(rate);
+	req.bulk.interval = csp_hton32(interval);
+
+	int rep_length = sizeof(ftp_type_t) + sizeof(ftp_bulk_reply_t);
+	if (csp_transaction_persistent(conn, ftp_timeout, &req, sizeof(ftp_type_t) + sizeof(ftp_bulk_request_t), &rep, rep_length) != rep_length) {
+		color_printf(COLOR_RED, "No reply to bulk request received, timeout or error (timeout set to %d msec)\r\n", ftp_timeout);
+		goto out;
+	}
+
+	if (rep.type != FTP_BULK_REPLY || rep.bulkrep.ret != FTP_RET_OK) {
+		ftp_perror(rep.bulkrep.ret);
+		goto out;
+	}
+
+	csp_conn_t * data_conn = csp_accept(bulk_socket, ftp_timeout);
+	if (data_conn == NULL) {
+		color_printf(COLOR_RED, "No bulk connection from server\r\n");
+		goto out;
+	}
+
+	progress_reset();
+	int err = csp_bulk_recv(data_conn, ftp_chunks, map, interval, ftp_timeout, ftp_bulk_write, NULL);
+	csp_close(data_conn);
+	color_printf(COLOR_NONE, "\r\n");
+
+	/* Sync file to disk */
+	fflush(fp);
+	fsync(fileno(fp));
+
+	fflush(fp_map);
+	fsync(fileno(fp_map));
+
+	if (err != CSP_ERR_NONE) {
+		color_printf(COLOR_RED, "Bulk transfer failed: %d\r\n", err);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	free(map);
+	return ret;
+
+}
+
 int ftp_data(int count) {
 
 	unsigned int i, j;
@@ -605,36 +740,46 @@ int ftp_data(int count) {
 	/* Reset progress bar */
 	progress_reset();
 
-	/* Request */
-	ftp_packet_t packet;
-	packet.type = FTP_DATA;
+	/* Chunks may be larger than ftp_data_t, so they are built directly in CSP buffers */
+	int length = sizeof(ftp_type_t) + sizeof(uint32_t) + ftp_chunk_size;
 	for (i = 0; i < last_entries; i++) {
 		ftp_status_element_t * n = &last_status[i];
 
 		for (j = 0; j < n->count; j++) {
+			csp_packet_t * csp_packet = csp_buffer_get(length);
+			if (csp_packet == NULL) {
+				color_printf(COLOR_RED, "No buffer for chunk of %d bytes\r\n", ftp_chunk_size);
+				return -1;
+			}
+			ftp_packet_t * packet = (ftp_packet_t *) csp_packet->data;
+			packet->type = FTP_DATA;
+
 			/* Calculate chunk number */
-			packet.data.chunk = n->next + j;
+			packet->data.chunk = n->next + j;
 
 			/* Print progress bar */
-			progress_bar(packet.data.chunk, true);
+			progress_bar(packet->data.chunk, true);
 
 			/* Read chunk */
-			if ((unsigned int) ftell(fp) != packet.data.chunk * ftp_chunk_size)
-				fseek(fp, packet.data.chunk * ftp_chunk_size, SEEK_SET);
-			ret = fread(packet.data.bytes, ftp_chunk_size, 1, fp);
+			if ((unsigned int) ftell(fp) != packet->data.chunk * ftp_chunk_size)
+				fseek(fp, packet->data.chunk * ftp_chunk_size, SEEK_SET);
+			ret = fread(packet->data.bytes, ftp_chunk_size, 1, fp);
 			if (ret < 0) {
-				if (!feof(fp))
+				if (!feof(fp)) {
+					csp_buffer_free(csp_packet);
 					break;
+				}
 			}
 
 			/* Chunk number MUST be little-endian!
 			 * Note: Yes, this is due to an old mistake, and now we are stuck with it! :( */
-			packet.data.chunk = csp_htole32(packet.data.chunk);
+			packet->data.chunk = csp_htole32(packet->data.chunk);
 
 			/* Send data */
-			int length = sizeof(ftp_type_t) + sizeof(uint32_t) + ftp_chunk_size;
-			if (csp_transaction_persistent(conn, ftp_timeout, &packet, length, NULL, 0) != 1) {
+			csp_packet->length = length;
+			if (!csp_send(conn, csp_packet, ftp_timeout)) {
 				color_printf(COLOR_RED, "Data transaction failed\r\n");
+				csp_buffer_free(csp_packet);
 				csp_close(conn);
 				break;
 			}
@@ -842,7 +987,7 @@ int ftp_list(uint8_t host, uint8_t port, uint8_t backend, char * path, ftp_list_
 	int reqsiz = sizeof(ftp_type_t) + sizeof(ftp_list_request_t);
 	int repsiz = sizeof(ftp_type_t) + sizeof(ftp_list_reply_t);
 
-	c = csp_connect(CSP_PRIO_NORM, host, port, ftp_timeout, CSP_O_RDP);
+	c = csp_connect(CSP_PRIO_NORM, host, port, ftp_timeout, CSP_O_RDP | CSP_O_RDPFASTOPEN);
 	if (c == NULL)
 		return -1;
 	if (csp_transaction_persistent(c, ftp_timeout, &packet, reqsiz, &packet, repsiz) != repsiz)
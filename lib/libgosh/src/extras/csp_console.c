@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <csp/csp.h>
 #include <csp/csp_cmp.h>
 #include <csp/csp_endian.h>
@@ -14,6 +15,10 @@
 #include <time.h>
 #endif
 
+#if CSP_USE_CAN
+#include <csp/interfaces/csp_if_can.h>
+#endif
+
 #include <conf_gosh.h>
 uint64_t clock_get_nsec(void);
 
@@ -180,6 +185,49 @@ int cmd_csp_rdp_set_opt(struct command_context *ctx) {
 }
 #endif
 
+#if CSP_USE_CAN
+int cmd_csp_can_stats(struct command_context *ctx) {
+	static const char * states[] = {"active", "warning", "passive", "bus off"};
+	csp_can_stats_t stats;
+	int i;
+
+	csp_can_get_stats(&stats);
+
+	printf("RX %"PRIu32" frames %"PRIu32" bytes, TX %"PRIu32" frames %"PRIu32" bytes\r\n",
+			stats.rx_frames, stats.rx_bytes, stats.tx_frames, stats.tx_bytes);
+	if (stats.bitrate > 0)
+		printf("Bus load %"PRIu32".%"PRIu32" %% at %"PRIu32" bit/s\r\n",
+				stats.bus_load / 10, stats.bus_load % 10, stats.bitrate);
+	else
+		printf("Bus load unknown, bitrate not set\r\n");
+
+	printf("State %s, TEC %u REC %u\r\n", stats.errors.state < 4 ? states[stats.errors.state] : "unknown",
+			stats.errors.tx_errors, stats.errors.rx_errors);
+	printf("Errors %"PRIu32": warning %"PRIu32" passive %"PRIu32" bus off %"PRIu32" restarts %"PRIu32"\r\n",
+			stats.errors.error_frames, stats.errors.warning, stats.errors.passive,
+			stats.errors.bus_off, stats.errors.restarts);
+	printf("        arbitration %"PRIu32" protocol %"PRIu32" no ack %"PRIu32" overflow %"PRIu32"\r\n",
+			stats.errors.arbitration, stats.errors.protocol, stats.errors.no_ack, stats.errors.overflow);
+
+	printf("Reassembly: %"PRIu32" packets, %"PRIu32" in use, time min %"PRIu32" avg %"PRIu32" max %"PRIu32" ms\r\n",
+			stats.pbuf.completed, stats.pbuf.in_use, stats.pbuf.time_min,
+			stats.pbuf.completed ? stats.pbuf.time_total / stats.pbuf.completed : 0, stats.pbuf.time_max);
+	printf("            evictions %"PRIu32" timeouts %"PRIu32" out of order %"PRIu32" incomplete %"PRIu32"\r\n",
+			stats.pbuf.evictions, stats.pbuf.timeouts, stats.pbuf.out_of_order, stats.pbuf.incomplete);
+
+	printf("Node      Frames       Bytes  Frames/s   Bytes/s\r\n");
+	for (i = 0; i <= CSP_ID_HOST_MAX; i++) {
+		if (stats.nodes[i].frames == 0)
+			continue;
+		printf("%4u %11"PRIu32" %11"PRIu32" %9"PRIu32" %9"PRIu32"\r\n", i,
+				stats.nodes[i].frames, stats.nodes[i].bytes,
+				stats.nodes[i].frame_rate, stats.nodes[i].byte_rate);
+	}
+
+	return CMD_ERROR_NONE;
+}
+#endif
+
 int cmd_cmp_ident(struct command_context *ctx) {
 
 	int ret;
@@ -278,6 +326,70 @@ int cmd_cmp_ifc(struct command_context *ctx) {
 	return CMD_ERROR_NONE;
 }
 
+static void cmp_ifx_hist_print(const char * name, void * buckets, uint32_t max) {
+
+	uint32_t hist[CSP_IF_HIST_BUCKETS];
+	unsigned int i;
+
+	/* The message is packed, so copy the buckets out before use */
+	memcpy(hist, buckets, CSP_IF_HIST_BUCKETS * sizeof(uint32_t));
+
+	printf("        %s:", name);
+	for (i = 0; i < CSP_IF_HIST_BUCKETS; i++) {
+		hist[i] = csp_ntoh32(hist[i]);
+		if (hist[i] == 0)
+			continue;
+		if (i == 0)
+			printf(" 0:%"PRIu32, hist[i]);
+		else if (i == CSP_IF_HIST_BUCKETS - 1)
+			printf(" %u+:%"PRIu32, 1 << (i - 1), hist[i]);
+		else
+			printf(" %u-%u:%"PRIu32, 1 << (i - 1), (1 << i) - 1, hist[i]);
+	}
+	printf(" max: %"PRIu32" ms\r\n", csp_ntoh32(max));
+
+}
+
+int cmd_cmp_ifx(struct command_context *ctx) {
+
+	uint8_t node;
+	uint32_t timeout;
+	char * interface;
+
+	if (ctx->argc > 4 || ctx->argc < 3)
+		return CMD_ERROR_SYNTAX;
+
+	node = atoi(ctx->argv[1]);
+	interface = ctx->argv[2];
+
+	if (ctx->argc < 4)
+		timeout = 1000;
+	else
+		timeout = atoi(ctx->argv[3]);
+
+	struct csp_cmp_message msg;
+	strncpy(msg.if_xstats.interface, interface, CSP_CMP_ROUTE_IFACE_LEN);
+
+	printf("Requesting extended interface stats for interface %s\r\n", interface);
+
+	int ret = csp_cmp_if_xstats(node, timeout, &msg);
+	if (ret != CSP_ERR_NONE) {
+		printf("Error: %d\r\n", ret);
+		return CMD_ERROR_FAIL;
+	}
+
+	printf("%-5s   fifo: %"PRIu32" route: %"PRIu32" split: %"PRIu32" dedup: %"PRIu32" sec: %"PRIu32" conn: %"PRIu32"\r\n",
+			msg.if_xstats.interface, csp_ntoh32(msg.if_xstats.fifo_full), csp_ntoh32(msg.if_xstats.no_route),
+			csp_ntoh32(msg.if_xstats.split_horizon), csp_ntoh32(msg.if_xstats.dedup),
+			csp_ntoh32(msg.if_xstats.security), csp_ntoh32(msg.if_xstats.no_conn));
+	cmp_ifx_hist_print("rxlat", msg.if_xstats.rx_latency, msg.if_xstats.rx_latency_max);
+	cmp_ifx_hist_print("dwell", msg.if_xstats.dwell, msg.if_xstats.dwell_max);
+	cmp_ifx_hist_print("txlat", msg.if_xstats.tx_latency, msg.if_xstats.tx_latency_max);
+	printf("\r\n");
+
+	return CMD_ERROR_NONE;
+}
+
 int cmd_cmp_peek(struct command_context *ctx) {
 
 	uint8_t node;
@@ -497,6 +609,11 @@ command_t __sub_command cmp_commands[] = {
 		.help = "Remote IFC",
 		.usage = "<node> <interface> [timeout]",
 		.handler = cmd_cmp_ifc,
+	},{
+		.name = "ifx",
+		.help = "Remote IFC drops and latency",
+		.usage = "<node> <interface> [timeout]",
+		.handler = cmd_cmp_ifx,
 	},{
 		.name = "peek",
 		.help = "Show remote memory",
@@ -576,6 +693,13 @@ command_t __root_command csp_commands[] = {
 		.handler = cmd_csp_conn_print_table,
 	},
 #endif
+#if CSP_USE_CAN
+	{
+		.name = "canstat",
+		.help = "csp: Show CAN bus statistics",
+		.handler = cmd_csp_can_stats,
+	},
+#endif
 #if CSP_USE_RDP
 	{
 		.name = "rdpopt",
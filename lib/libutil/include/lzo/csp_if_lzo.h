@@ -0,0 +1,79 @@
+/* LZO compression wrapper for CSP interfaces */
+
+#ifndef CSP_IF_LZO_H_
+#define CSP_IF_LZO_H_
+
+#include <stdint.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_semaphore.h>
+
+/**
+ * The wrapper is an interface stacked on top of another interface. Packets
+ * routed to the wrapper are compressed with LZO1X and sent on the lower
+ * interface with the CSP_FCOMP flag set, unless compression does not make
+ * them smaller. Packets received on the lower interface with CSP_FCOMP are
+ * decompressed by the router before delivery. Both ends of a link must
+ * use the wrapper.
+ */
+
+/** Packets shorter than this are sent uncompressed by default */
+#define CSP_LZO_MIN_LENGTH	32
+
+/** Compression statistics */
+typedef struct {
+	uint32_t tx_compressed;		/**< Packets sent compressed */
+	uint32_t tx_skipped;		/**< Packets sent uncompressed */
+	uint32_t tx_bytes_in;		/**< Bytes before compression */
+	uint32_t tx_bytes_out;		/**< Bytes after compression */
+	uint32_t tx_time_us;		/**< Time spent compressing */
+	uint32_t rx_decompressed;	/**< Packets decompressed */
+	uint32_t rx_errors;		/**< Packets that failed to decompress */
+	uint32_t rx_bytes_in;		/**< Bytes before decompression */
+	uint32_t rx_bytes_out;		/**< Bytes after decompression */
+	uint32_t rx_time_us;		/**< Time spent decompressing */
+} csp_lzo_stats_t;
+
+/**
+ * This structure should be statically allocated by the user
+ * and passed to the wrapper during the init function
+ */
+typedef struct {
+	csp_iface_t * lower;		/**< Wrapped interface */
+	uint8_t enabled;		/**< Compress outgoing packets */
+	uint16_t min_length;		/**< Do not compress packets shorter than this */
+	csp_lzo_stats_t stats;
+	csp_mutex_t lock;		/**< Protects work memory and TX statistics */
+	void * wrkmem;			/**< LZO compression dictionary */
+	uint8_t * txbuf;		/**< Compression output */
+	uint8_t * rxbuf;		/**< Decompression output */
+	uint32_t bufsize;		/**< Largest packet data the buffers hold */
+} csp_lzo_handle_t;
+
+/**
+ * Setup compression wrapper on top of an interface. Route destinations
+ * to iface instead of lower to send them compressed.
+ * @param iface Wrapper interface, statically allocated by the user
+ * @param handle Wrapper handle, statically allocated by the user
+ * @param name Interface name
+ * @param lower Interface to send compressed packets on, must be initialized
+ * @return CSP_ERR
+ */
+int csp_lzo_init(csp_iface_t * iface, csp_lzo_handle_t * handle, const char * name, csp_iface_t * lower);
+
+/**
+ * Enable or disable compression of outgoing packets. Received compressed
+ * packets are always decompressed.
+ * @param iface Wrapper interface
+ * @param enable 1 to compress, 0 to send uncompressed
+ */
+void csp_lzo_enable(csp_iface_t * iface, uint8_t enable);
+
+/**
+ * Get compression statistics
+ * @param iface Wrapper interface
+ * @param stats Statistics output
+ */
+void csp_lzo_get_stats(csp_iface_t * iface, csp_lzo_stats_t * stats);
+
+#endif /* CSP_IF_LZO_H_ */
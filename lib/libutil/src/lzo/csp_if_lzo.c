@@ -0,0 +1,157 @@
+/* LZO compression wrapper for CSP interfaces
+ *
+ * Packets are compressed one at a time with LZO1X-1 from minilzo. The lzop
+ * framing used by lzo_compress_buffer() adds about 40 bytes of header,
+ * which is more than is saved on a typical packet, so compressed packets
+ * carry the raw LZO1X stream and are marked with CSP_FCOMP.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/csp_interface.h>
+#include <csp/arch/csp_semaphore.h>
+#include <lzo/minilzo.h>
+#include <lzo/csp_if_lzo.h>
+#include <util/clock.h>
+
+/* Worst case LZO1X output size */
+#define LZO_OUT_SIZE(len)	((len) + (len) / 16 + 64 + 3)
+
+static int csp_lzo_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
+
+	csp_lzo_handle_t * handle = interface->driver;
+	csp_iface_t * lower = handle->lower;
+	uint16_t length = packet->length;
+
+	/* Encrypted and very short payloads do not compress */
+	if (!handle->enabled || length < handle->min_length || length > handle->bufsize ||
+			(packet->id.flags & (CSP_FXTEA | CSP_FCOMP))) {
+		csp_mutex_lock(&handle->lock, CSP_MAX_DELAY);
+		handle->stats.tx_skipped++;
+		csp_mutex_unlock(&handle->lock);
+	} else {
+		lzo_uint out_len;
+		csp_mutex_lock(&handle->lock, CSP_MAX_DELAY);
+		uint64_t start = clock_get_nsec();
+		int ret = lzo1x_1_compress(packet->data, length, handle->txbuf, &out_len, handle->wrkmem);
+		if (ret == LZO_E_OK && out_len < length) {
+			memcpy(packet->data, handle->txbuf, out_len);
+			packet->length = out_len;
+			packet->id.flags |= CSP_FCOMP;
+			handle->stats.tx_compressed++;
+			handle->stats.tx_bytes_in += length;
+			handle->stats.tx_bytes_out += out_len;
+		} else {
+			handle->stats.tx_skipped++;
+		}
+		handle->stats.tx_time_us += (clock_get_nsec() - start) / 1000;
+		csp_mutex_unlock(&handle->lock);
+	}
+
+	/* Account wire bytes on the lower interface */
+	uint16_t bytes = packet->length;
+	if ((*lower->nexthop)(lower, packet, timeout) != CSP_ERR_NONE) {
+		lower->tx_error++;
+		return CSP_ERR_TX;
+	}
+
+	lower->tx++;
+	lower->txbytes += bytes;
+
+	return CSP_ERR_NONE;
+
+}
+
+static int csp_lzo_rx(csp_iface_t * interface, csp_packet_t * packet) {
+
+	csp_lzo_handle_t * handle = interface->driver;
+
+	if ((packet->id.flags & CSP_FCOMP) == 0)
+		return CSP_ERR_NONE;
+
+	/* Output must fit both the packet buffer and the receive buffer */
+	lzo_uint out_len = csp_buffer_size_of(packet) - CSP_BUFFER_PACKET_OVERHEAD;
+	if (out_len > handle->bufsize)
+		out_len = handle->bufsize;
+
+	/* Only called from the router task, so the receive buffer needs no lock */
+	uint64_t start = clock_get_nsec();
+	int ret = lzo1x_decompress_safe(packet->data, packet->length, handle->rxbuf, &out_len, NULL);
+	handle->stats.rx_time_us += (clock_get_nsec() - start) / 1000;
+
+	if (ret != LZO_E_OK) {
+		csp_log_warn("LZO: Failed to decompress packet from %u: %d", packet->id.src, ret);
+		handle->stats.rx_errors++;
+		return CSP_ERR_INVAL;
+	}
+
+	handle->stats.rx_decompressed++;
+	handle->stats.rx_bytes_in += packet->length;
+	handle->stats.rx_bytes_out += out_len;
+
+	memcpy(packet->data, handle->rxbuf, out_len);
+	packet->length = out_len;
+	packet->id.flags &= ~CSP_FCOMP;
+
+	return CSP_ERR_NONE;
+
+}
+
+void csp_lzo_enable(csp_iface_t * iface, uint8_t enable) {
+	csp_lzo_handle_t * handle = iface->driver;
+	handle->enabled = enable;
+}
+
+void csp_lzo_get_stats(csp_iface_t * iface, csp_lzo_stats_t * stats) {
+	csp_lzo_handle_t * handle = iface->driver;
+	csp_mutex_lock(&handle->lock, CSP_MAX_DELAY);
+	*stats = handle->stats;
+	csp_mutex_unlock(&handle->lock);
+}
+
+int csp_lzo_init(csp_iface_t * iface, csp_lzo_handle_t * handle, const char * name, csp_iface_t * lower) {
+
+	/* Sized for the largest buffer class at init, larger packets are sent uncompressed */
+	size_t datasize = csp_buffer_size() - CSP_BUFFER_PACKET_OVERHEAD;
+
+	if (lzo_init() != LZO_E_OK)
+		return CSP_ERR_DRIVER;
+
+	memset(handle, 0, sizeof(*handle));
+	handle->lower = lower;
+	handle->enabled = 1;
+	handle->min_length = CSP_LZO_MIN_LENGTH;
+	handle->bufsize = datasize;
+
+	if (csp_mutex_create(&handle->lock) != CSP_MUTEX_OK)
+		return CSP_ERR_NOMEM;
+
+	handle->wrkmem = malloc(LZO1X_1_MEM_COMPRESS);
+	handle->txbuf = malloc(LZO_OUT_SIZE(datasize));
+	handle->rxbuf = malloc(datasize);
+	if (handle->wrkmem == NULL || handle->txbuf == NULL || handle->rxbuf == NULL) {
+		free(handle->wrkmem);
+		free(handle->txbuf);
+		free(handle->rxbuf);
+		return CSP_ERR_NOMEM;
+	}
+
+	/* Setup interface */
+	iface->driver = handle;
+	iface->name = name;
+	iface->nexthop = csp_lzo_tx;
+	iface->upper_rx = csp_lzo_rx;
+	iface->mtu = lower->mtu;
+
+	/* Receive packets from the lower interface */
+	lower->upper = iface;
+
+	/* Regsiter interface */
+	csp_iflist_add(iface);
+
+	return CSP_ERR_NONE;
+
+}
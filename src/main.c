@@ -35,13 +35,21 @@
 
 const vmem_t vmem_map[] = {{0}};
 
+/* Jumbo buffers for ground interfaces with a large MTU */
+#define JUMBO_SIZE	4096
+#define JUMBO_COUNT	32
+
 static void print_help(void) {
 	printf(" usage: csp-client <-d|-c|-z> [optargs]\r\n");
 	printf("  -d DEVICE,\tSet device (default: /dev/ttyUSB0)\r\n");
 	printf("  -c DEVICE,\tSet can device (default: can0)\r\n");
+	printf("  -f,\t\tUse CAN FD frames on can device\r\n");
+	printf("  -r BITRATE,\tSet can bitrate, used for bus load (default: unknown)\r\n");
 	printf("  -z SERVER,\tSet ZMQ server (default: localhost)\r\n");
+	printf("  -m MTU,\tSet ZMQ MTU, up to %u (default: 256)\r\n", JUMBO_SIZE);
 	printf("  -a ADDRESS,\tSet address (default: 8)\r\n");
 	printf("  -b BAUD,\tSet baud rate (default: 500000)\r\n");
+	printf("  -w WINDOW,\tSet RDP window size (default: 6)\r\n");
 	printf("  -h,\t\tPrint help and exit\r\n");
 }
 
@@ -64,6 +72,7 @@ int main(int argc, char * argv[]) {
 
 	/* Config */
 	uint8_t addr = 8;
+	unsigned int rdp_window = 6;
 
 	/* KISS STUFF */
 	char * device = "/dev/ttyUSB0";
@@ -73,10 +82,13 @@ int main(int argc, char * argv[]) {
 	/* CAN STUFF */
 	char * ifc = "can0";
 	uint8_t use_can = 0;
+	uint8_t use_can_fd = 0;
+	uint32_t can_bitrate = 0;
 
 	/* ZMQ STUFF */
 	char zmqhost[100] = "localhost";
 	uint8_t use_zmq = 0;
+	uint16_t zmq_mtu = 0;
 
 	/* Console exit */
 	atexit(exithandler);
@@ -93,7 +105,7 @@ int main(int argc, char * argv[]) {
 	 * Parser
 	 **/
 	int c;
-	while ((c = getopt(argc, argv, "a:b:c:d:hz:")) != -1) {
+	while ((c = getopt(argc, argv, "a:b:c:d:fhm:r:w:z:")) != -1) {
 		switch (c) {
 		case 'a':
 			addr = atoi(optarg);
@@ -105,10 +117,24 @@ int main(int argc, char * argv[]) {
 			use_can = 1;
 			ifc = optarg;
 			break;
+		case 'f':
+			use_can_fd = 1;
+			break;
 		case 'd':
 			device = optarg;
 			use_kiss = 1;
 			break;
+		case 'm':
+			zmq_mtu = atoi(optarg);
+			if (zmq_mtu > JUMBO_SIZE)
+				zmq_mtu = JUMBO_SIZE;
+			break;
+		case 'r':
+			can_bitrate = atoi(optarg);
+			break;
+		case 'w':
+			rdp_window = atoi(optarg);
+			break;
 		case 'h':
 			print_help();
 			exit(0);
@@ -130,9 +156,11 @@ int main(int argc, char * argv[]) {
 	csp_set_model("CSP Client");
 	csp_set_revision(CSPCLIENT_VERSION);
 	csp_buffer_init(400, 512);
+	csp_buffer_init_class(JUMBO_COUNT, JUMBO_SIZE);
 	csp_init(addr);
 	log_csp_init();
-	csp_rdp_set_opt(6, 30000, 16000, 1, 8000, 3);
+	csp_rdp_set_opt(rdp_window, 30000, 16000, 1, 8000, 3);
+	csp_rdp_set_suspend(120000);
 
 	/**
 	 * KISS interface
@@ -157,6 +185,8 @@ int main(int argc, char * argv[]) {
 	 */
 	if (use_zmq == 1) {
 		csp_zmqhub_init(addr, zmqhost);
+		if (zmq_mtu > 0)
+			csp_if_zmqhub.mtu = zmq_mtu;
 		csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_zmqhub, CSP_NODE_MAC);
 	}
 
@@ -164,7 +194,7 @@ int main(int argc, char * argv[]) {
 	 * CAN Interface
 	 */
 	if (use_can == 1) {
-		struct csp_can_config conf = {.ifc = ifc};
+		struct csp_can_config conf = {.ifc = ifc, .fd = use_can_fd, .bitrate = can_bitrate};
 		csp_can_init(CSP_CAN_MASKED, &conf);
 		csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_can, CSP_NODE_MAC);
 	}